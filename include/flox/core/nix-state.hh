@@ -41,7 +41,11 @@ makeFilteredLogger( bool printBuildLogs );
 /* -------------------------------------------------------------------------- */
 
 /**
- * @brief Perform one time `nix` global runtime setup.
+ * @brief Perform one time setup of `nix` settings and logging.
+ *
+ * This loads `nix.conf` and sets `flox` defaults for `nix` settings, but
+ * unlike @a initNix it does not initialize the garbage collector or load
+ * plugins, which are only needed to open a store or evaluator.
  *
  * You may safely call this function multiple times, after the first invocation
  * it is effectively a no-op.
@@ -49,6 +53,21 @@ makeFilteredLogger( bool printBuildLogs );
  * This replaces the default `nix::Logger` with a @a flox::FilteredLogger.
  */
 void
+initNixConfig();
+
+
+/**
+ * @brief Perform one time `nix` global runtime setup.
+ *
+ * This performs @a initNixConfig, initializes the garbage collector, and
+ * loads plugins.
+ * This is called lazily when a store connection is opened, so commands which
+ * only read existing databases never pay for it.
+ *
+ * You may safely call this function multiple times, after the first invocation
+ * it is effectively a no-op.
+ */
+void
 initNix();
 
 
@@ -94,18 +113,23 @@ public:
   /**
    * @brief Construct `NixStoreMixin` using the systems default `nix` store.
    */
-  NixStoreMixin() { initNix(); }
+  NixStoreMixin() { initNixConfig(); }
 
 
   /**
    * @brief Lazily open a `nix` store connection.
    *
    * Connection remains open for lifetime of object.
+   * The `nix` runtime is initialized before the first connection is opened.
    */
   nix::ref<nix::Store>
   getStore()
   {
-    if ( this->store == nullptr ) { this->store = nix::openStore(); }
+    if ( this->store == nullptr )
+      {
+        initNix();
+        this->store = nix::openStore();
+      }
     return static_cast<nix::ref<nix::Store>>( this->store );
   }
 
@@ -155,6 +179,7 @@ public:
   {
     if ( this->state == nullptr )
       {
+        initNix();
         this->state = std::make_shared<nix::EvalState>( nix::SearchPath(),
                                                         this->getStore(),
                                                         this->getStore() );
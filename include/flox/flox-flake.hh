@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <filesystem>
 #include <memory>
 #include <nix/eval.hh>
 #include <nix/flake/flake.hh>
@@ -57,6 +58,41 @@ static const nix::flake::LockFlags defaultLockFlags = {
 };
 
 
+/* -------------------------------------------------------------------------- */
+
+/** @brief How @a flox::FloxFlake uses `nix`'s SQLite eval cache. */
+enum eval_cache_mode {
+  /** Open the eval cache, creating and populating it as needed. */
+  ECM_READ_WRITE = 0,
+  /**
+   * Only open an eval cache which already exists, otherwise evaluate
+   * in memory.
+   * Attributes missing from an existing cache are still added to it.
+   */
+  ECM_WARM = 1,
+  /** Evaluate in memory without an eval cache. */
+  ECM_NONE = 2
+}; /* End enum `eval_cache_mode' */
+
+
+/**
+ * @brief The eval cache mode used by @a flox::FloxFlake::openEvalCache.
+ *
+ * An eval cache is only used in pure evaluation mode, and only if
+ * `nix::evalSettings.useEvalCache` is set.
+ */
+extern eval_cache_mode evalCacheMode;
+
+
+/**
+ * @brief Get the path to the `nix` eval cache for a locked flake.
+ * @param fingerprint The locked flake's fingerprint.
+ * @return The path to a SQLite3 database, which may not exist.
+ */
+[[nodiscard]] std::filesystem::path
+getEvalCachePath( const nix::flake::Fingerprint & fingerprint );
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -91,6 +127,7 @@ public:
   /**
    * Open a `nix` evaluator ( with an eval cache when possible ) with the
    * evaluated `flake` and its outputs in global scope.
+   * Whether an eval cache is used depends on @a flox::evalCacheMode.
    * @return A `nix` evaluator, potentially with caching.
    */
   nix::ref<nix::eval_cache::EvalCache>
@@ -0,0 +1,232 @@
+/* ========================================================================== *
+ *
+ * @file flox/pkgdb/cache-index.hh
+ *
+ * @brief An index of package databases in a cache directory.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <sqlite3pp.hh>
+
+#include "flox/core/types.hh"
+#include "flox/pkgdb/read.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Name of the index database file in a cache directory. */
+constexpr const char * CACHE_INDEX_NAME = "index.sqlite";
+
+/**
+ * @brief Minimum time between updates to a database's last access time by
+ *        @a flox::pkgdb::recordCacheAccess.
+ */
+constexpr std::chrono::seconds CACHE_ACCESS_INTERVAL( 3600 );
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Summary of a package database held in a @a CacheIndex. */
+struct CacheEntry
+{
+
+  Fingerprint                   fingerprint; /**< Hash of associated flake. */
+  std::filesystem::path         path;        /**< Path to the database. */
+  PkgDbReadOnly::LockedFlakeRef lockedRef;   /**< Locked flake reference. */
+  /** Size of the database in bytes when it was last indexed. */
+  std::uintmax_t size = 0;
+  /** Time the database was last opened, in seconds since the epoch. */
+  std::time_t lastAccess = 0;
+  /** Completely scraped `<SUBTREE>.<SYSTEM>` prefixes. */
+  std::vector<std::string> prefixes;
+
+  CacheEntry() : fingerprint( nix::htSHA256 ) {}
+
+
+}; /* End struct `CacheEntry' */
+
+
+/** @brief Convert a @a flox::pkgdb::CacheEntry to a JSON object. */
+void
+to_json( nlohmann::json & jto, const CacheEntry & entry );
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief An index of package databases in a cache directory, recording their
+ *        locked references, sizes, scraped prefixes, and last access times.
+ *
+ * The index lives in the cache directory alongside the databases it
+ * describes, so that listing and evicting databases doesn't require
+ * opening each of them.
+ *
+ * Writes to the index are best effort, failures to update it are logged
+ * and ignored since the index may always be rebuilt with @a refresh.
+ */
+class CacheIndex
+{
+
+private:
+
+  std::filesystem::path cacheDir; /**< Directory holding databases. */
+  SQLiteDb              db;       /**< Index database connection. */
+
+
+  /** @brief Create the index's tables if they don't exist. */
+  void
+  initTables();
+
+  /**
+   * @brief Add or update an entry for a database.
+   * @param pdb The database, or one of its shards.
+   * @param path Path to the database, which may not exist if @a pdb is
+   *             a shard.
+   * @param lastAccess Time the database was last opened.
+   */
+  void
+  upsertEntry( PkgDbReadOnly &               pdb,
+               const std::filesystem::path & path,
+               std::time_t                   lastAccess );
+
+  /** @brief Remove an entry for a database. */
+  void
+  removeEntry( const Fingerprint & fingerprint );
+
+
+public:
+
+  /**
+   * @brief Open or create the index of a cache directory.
+   * @param cacheDir Directory holding package databases.
+   */
+  explicit CacheIndex( std::filesystem::path cacheDir = getPkgDbCachedir() );
+
+  /** @return Directory holding package databases. */
+  [[nodiscard]] const std::filesystem::path &
+  getCacheDir() const
+  {
+    return this->cacheDir;
+  }
+
+  /**
+   * @brief Record that a database was opened, updating its size, scraped
+   *        prefixes, and last access time.
+   * @param pdb An open database in the cache directory.
+   */
+  void
+  recordAccess( PkgDbReadOnly & pdb );
+
+  /**
+   * @brief Get the last access time recorded for a database without
+   *        creating or writing to the index.
+   * @param cacheDir Directory holding package databases.
+   * @param fingerprint Fingerprint of the database's flake.
+   * @return The last access time in seconds since the epoch, or
+   *         `std::nullopt` if the database isn't indexed.
+   */
+  [[nodiscard]] static std::optional<std::time_t>
+  getLastAccess( const std::filesystem::path & cacheDir,
+                 const Fingerprint &           fingerprint );
+
+  /**
+   * @brief Synchronize the index with the cache directory.
+   *
+   * Databases missing from the index are added using their modification time
+   * as their last access time, entries for databases which no longer exist
+   * are removed, and the sizes of all databases are updated.
+   * Sizes include shards created by `pkgdb scrape --shard`, and databases
+   * with shards which haven't been merged are indexed as well.
+   */
+  void
+  refresh();
+
+  /**
+   * @brief List all indexed databases.
+   * @return Entries ordered from most to least recently accessed.
+   */
+  [[nodiscard]] std::vector<CacheEntry>
+  getEntries();
+
+  /**
+   * @brief Delete the least recently accessed databases and their shards
+   *        until the total size of the cache directory's databases is at most
+   *        @a maxSize bytes.
+   *
+   * Databases are locked with @a flox::pkgdb::lockPkgDb while they're
+   * deleted, and those being scraped by other processes are skipped.
+   * @param maxSize Maximum total size of databases in bytes.
+   * @param dryRun If `true` report databases that would be deleted without
+   *               deleting them.
+   * @return Entries for deleted databases.
+   */
+  std::vector<CacheEntry>
+  collectGarbage( std::uintmax_t maxSize, bool dryRun = false );
+
+
+}; /* End class `CacheIndex' */
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Summarize the databases in a cache directory without reading or
+ *        writing its index, for use when @a cacheDir isn't writable.
+ *
+ * Last access times are approximated by modification times.
+ * @param cacheDir Directory holding package databases.
+ * @return Entries ordered from most to least recently accessed.
+ */
+[[nodiscard]] std::vector<CacheEntry>
+scanCacheDir( const std::filesystem::path & cacheDir );
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Record that a database was opened in the index of its cache
+ *        directory, ignoring any errors.
+ *
+ * Last access times only order evictions, so to avoid writing to the index
+ * every time a database is opened they are only updated once they are older
+ * than @a flox::pkgdb::CACHE_ACCESS_INTERVAL, unless @a modified is set.
+ *
+ * This is a no-op for databases outside of @a cacheDir, or if @a cacheDir
+ * isn't writable.
+ * @param pdb An open database.
+ * @param cacheDir Directory holding package databases.
+ * @param modified Whether @a pdb was just written to, in which case its size
+ *                 and scraped prefixes are always updated.
+ */
+void
+recordCacheAccess( PkgDbReadOnly &               pdb,
+                   const std::filesystem::path & cacheDir,
+                   bool                          modified = false );
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+
 #include "flox/core/command.hh"
 #include "flox/pkgdb/input.hh"
 #include "flox/pkgdb/write.hh"
@@ -18,6 +21,19 @@
 
 namespace flox::pkgdb {
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Parse a size in bytes with an optional `K`, `M`, or `G` suffix
+ *        indicating a power of 1024.
+ *
+ * Throws @a flox::command::InvalidArgException if @a str is invalid, or if
+ * the size doesn't fit in `std::uintmax_t`.
+ */
+[[nodiscard]] std::uintmax_t
+parseSize( const std::string & str );
+
+
 /* -------------------------------------------------------------------------- */
 
 /** @brief Adds a single package database path to a state blob. */
@@ -85,6 +101,13 @@ private:
   std::optional<PkgDbInput> input;
   /** Whether to force re-evaluation. */
   bool force = false;
+  /** Whether to write to a database shard for the prefix. */
+  bool shard = false;
+  /** Whether to scrape a skeleton, whether to retry failed attributes, and
+   *  per-attribute evaluation budgets. */
+  ScrapeOptions options;
+  /** Optional `Packages` columns to scrape. */
+  std::optional<ScrapeFields> fields;
 
   /** @brief Initialize @a input from @a registryInput. */
   void
@@ -245,6 +268,80 @@ public:
 }; /* End class `ListCommand' */
 
 
+/* -------------------------------------------------------------------------- */
+
+/** @brief Evict least recently used databases from a cache directory. */
+class GcCommand
+{
+
+private:
+
+  command::VerboseParser               parser;
+  std::optional<std::filesystem::path> cacheDir;
+  std::optional<std::uintmax_t>        maxSize;
+  bool                                 dryRun = false;
+  bool                                 json   = false;
+
+
+public:
+
+  GcCommand();
+
+  [[nodiscard]] command::VerboseParser &
+  getParser()
+  {
+    return this->parser;
+  }
+
+  /**
+   * @brief Execute the `gc` routine.
+   * @return `EXIT_SUCCESS` or `EXIT_FAILURE`.
+   */
+  int
+  run();
+
+
+}; /* End class `GcCommand' */
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Consolidate database shards created by `pkgdb scrape --shard` into
+ *        a single database.
+ */
+class MergeCommand : public DbPathMixin
+{
+
+private:
+
+  command::VerboseParser parser;
+  std::filesystem::path  shardDir;
+  /** Whether to merge shards which haven't been completely scraped. */
+  bool all = false;
+
+
+public:
+
+  MergeCommand();
+
+  [[nodiscard]] command::VerboseParser &
+  getParser()
+  {
+    return this->parser;
+  }
+
+  /**
+   * @brief Execute the `merge` routine.
+   * @return `EXIT_SUCCESS` or `EXIT_FAILURE`.
+   */
+  int
+  run();
+
+
+}; /* End class `MergeCommand' */
+
+
 /* -------------------------------------------------------------------------- */
 
 }  // namespace flox::pkgdb
@@ -0,0 +1,145 @@
+/* ========================================================================== *
+ *
+ * @file flox/pkgdb/eval-watchdog.hh
+ *
+ * @brief Interrupts evaluation of attributes which exceed a time or
+ *        allocation budget.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <nix/util.hh>
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Thrown by `nix::checkInterrupt()` while evaluating an attribute
+ *        which exceeded its budget.
+ */
+class EvalBudgetExceeded : public nix::Interrupted
+{
+public:
+
+  using nix::Interrupted::Interrupted;
+}; /* End class `EvalBudgetExceeded' */
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Limits the time spent and memory allocated while evaluating
+ *        a single attribute.
+ *
+ * A watchdog thread checks the budget of the attribute being evaluated, and
+ * once it is exceeded the next call to `nix::checkInterrupt()` on the
+ * evaluating thread throws @a flox::pkgdb::EvalBudgetExceeded.
+ * Evaluation is only interrupted where `nix` checks for interrupts, and
+ * user interrupts are handled as usual.
+ *
+ * The watchdog must be created, armed, and destroyed on the evaluating
+ * thread, since `nix::interruptCheck` is thread local.
+ * No thread is started unless a budget is given.
+ */
+class EvalWatchdog
+{
+
+private:
+
+  /** Maximum time spent evaluating an attribute. */
+  std::optional<std::chrono::milliseconds> timeBudget;
+  /** Maximum number of bytes allocated evaluating an attribute. */
+  std::optional<std::size_t> allocBudget;
+
+  /** Guards @a armed, @a stopping, @a started, @a startBytes, and
+   *  @a reason. */
+  std::mutex                            mutex;
+  std::condition_variable               changed; /**< Signalled on (dis)arm. */
+  bool                                  armed    = false;
+  bool                                  stopping = false;
+  std::chrono::steady_clock::time_point started; /**< When armed. */
+  std::size_t startBytes = 0; /**< Bytes allocated when armed. */
+  std::string reason;         /**< Why the budget was exceeded. */
+
+  /** Set by the watchdog thread once the budget is exceeded. */
+  std::atomic<bool> expired = false;
+
+  /** `nix::interruptCheck` from before the watchdog was created. */
+  std::function<bool()> prevInterruptCheck;
+
+  std::thread watcher; /**< Thread running @a run. */
+
+
+  /** @brief Check the budget until @a stopping is set. */
+  void
+  run();
+
+  /** @brief Throw if the budget was exceeded, called by `nix`. */
+  bool
+  interruptCheck();
+
+
+public:
+
+  /**
+   * @brief Start a watchdog on the current thread.
+   * @param timeBudget Maximum time spent evaluating an attribute.
+   * @param allocBudget Maximum number of bytes allocated evaluating an
+   *                    attribute.
+   *                    This is ignored if `nix` was built without a garbage
+   *                    collector.
+   */
+  EvalWatchdog( std::optional<std::chrono::milliseconds> timeBudget,
+                std::optional<std::size_t>               allocBudget );
+
+  EvalWatchdog( const EvalWatchdog & ) = delete;
+  EvalWatchdog( EvalWatchdog && )      = delete;
+
+  /** @brief Stop the watchdog thread and restore `nix::interruptCheck`. */
+  ~EvalWatchdog();
+
+  EvalWatchdog &
+  operator=( const EvalWatchdog & )
+    = delete;
+  EvalWatchdog &
+  operator=( EvalWatchdog && )
+    = delete;
+
+  /** @brief Start charging evaluation to a new attribute. */
+  void
+  arm();
+
+  /** @brief Stop charging evaluation to any attribute. */
+  void
+  disarm();
+
+
+}; /* End class `EvalWatchdog' */
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
@@ -10,12 +10,14 @@
 #pragma once
 
 #include <filesystem>
+#include <map>
 #include <memory>
 #include <nlohmann/json_fwd.hpp>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -66,6 +68,18 @@ private:
   /** Path to the flake's pkgdb SQLite3 file. */
   std::filesystem::path dbPath;
 
+  /**
+   * Fingerprint of the locked flake, if it was known without locking the
+   * flake ( such as from a lockfile ).
+   */
+  std::optional<Fingerprint> knownFingerprint;
+
+  /**
+   * Cache directory holding the database, if it is managed by a
+   * @a flox::pkgdb::CacheIndex.
+   */
+  std::optional<std::filesystem::path> cacheDir;
+
   /**
    * A read-only database connection that remains open for the lifetime of
    * @a this object.
@@ -81,6 +95,13 @@ private:
   /** The name of the input, used to emit output with shortnames. */
   std::optional<std::string> name;
 
+  /**
+   * Sorted `pname` and `attrName` lists for completely scraped prefixes,
+   * loaded lazily by @a mayHaveMatches, and cleared whenever scraping adds
+   * packages.
+   */
+  std::map<flox::AttrPath, std::vector<std::string>> packageNames;
+
 
   /**
    * @brief Prepare database handles for use.
@@ -98,6 +119,39 @@ private:
   void
   init();
 
+  /**
+   * @brief Merge completely scraped shards of the database created by
+   *        `pkgdb scrape --shard` into the database.
+   *
+   * Database and filesystem errors are logged as warnings and ignored,
+   * leaving the shard to be merged later.
+   */
+  void
+  mergeShards();
+
+  /**
+   * @brief List the `<SUBTREE>.<SYSTEM>` prefixes which may be searched by
+   *        a query.
+   * @param args Query parameters to list prefixes for.
+   * @return Prefixes of enabled subtrees which are also allowed by
+   *         @a args.subtrees, for each of @a args.systems.
+   */
+  [[nodiscard]] std::vector<flox::AttrPath>
+  getQueryPrefixes( const PkgQueryArgs & args );
+
+  /**
+   * @brief Fill in the `meta` fields of some packages in a prefix which was
+   *        scraped as a _skeleton_, leaving the rest for a later backfill.
+   * @param prefix Attribute path of the skeleton prefix.
+   * @param packageIds `Packages.id`s to backfill, packages outside of
+   *                   @a prefix or which aren't skeletons are ignored.
+   * @param options Per-attribute evaluation budgets.
+   */
+  void
+  backfillPackages( const flox::AttrPath &      prefix,
+                    const std::vector<row_id> & packageIds,
+                    const ScrapeOptions &       options );
+
 
 public:
 
@@ -132,6 +186,27 @@ public:
     this->init();
   }
 
+  /**
+   * @brief Construct a @a PkgDbInput from a @a FloxFlakeInput and a path to
+   *        the database, reusing the input's flake if it was already locked.
+   * @param input A @a FloxFlakeInput.
+   * @param dbPath Path to the database.
+   * @param db_path_tag Tag used to disambiguate this constructor from
+   *                    other constructor which takes a cache directory.
+   * @param name Name of the input ( empty implies N/A ).
+   */
+  PkgDbInput( FloxFlakeInput        input,
+              std::filesystem::path dbPath,
+              const db_path_tag & /* unused */
+              ,
+              const std::string & name = "" )
+    : FloxFlakeInput( std::move( input ) )
+    , dbPath( std::move( dbPath ) )
+    , name( name.empty() ? std::nullopt : std::make_optional( name ) )
+  {
+    this->init();
+  }
+
   /**
    * @brief Construct a @a PkgDbInput from a @a RegistryInput and a path to
    *        the directory where the database should be cached.
@@ -148,6 +223,34 @@ public:
     : FloxFlakeInput( store, input )
     , dbPath( genPkgDbName( this->getFlake()->lockedFlake.getFingerprint(),
                             cacheDir ) )
+    , cacheDir( cacheDir )
+    , name( name.empty() ? std::nullopt : std::make_optional( name ) )
+  {
+    this->init();
+  }
+
+  /**
+   * @brief Construct a @a PkgDbInput from a locked @a RegistryInput and the
+   *        fingerprint of its flake, such as those recorded in a lockfile.
+   *
+   * The flake is only locked and evaluated if its database must be created
+   * or scraped, so cached databases are opened without a `nix` evaluator.
+   * @param store A `nix` store connection.
+   * @param input A @a RegistryInput with a locked flake reference.
+   * @param fingerprint Unique hash associated with the locked flake.
+   * @param cacheDir Path to the directory where the database should
+   *                 be cached.
+   * @param name Name of the input ( empty implies N/A ).
+   */
+  PkgDbInput( nix::ref<nix::Store> &        store,
+              const RegistryInput &         input,
+              const Fingerprint &           fingerprint,
+              const std::filesystem::path & cacheDir = getPkgDbCachedir(),
+              const std::string &           name     = "" )
+    : FloxFlakeInput( store, input )
+    , dbPath( genPkgDbName( fingerprint, cacheDir ) )
+    , knownFingerprint( fingerprint )
+    , cacheDir( cacheDir )
     , name( name.empty() ? std::nullopt : std::make_optional( name ) )
   {
     this->init();
@@ -192,10 +295,17 @@ public:
    * If a read/write connection is already open when @a scrapePrefix is called
    * it will remain open, but if the connection is opened by @a scrapePrefix
    * it will be closed after scraping is completed.
+   *
+   * A _skeleton_ scrape skips packages' `meta` fields, which is much faster.
+   * Scraping a skeleton prefix again without `options.skeleton` backfills
+   * them.
    * @param prefix Attribute path to scrape.
+   * @param options Whether to scrape a skeleton, and whether to retry
+   *                attributes which previously failed to evaluate.
    */
   void
-  scrapePrefix( const flox::AttrPath & prefix );
+  scrapePrefix( const flox::AttrPath & prefix,
+                const ScrapeOptions &  options = {} );
 
   /**
    * @brief Scrape all prefixes indicated by @a InputPreferences for
@@ -205,6 +315,60 @@ public:
   void
   scrapeSystems( const std::vector<System> & systems );
 
+  /**
+   * @brief Scrape a single package without scraping its whole prefix.
+   *
+   * Only the cursors along @a absPath are evaluated, and the package is
+   * added to a partial ( not `done` ) subtree of `AttrSets`, so a later
+   * @a scrapePrefix call will still scrape the rest of the prefix.
+   *
+   * Packages are only added if @a scrapePrefix would also find them, so
+   * queries return the same results either way.
+   * @param absPath Absolute attribute path to a package such as
+   *                `legacyPackages.x86_64-linux.python3Packages.numpy`.
+   * @param options Per-attribute evaluation budgets.
+   * @return `true` if the database holds the same packages at @a absPath as
+   *         it would after scraping its prefix, or `false` if evaluation
+   *         failed or exceeded its budget and the caller should scrape the
+   *         prefix instead.
+   */
+  bool
+  scrapeAttrPath( const flox::AttrPath & absPath,
+                  const ScrapeOptions &  options = {} );
+
+  /**
+   * @brief Scrape only the prefixes which may be searched by a query.
+   *
+   * This scrapes each of @a args.systems for any enabled subtrees which are
+   * also allowed by @a args.subtrees.
+   * Prefixes which have already been scraped are skipped.
+   * If @a args.relPath is set only the cursors along that path are scraped
+   * using @a scrapeAttrPath.
+   * Prefixes are scraped as a skeleton unless @a args matches packages by
+   * `meta` fields, in which case skeleton prefixes are backfilled.
+   * Filtering by `broken` or `unfree` only backfills the packages which
+   * match @a args otherwise.
+   * @param args Query parameters to scrape prefixes for.
+   */
+  void
+  scrapeForQuery( const PkgQueryArgs & args );
+
+  /**
+   * @brief Quickly check whether a query could have any results without
+   *        running it.
+   *
+   * Queries which filter by @a args.pname, @a args.pnameOrAttrName, or
+   * @a args.relPath are checked against the names of packages in each
+   * prefix they search.
+   * These names are kept in memory after being read once.
+   * @param args Query parameters to check.
+   * @return `false` if every prefix searched by @a args has been completely
+   *         scraped and none of them contain the requested names,
+   *         otherwise `true`.
+   */
+  [[nodiscard]] bool
+  mayHaveMatches( const PkgQueryArgs & args );
+
   /** @brief Add/set a shortname for this input. */
   void
   setName( std::string_view name )
@@ -219,8 +383,7 @@ public:
   [[nodiscard]] std::string
   getNameOrURL()
   {
-    return this->name.value_or(
-      this->getFlake()->lockedFlake.flake.lockedRef.to_string() );
+    return this->name.value_or( this->getDbReadOnly()->lockedRef.string );
   }
 
   /** @brief Get a JSON representation of a row in the database. */
@@ -237,15 +400,31 @@ public:
 class PkgDbInputFactory
 {
 
+public:
+
+  using input_type = PkgDbInput;
+
+  /**
+   * @brief Inputs which may be shared by multiple registries, keyed by
+   *        their name and @a RegistryInput.
+   */
+  using SharedInputs
+    = std::unordered_map<std::string, std::shared_ptr<PkgDbInput>>;
+
+
 private:
 
   nix::ref<nix::Store>  store;    /**< `nix` store connection. */
   std::filesystem::path cacheDir; /**< Cache directory. */
 
+  /** Previously constructed inputs to reuse ( if any ). */
+  std::shared_ptr<SharedInputs> sharedInputs;
 
-public:
+  /** Fingerprints of locked flakes keyed by their locked URL. */
+  std::unordered_map<std::string, Fingerprint> fingerprints;
 
-  using input_type = PkgDbInput;
+
+public:
 
   /** @brief Construct a factory using a `nix` evaluator. */
   explicit PkgDbInputFactory( nix::ref<nix::Store> & store,
@@ -254,16 +433,44 @@ public:
     : store( store ), cacheDir( std::move( cacheDir ) )
   {}
 
-  /** @brief Construct an input from a @a RegistryInput. */
-  [[nodiscard]] std::shared_ptr<PkgDbInput>
-  mkInput( const std::string & name, const RegistryInput & input )
+  /**
+   * @brief Construct a factory which reuses inputs from @a sharedInputs,
+   *        and adds any new inputs to it.
+   *
+   * This allows several registries to share flakes and database connections.
+   */
+  PkgDbInputFactory( nix::ref<nix::Store> &        store,
+                     std::shared_ptr<SharedInputs> sharedInputs,
+                     std::filesystem::path cacheDir = getPkgDbCachedir() )
+    : store( store )
+    , cacheDir( std::move( cacheDir ) )
+    , sharedInputs( std::move( sharedInputs ) )
+  {}
+
+  /**
+   * @brief Record the fingerprint of a locked flake so that inputs using it
+   *        may open their database without locking the flake.
+   * @param lockedRef A locked flake reference.
+   * @param fingerprint Unique hash associated with the locked flake.
+   */
+  void
+  addFingerprint( const nix::FlakeRef & lockedRef,
+                  const Fingerprint &   fingerprint )
+  {
+    this->fingerprints.insert_or_assign( lockedRef.to_string(), fingerprint );
+  }
+
+  /** @brief Whether the fingerprint of a locked flake is known. */
+  [[nodiscard]] bool
+  hasFingerprint( const nix::FlakeRef & lockedRef ) const
   {
-    return std::make_shared<PkgDbInput>( this->store,
-                                         input,
-                                         this->cacheDir,
-                                         name );
+    return this->fingerprints.contains( lockedRef.to_string() );
   }
 
+  /** @brief Construct an input from a @a RegistryInput. */
+  [[nodiscard]] std::shared_ptr<PkgDbInput>
+  mkInput( const std::string & name, const RegistryInput & input );
+
 
 }; /* End class `PkgDbInputFactory' */
 
@@ -278,6 +485,10 @@ static_assert( registry_input_factory<PkgDbInputFactory> );
  *
  * Derived classes must provide their own @a getRegistryRaw and @a getSystems
  * implementations to support @a initRegistry and @a scrapeIfNeeded.
+ *
+ * Inputs are not scraped until they are needed, so callers which query
+ * inputs should either call @a scrapeIfNeeded or scrape the prefixes they
+ * search with @a PkgDbInput::scrapeForQuery.
  */
 class PkgDbRegistryMixin : virtual protected NixStoreMixin
 {
@@ -307,8 +518,9 @@ protected:
   initRegistry();
 
   /**
-   * @brief Lazily perform scraping on input flakes.
+   * @brief Scrape all subtrees of input flakes for @a getSystems.
    *
+   * Prefixes which have already been scraped are skipped.
    * If scraping is necessary temprorary read/write handles are opened for
    * those flakes and closed before returning from this function.
    */
@@ -331,7 +543,7 @@ public:
   /**
    * @brief Get the set of package databases to resolve in.
    *
-   * This lazily initializes the registry and scrapes inputs when necessary.
+   * This lazily initializes the registry, but does not scrape inputs.
    */
   [[nodiscard]] nix::ref<Registry<PkgDbInputFactory>>
   getPkgDbRegistry();
@@ -0,0 +1,144 @@
+/* ========================================================================== *
+ *
+ * @file flox/pkgdb/package-writer.hh
+ *
+ * @brief Writes packages to a database from a dedicated thread so that
+ *        evaluation may continue while rows are inserted.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "flox/pkgdb/write.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Writes @a flox::pkgdb::PackageRow records to a database from
+ *        a dedicated thread.
+ *
+ * Packages are pushed to a bounded queue by the evaluating thread, and the
+ * writer thread drains the queue in batches which are inserted using a
+ * single prepared statement.
+ *
+ * The evaluating thread may continue to use the database connection, such as
+ * to add `AttrSets` rows, but must hold the lock returned by @a lockDb while
+ * doing so.
+ * Any transaction opened on the connection before the writer is created
+ * includes the rows it writes.
+ */
+class PackageWriter
+{
+
+private:
+
+  PkgDb &     db;        /**< Database being written to. */
+  std::size_t capacity;  /**< Maximum number of queued packages. */
+  std::size_t batchSize; /**< Maximum number of packages per insert. */
+
+  /** Guards @a queue, @a closed, and @a error. */
+  std::mutex              queueMutex;
+  std::condition_variable notEmpty; /**< Signalled when pushing packages. */
+  std::condition_variable notFull;  /**< Signalled when popping packages. */
+  std::deque<PackageRow>  queue;    /**< Packages waiting to be written. */
+  bool                    closed = false; /**< Whether pushing has ended. */
+  std::exception_ptr      error;          /**< First error writing. */
+
+  /** Guards use of the database connection across threads. */
+  std::mutex dbMutex;
+
+  std::thread writer; /**< Thread running @a run. */
+
+
+  /** @brief Write packages until the queue is closed and empty. */
+  void
+  run();
+
+  /** @brief Stop accepting packages and wait for the writer to exit. */
+  void
+  close();
+
+
+public:
+
+  /**
+   * @brief Start a writer thread for a database.
+   * @param db Database to write packages to.
+   * @param capacity Maximum number of packages which may be queued before
+   *                 @a push waits for the writer.
+   * @param batchSize Maximum number of packages inserted while holding the
+   *                  database lock.
+   */
+  explicit PackageWriter( PkgDb &     db,
+                          std::size_t capacity  = 4096,
+                          std::size_t batchSize = 256 );
+
+  PackageWriter( const PackageWriter & ) = delete;
+  PackageWriter( PackageWriter && )      = delete;
+
+  /** @brief Discard queued packages and stop the writer thread. */
+  ~PackageWriter();
+
+  PackageWriter &
+  operator=( const PackageWriter & )
+    = delete;
+  PackageWriter &
+  operator=( PackageWriter && )
+    = delete;
+
+  /**
+   * @brief Queue a package to be written.
+   *
+   * This only waits if the queue is full.
+   * Errors encountered by the writer thread are rethrown here.
+   * @param row Package metadata produced by @a mkPackageRow.
+   */
+  void
+  push( PackageRow row );
+
+  /**
+   * @brief Acquire exclusive use of the database connection.
+   * @return A lock which must be held while using the database.
+   */
+  [[nodiscard]] std::unique_lock<std::mutex>
+  lockDb()
+  {
+    return std::unique_lock<std::mutex>( this->dbMutex );
+  }
+
+  /**
+   * @brief Wait for all queued packages to be written.
+   *
+   * No packages may be pushed afterwards.
+   * Errors encountered by the writer thread are rethrown here.
+   */
+  void
+  finish();
+
+
+}; /* End class `PackageWriter' */
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
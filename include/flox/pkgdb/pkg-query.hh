@@ -47,6 +47,8 @@ namespace flox::pkgdb {
 
 using row_id = uint64_t; /**< A _row_ index in a SQLite3 table. */
 
+struct ScrapeFields;
+
 
 /* -------------------------------------------------------------------------- */
 
@@ -141,6 +143,41 @@ struct PkgQueryArgs
   void
   check() const;
 
+  /**
+   * @brief Whether filters depend on `meta` fields, being `licenses`,
+   *        `allowBroken`, `allowUnfree`, or `partialMatch` ( which matches
+   *        descriptions ).
+   *
+   * Such queries cannot be answered by packages which were scraped as a
+   * _skeleton_ until their `meta` fields have been backfilled, so
+   * @a flox::pkgdb::PkgQuery skips skeleton packages for them.
+   */
+  [[nodiscard]] bool
+  needsMeta() const;
+
+  /**
+   * @brief Whether packages are selected by `meta` fields other than
+   *        `broken` and `unfree`, being `licenses` or `partialMatch`.
+   *
+   * Unlike `broken` and `unfree`, which only rule out candidates that
+   * otherwise match, these may match any package in a prefix.
+   */
+  [[nodiscard]] bool
+  matchesMeta() const;
+
+  /**
+   * @brief Ensure that columns used by filters were scraped, throwing a
+   *        @a flox::pkgdb::InvalidPkgQueryArg exception otherwise.
+   *
+   * Columns which weren't scraped are `NULL` for every package, so filters
+   * on `licenses` can't be answered by them.
+   * Filters on `allowBroken` and `allowUnfree` treat `NULL` as unknown and
+   * keep those packages, so they are always allowed.
+   * @param scraped The columns scraped by the database being queried.
+   */
+  void
+  checkScrapeFields( const ScrapeFields & scraped ) const;
+
 
 }; /* End struct `PkgQueryArgs' */
 
@@ -154,6 +191,59 @@ void
 to_json( nlohmann::json & jto, const PkgQueryArgs & descriptor );
 
 
+/**
+ * @brief Get a key used to memoize the results of a query for all of its
+ *        systems.
+ *
+ * This is a SHA256 hash of @a args, ignoring the order of `systems`.
+ * Keys are only meaningful for a single database.
+ */
+[[nodiscard]] std::string
+getQueryCacheKey( const PkgQueryArgs & args );
+
+
+/**
+ * @brief Resolve a query for a single system by looking up its `relPath`
+ *        directly in `AttrSets` and `Packages`.
+ *
+ * This avoids filtering and ranking `v_PackagesSearch`, and is only possible
+ * for queries with a `relPath` and no `version`, `semver`, `partialMatch`, or
+ * `partialNameMatch` parameters.
+ * @param pdb Database to lookup packages in.
+ * @param args Query parameters, `systems` is ignored.
+ * @param system System to lookup packages for.
+ * @return `std::nullopt` if @a args cannot be resolved directly, or if
+ *         `relPath` exists in multiple subtrees and must be ranked.
+ *         Otherwise a list containing the satisfactory `Packages.id` if
+ *         there is one.
+ */
+[[nodiscard]] std::optional<std::vector<row_id>>
+lookupRelPath( sqlite3pp::database & pdb,
+               const PkgQueryArgs &  args,
+               const System &        system );
+
+
+/**
+ * @brief Resolve a query for a single system using the `BestCandidates`
+ *        rankings recorded when a prefix was scraped.
+ *
+ * This is only possible for queries with a `pnameOrAttrName` which otherwise
+ * use default parameters, except for `allowBroken`, `allowUnfree`, and
+ * `subtrees`.
+ * @param pdb Database to lookup packages in.
+ * @param args Query parameters, `systems` is ignored.
+ * @param system System to lookup packages for.
+ * @return `std::nullopt` if @a args cannot be resolved using rankings, if a
+ *         prefix has not been completely scraped, or if candidates in
+ *         multiple subtrees must be ranked.
+ *         Otherwise a list containing the best `Packages.id` if there is one.
+ */
+[[nodiscard]] std::optional<std::vector<row_id>>
+lookupBestCandidate( sqlite3pp::database & pdb,
+                     const PkgQueryArgs &  args,
+                     const System &        system );
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -321,6 +411,94 @@ public:
 }; /* End class `PkgQuery' */
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief A collection of queries which are resolved together in a single
+ *        SQL statement, producing the best match for each member and system.
+ *
+ * This is intended for resolving groups of descriptors, so members may only
+ * differ in the fields set by descriptors being `pnameOrAttrName`, `version`,
+ * `semver`, `preferPreReleases`, `subtrees`, `systems`, and `relPath`.
+ * The fields `licenses`, `allowBroken`, and `allowUnfree` must be identical
+ * for all members, and `name`, `pname`, `partialMatch`, and
+ * `partialNameMatch` may not be used.
+ *
+ * Members are loaded into a `VALUES` table with one row per system which is
+ * joined with `v_PackagesSearch` and ranked using `ROW_NUMBER()` partitioned
+ * by member and system, using the same ordering as @a flox::pkgdb::PkgQuery.
+ */
+class PkgQueryBatch
+{
+
+private:
+
+  /** Members of the batch, indexed by their position. */
+  std::vector<PkgQueryArgs> queries;
+
+
+  /**
+   * @brief Sanity check members, throwing a
+   *        @a flox::pkgdb::InvalidPkgQueryArg exception if they cannot be
+   *        resolved together.
+   */
+  void
+  check() const;
+
+  /** @brief Bind the `VALUES` table parameters for each member. */
+  void
+  bindQueries( sqlite3pp::query & qry ) const;
+
+
+public:
+
+  explicit PkgQueryBatch( std::vector<PkgQueryArgs> queries )
+    : queries( std::move( queries ) )
+  {
+    this->check();
+  }
+
+  /**
+   * @brief Produce an unbound SQL statement for all members.
+   *
+   * Each row contains a member's index, a system, a `Packages.id`, and
+   * its `semver`.
+   * Rows for members without `semver` are limited to the best match for each
+   * system, while rows for members with `semver` are returned in ranked order
+   * so that they may be filtered in post-processing.
+   */
+  [[nodiscard]] std::string
+  str() const;
+
+  /**
+   * @brief Query a given database returning the best satisfactory
+   *        `Packages.id` for each member on each of its systems.
+   *
+   * This performs `semver` filtering.
+   * @return A list of results in the same order as the batch's members,
+   *         mapping systems to their best match.
+   *         Systems without a match are omitted.
+   */
+  [[nodiscard]] std::vector<std::unordered_map<System, row_id>>
+  executeBySystem( sqlite3pp::database & pdb ) const;
+
+  /**
+   * @brief Query a given database returning the best satisfactory
+   *        `Packages.id` for each member.
+   *
+   * Members with multiple systems prefer matches for systems in the order
+   * they were given.
+   * This performs `semver` filtering.
+   * @return A list of results in the same order as the batch's members,
+   *         being `std::nullopt` for members without a match.
+   */
+  [[nodiscard]] std::vector<std::optional<row_id>>
+  execute( sqlite3pp::database & pdb ) const;
+
+
+}; /* End class `PkgQueryBatch' */
+
+
 /* -------------------------------------------------------------------------- */
 
 }  // namespace flox::pkgdb
@@ -9,10 +9,14 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <filesystem>
 #include <functional>
 #include <queue>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <nix/eval-cache.hh>
@@ -84,7 +88,107 @@ operator<<( std::ostream & oss, const SqlVersions & versions );
 
 
 /** The current SQLite3 schema versions. */
-constexpr SqlVersions sqlVersions = { .tables = 2, .views = 3 };
+constexpr SqlVersions sqlVersions = { .tables = 6, .views = 4 };
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Optional `Packages` columns which may be skipped while scraping to
+ *        avoid evaluating their `meta` fields.
+ *
+ * Skipped columns are stored as `NULL`.
+ * The columns scraped for every package in a database are recorded in its
+ * `DbVersions` table, so that readers may tell whether a `NULL` value
+ * is authoritative.
+ */
+struct ScrapeFields
+{
+
+  bool outputsToInstall = true; /**< `meta.outputsToInstall` */
+  bool license          = true; /**< `meta.license.spdxId` */
+  bool broken           = true; /**< `meta.broken` */
+  bool unfree           = true; /**< `meta.unfree` */
+  bool description      = true; /**< `meta.description` */
+
+
+  /** @return A set which doesn't scrape any optional columns. */
+  [[nodiscard]] static ScrapeFields
+  none()
+  {
+    return ScrapeFields { .outputsToInstall = false,
+                          .license          = false,
+                          .broken           = false,
+                          .unfree           = false,
+                          .description      = false };
+  }
+
+  /** @return Whether any fields of `meta` are scraped. */
+  [[nodiscard]] bool
+  anyMeta() const
+  {
+    return this->outputsToInstall || this->license || this->broken
+           || this->unfree || this->description;
+  }
+
+  /** @return The fields scraped by both @a this and @a other. */
+  [[nodiscard]] ScrapeFields
+  intersect( const ScrapeFields & other ) const;
+
+  [[nodiscard]] bool
+  operator==( const ScrapeFields & other ) const
+    = default;
+
+
+}; /* End struct `ScrapeFields' */
+
+
+/** @brief Convert a @a flox::pkgdb::ScrapeFields to a list of column names. */
+void
+to_json( nlohmann::json & jto, const ScrapeFields & fields );
+
+/**
+ * @brief Convert a list of column names to a @a flox::pkgdb::ScrapeFields.
+ *
+ * Columns which are not listed are skipped.
+ */
+void
+from_json( const nlohmann::json & jfrom, ScrapeFields & fields );
+
+/**
+ * @return The optional `Packages` columns which have been scraped for
+ *         every package in the database @a pdb.
+ */
+[[nodiscard]] ScrapeFields
+getScrapeFields( sqlite3pp::database & pdb );
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Options controlling how a prefix is scraped. */
+struct ScrapeOptions
+{
+
+  /**
+   * Whether to skip `meta` fields, marking packages so that they may be
+   * backfilled later.
+   */
+  bool skeleton = false;
+
+  /**
+   * Whether to evaluate attributes which failed to evaluate during previous
+   * scrapes, rather than skipping them.
+   */
+  bool retryErrors = false;
+
+  /** Maximum time spent evaluating a single attribute. */
+  std::optional<std::chrono::milliseconds> timeBudget;
+
+  /** Maximum number of bytes allocated evaluating a single attribute. */
+  std::optional<std::size_t> allocBudget;
+
+
+}; /* End struct `ScrapeOptions' */
 
 
 /* -------------------------------------------------------------------------- */
@@ -95,6 +199,28 @@ using SQLiteDb    = sqlite3pp::database; /** < SQLite3 database handle. */
 using sql_rc      = int;                 /**< `SQLITE_*` result code. */
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Total time spent waiting for another connection to release a lock
+ *        before giving up with `SQLITE_BUSY`.
+ */
+constexpr std::chrono::milliseconds DB_BUSY_TIMEOUT( 60000 );
+
+/**
+ * @brief Retry operations that failed with `SQLITE_BUSY` using exponential
+ *        backoff, until @a DB_BUSY_TIMEOUT has elapsed.
+ *
+ * This is installed on every database connection opened by
+ * @a flox::pkgdb::PkgDbReadOnly and @a flox::pkgdb::PkgDb.
+ * @param attempts The number of times the handler has already been invoked
+ *                 for the same locking event.
+ * @return Non-zero to retry the operation, or zero to fail with `SQLITE_BUSY`.
+ */
+int
+busyHandler( int attempts );
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -124,6 +250,30 @@ std::filesystem::path
 genPkgDbName( const Fingerprint &           fingerprint,
               const std::filesystem::path & cacheDir = getPkgDbCachedir() );
 
+/**
+ * @brief Get an absolute path to the directory holding the sharded `PkgDb's
+ *        for a given fingerprint hash.
+ *
+ * Each shard is a complete database holding a single `<SUBTREE>.<SYSTEM>`
+ * prefix, so that separate processes may scrape different prefixes of a
+ * flake without contending for the same database lock.
+ * Shards are merged into the database named by @a genPkgDbName when it is
+ * opened by a @a flox::pkgdb::PkgDbInput, or by `pkgdb merge`.
+ */
+std::filesystem::path
+getPkgDbShardDir( const Fingerprint &           fingerprint,
+                  const std::filesystem::path & cacheDir = getPkgDbCachedir() );
+
+/**
+ * @brief Get an absolute path to the `PkgDb' shard holding the
+ *        `<SUBTREE>.<SYSTEM>` prefix of @a prefix for a given fingerprint hash.
+ */
+std::filesystem::path
+genPkgDbShardName(
+  const Fingerprint &           fingerprint,
+  const flox::AttrPath &        prefix,
+  const std::filesystem::path & cacheDir = getPkgDbCachedir() );
+
 
 /* -------------------------------------------------------------------------- */
 
@@ -246,6 +396,13 @@ public:
   SqlVersions
   getDbVersion();
 
+  /**
+   * @return The optional `Packages` columns which have been scraped for
+   *         every package in the database.
+   */
+  ScrapeFields
+  getScrapeFields();
+
   /**
    * @brief Get the `AttrSet.id` for a given path.
    * @param path An attribute path prefix such as `packages.x86_64-linux` or
@@ -285,6 +442,27 @@ public:
   bool
   completedAttrSet( const flox::AttrPath & path );
 
+  /**
+   * @brief Check to see if a completely scraped prefix was scraped as a
+   *        _skeleton_, without its packages' `meta` fields.
+   * @param path An attribute path prefix such as `packages.x86_64-linux` or
+   *             `legacyPackages.aarch64-darwin.python3Packages`.
+   * @return `true` iff the `AttrSet` at @a path is complete but its packages'
+   *         `meta` fields have yet to be backfilled.
+   */
+  bool
+  skeletonAttrSet( const flox::AttrPath & path );
+
+  /**
+   * @brief Get the attributes of an attribute set which failed to evaluate
+   *        while scraping.
+   * @param parentId The `AttrSets.id` of the attribute set.
+   * @return A map of attribute names to their error class, such as `throw`
+   *         or `assert`.
+   */
+  std::unordered_map<std::string, std::string>
+  getEvalErrors( row_id parentId );
+
   /**
    * @brief Get the attribute path for a given `AttrSet.id`.
    * @param row A unique `row_id` ( unsigned 64bit int ).
@@ -369,6 +547,29 @@ public:
   getPackage( const flox::AttrPath & path );
 
 
+  /**
+   * @brief Lookup the memoized results of a package query.
+   * @param key A key produced by @a flox::pkgdb::getQueryCacheKey.
+   * @return A map of systems to their best `Packages.id` if the query has
+   *         been memoized, otherwise `std::nullopt`.
+   */
+  std::optional<std::unordered_map<System, row_id>>
+  getCachedQuery( const std::string & key );
+
+  /**
+   * @brief List the `pname`s and `attrName`s of packages under a completely
+   *        scraped prefix.
+   *
+   * These names are recorded in `BestCandidates` when a prefix is scraped,
+   * and may be used to quickly rule out queries which cannot match.
+   * @param prefix An attribute path prefix such as `packages.x86_64-linux`.
+   * @return A sorted list of unique names, or `std::nullopt` if @a prefix
+   *         has not been completely scraped.
+   */
+  std::optional<std::vector<std::string>>
+  getPackageNames( const flox::AttrPath & prefix );
+
+
   nix::FlakeRef
   getLockedFlakeRef() const
   {
@@ -9,8 +9,16 @@
 
 #pragma once
 
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <tuple>
+#include <vector>
 
+#include <nix/util.hh>
+
+#include "flox/pkgdb/eval-watchdog.hh"
 #include "flox/pkgdb/read.hh"
 
 
@@ -27,6 +35,57 @@ using Target = std::tuple<flox::AttrPath, flox::Cursor, row_id>;
 using Todos = std::queue<Target, std::list<Target>>;
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief A row of the `Packages` table, extracted from a package's cursor so
+ *        that it may be written without access to the evaluator.
+ */
+struct PackageRow
+{
+
+  row_id                     parentId = 0;     /**< `AttrSets.id` of parent. */
+  std::string                attrName;         /**< Last attr path element. */
+  std::string                name;             /**< Derivation `name`. */
+  std::string                pname;            /**< Parsed `pname`. */
+  std::optional<std::string> version;          /**< Parsed `version`. */
+  std::optional<std::string> semver;           /**< Normalized `version`. */
+  std::optional<std::string> license;          /**< `meta.license.spdxId`. */
+  std::vector<std::string>   outputs;          /**< Derivation `outputs`. */
+  std::optional<bool>        broken;           /**< `meta.broken`. */
+  std::optional<bool>        unfree;           /**< `meta.unfree`. */
+  std::optional<std::string> description;      /**< `meta.description`. */
+
+  /** `meta.outputsToInstall`, or `std::nullopt` if it wasn't scraped. */
+  std::optional<std::vector<std::string>> outputsToInstall;
+
+  /** Whether `meta` fields were skipped, to be backfilled later. */
+  bool skeleton = false;
+
+
+}; /* End struct `PackageRow' */
+
+
+/**
+ * @brief Evaluate a package's metadata.
+ * @param parentId The `AttrSets.id` associated with the parent path.
+ * @param attrName The last element of the package's attribute path.
+ * @param cursor An attribute cursor to scrape data from.
+ * @param checkDrv Whether to check `isDerivation` for @a cursor.
+ * @param fields Optional columns to scrape, others are left empty.
+ * @return A row that may be written by @a flox::pkgdb::PkgDb::addPackage.
+ */
+[[nodiscard]] PackageRow
+mkPackageRow( row_id               parentId,
+              std::string_view     attrName,
+              const flox::Cursor & cursor,
+              bool                 checkDrv = true,
+              const ScrapeFields & fields   = {} );
+
+
+class PackageWriter;
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -108,6 +167,7 @@ public:
       }
     this->db.connect( this->dbPath.c_str(),
                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE );
+    this->db.set_busy_handler( busyHandler );
     this->init();
     this->loadLockedFlake();
   }
@@ -130,6 +190,7 @@ public:
       }
     this->db.connect( this->dbPath.c_str(),
                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE );
+    this->db.set_busy_handler( busyHandler );
     this->init();
     this->loadLockedFlake();
   }
@@ -157,6 +218,7 @@ public:
     this->fingerprint = flake.getFingerprint();
     this->db.connect( this->dbPath.c_str(),
                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE );
+    this->db.set_busy_handler( busyHandler );
     init();
     this->lockedRef
       = { flake.flake.lockedRef.to_string(),
@@ -267,6 +329,27 @@ public:
               bool                 replace  = false,
               bool                 checkDrv = true );
 
+  /**
+   * @brief Adds a package to the database.
+   * @param row Package metadata produced by @a mkPackageRow.
+   * @param replace Whether to replace/ignore existing rows.
+   * @return The `Packages.id` value for the added package.
+   */
+  row_id
+  addPackage( const PackageRow & row, bool replace = false );
+
+  /**
+   * @brief Adds packages to the database, reusing a single prepared
+   *        statement for each of them.
+   * @param begin Iterator to the first package to add.
+   * @param end Iterator past the last package to add.
+   * @param replace Whether to replace/ignore existing rows.
+   */
+  void
+  addPackages( std::vector<PackageRow>::const_iterator begin,
+               std::vector<PackageRow>::const_iterator end,
+               bool                                    replace = false );
+
 
   /* --------------------------------------------------------------------------
    */
@@ -274,22 +357,106 @@ public:
   /* Updates */
 
   /**
-   * @brief Update the `done` column for an attribute set and all of its
-   *        children recursively.
+   * @brief Update the `done` and `skeleton` columns for an attribute set and
+   *        all of its children recursively.
    * @param prefixId `AttrSets.id` for the prefix to be updated.
    * @param done Value to update `done` column to.
+   * @param skeleton Whether packages were scraped without `meta` fields.
    */
   void
-  setPrefixDone( row_id prefixId, bool done );
+  setPrefixDone( row_id prefixId, bool done, bool skeleton = false );
 
   /**
-   * @brief Update the `done` column for an attribute set and all of its
-   *        children recursively.
+   * @brief Update the `done` and `skeleton` columns for an attribute set and
+   *        all of its children recursively.
    * @param prefix Attribute set prefix to be updated.
    * @param done Value to update `done` column to.
+   * @param skeleton Whether packages were scraped without `meta` fields.
+   */
+  void
+  setPrefixDone( const flox::AttrPath & prefix,
+                 bool                   done,
+                 bool                   skeleton = false );
+
+  /**
+   * @brief Rank the best package for each `pname` and `attrName` under a
+   *        completed prefix using default query parameters.
+   *
+   * Rankings are recorded for each combination of `allowBroken` and
+   * `allowUnfree` in the `BestCandidates` table, replacing any existing
+   * rankings for the prefix.
+   * @param prefix A `<SUBTREE>` or `<SUBTREE>.<SYSTEM>` prefix which has
+   *               been completely scraped.
+   */
+  void
+  updateBestCandidates( const flox::AttrPath & prefix );
+
+  /**
+   * @brief Memoize the results of a package query.
+   * @param key A key produced by @a flox::pkgdb::getQueryCacheKey.
+   * @param results A map of systems to their best `Packages.id`.
    */
   void
-  setPrefixDone( const flox::AttrPath & prefix, bool done );
+  cacheQuery( const std::string &                        key,
+              const std::unordered_map<System, row_id> & results );
+
+  /**
+   * @brief Drop all memoized query results.
+   *
+   * This must be called whenever packages are added to the database.
+   */
+  void
+  clearQueryCache();
+
+  /**
+   * @brief Record the optional `Packages` columns to scrape.
+   *
+   * If the database already has packages, columns are only recorded if they
+   * were scraped by previous scrapes as well as @a fields, since existing
+   * packages would otherwise have non-authoritative `NULL` values.
+   * @param fields Columns to scrape.
+   * @return The columns which will be scraped.
+   */
+  ScrapeFields
+  setScrapeFields( const ScrapeFields & fields );
+
+  /**
+   * @brief Record an attribute which failed to evaluate while scraping, so
+   *        that later scrapes may skip it.
+   * @param parentId The `AttrSets.id` of the attribute's parent.
+   * @param attrName The attribute's name.
+   * @param errorClass The kind of error, such as `throw` or `assert`.
+   * @param message The error message.
+   */
+  void
+  addEvalError( row_id           parentId,
+                std::string_view attrName,
+                std::string_view errorClass,
+                std::string_view message );
+
+  /**
+   * @brief Forget the attributes of an attribute set which failed to
+   *        evaluate, so that they are evaluated by the next scrape.
+   * @param parentId The `AttrSets.id` of the attribute set.
+   */
+  void
+  clearEvalErrors( row_id parentId );
+
+  /**
+   * @brief Copy the attribute sets, packages, and descriptions of a database
+   *        shard into this database.
+   *
+   * The shard is attached to this database's connection and its rows are
+   * copied in a single transaction, with `AttrSets.id`, `Packages.id`, and
+   * `Descriptions.id` values renumbered to avoid collisions.
+   * Existing packages are left in place, and prefixes marked as "done" in the
+   * shard are marked as "done" in this database and have their
+   * `BestCandidates` ranked.
+   * @param shardPath Path to a database created for the same locked flake,
+   *                  usually by `pkgdb scrape --shard`.
+   */
+  void
+  mergeShard( const std::filesystem::path & shardPath );
 
 
   /* --------------------------------------------------------------------------
@@ -309,6 +476,56 @@ public:
   void
   scrape( nix::SymbolTable & syms, const Target & target, Todos & todo );
 
+  /**
+   * @brief Scrape package definitions from an attribute set, handing packages
+   *        to @a writer to be written by its thread.
+   *
+   * Evaluation continues while packages are written, and only waits for
+   * @a writer when its queue is full or an attribute set must be added.
+   *
+   * Attributes under `legacyPackages` which fail to evaluate are recorded in
+   * `EvalErrors`, and are skipped by later scrapes.
+   * Attributes in any prefix which exceed the budget of @a watchdog are
+   * interrupted and recorded with the error class `budget`.
+   * @param syms Symbol table from @a cursor evaluator.
+   * @param target A tuple containing the attribute path to scrape, a cursor,
+   *               and a SQLite _row id_.
+   * @param todo Queue to add `recurseForDerivations = true` cursors to so
+   *             they may be scraped by later invocations.
+   * @param writer Writer thread for this database.
+   * @param watchdog Charges evaluation of each attribute to its budget,
+   *                 usually shared by every target of a scrape.
+   * @param options Whether to scrape a _skeleton_, whose packages may be
+   *                completed later by @a backfill, and whether to retry
+   *                attributes which previously failed to evaluate.
+   */
+  void
+  scrape( nix::SymbolTable &    syms,
+          const Target &        target,
+          Todos &               todo,
+          PackageWriter &       writer,
+          EvalWatchdog &        watchdog,
+          const ScrapeOptions & options = {} );
+
+  /**
+   * @brief Fill in the `meta` fields of packages under a prefix which were
+   *        scraped as a _skeleton_, and mark the prefix as completely scraped.
+   *
+   * Packages whose `meta` fields fail to evaluate or exceed the budget of
+   * @a watchdog keep `NULL` values.
+   * @param prefixId `AttrSets.id` of the prefix.
+   * @param cursor A cursor for the prefix's attribute set.
+   * @param watchdog Charges evaluation of each package to its budget.
+   * @param packageIds If set, only these `Packages.id`s are backfilled and
+   *                   the prefix remains a skeleton.
+   */
+  void
+  backfill( row_id                                    prefixId,
+            const flox::Cursor &                      cursor,
+            EvalWatchdog &                            watchdog,
+            const std::optional<std::vector<row_id>> & packageIds
+            = std::nullopt );
+
 
   /* --------------------------------------------------------------------------
    */
@@ -316,6 +533,55 @@ public:
 }; /* End class `PkgDb' */
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Lock a database against other processes scraping or deleting it.
+ *
+ * The lock is held on `<DB-PATH>.lock` until the returned descriptor is
+ * closed.
+ * A lock file may only be deleted by its holder with @a deletePkgDbLock, and
+ * processes waiting on a deleted lock file retry with a new one.
+ * @param dbPath Path to the database.
+ * @param wait Whether to wait for another process to release the lock.
+ * @return A descriptor holding the lock, or an invalid descriptor if @a wait
+ *         is `false` and another process holds the lock.
+ */
+[[nodiscard]] nix::AutoCloseFD
+lockPkgDb( const std::filesystem::path & dbPath, bool wait = true );
+
+/**
+ * @brief Delete a database's lock file while holding its lock.
+ * @param dbPath Path to the database.
+ * @param lock A descriptor returned by @a lockPkgDb.
+ */
+void
+deletePkgDbLock( const std::filesystem::path & dbPath,
+                 const nix::AutoCloseFD &      lock );
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Merge the database shards held in @a shardDir into @a pdb, deleting
+ *        each shard once it has been merged.
+ *
+ * Shards are named `<SUBTREE>.<SYSTEM>.sqlite` by @a genPkgDbShardName, and
+ * the directory is removed once it is empty.
+ * Shards with a different schema version, and shards locked by another
+ * process, are always skipped.
+ * @param pdb Database to merge shards into.
+ * @param shardDir Directory holding shards, see @a getPkgDbShardDir.
+ * @param completeOnly Whether to skip shards whose prefix has not been
+ *                     completely scraped, since they may still be written to.
+ * @return Paths of merged shards.
+ */
+std::vector<std::filesystem::path>
+mergePkgDbShards( PkgDb &                       pdb,
+                  const std::filesystem::path & shardDir,
+                  bool                          completeOnly = true );
+
+
 /* -------------------------------------------------------------------------- */
 
 }  // namespace flox::pkgdb
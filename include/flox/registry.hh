@@ -734,10 +734,35 @@ public:
 
 /* -------------------------------------------------------------------------- */
 
-/** @brief Lock an unlocked registry. */
+/**
+ * @brief Fetch the source trees of a registry's inputs concurrently.
+ *
+ * Locking a flake is dominated by fetching its source tree, but locking
+ * requires a `nix` evaluator which cannot be shared across threads.
+ * Fetching inputs ahead of time on a thread pool populates the `nix` store
+ * and fetcher cache so that subsequent locking of each input is cheap.
+ *
+ * Errors are ignored here, and are instead reported when the input is locked.
+ */
+void
+prefetchRegistryInputs( const RegistryRaw &          registry,
+                        const nix::ref<nix::Store> & store );
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Lock an unlocked registry.
+ * @param unlocked The registry to lock.
+ * @param store The store to fetch inputs into.
+ * @param prefetch Whether to fetch inputs with @a prefetchRegistryInputs
+ *                 before locking them, callers which already did so may
+ *                 skip it.
+ */
 RegistryRaw
 lockRegistry( const RegistryRaw &          unlocked,
-              const nix::ref<nix::Store> & store = NixStoreMixin().getStore() );
+              const nix::ref<nix::Store> & store = NixStoreMixin().getStore(),
+              bool                         prefetch = true );
 
 
 /* -------------------------------------------------------------------------- */
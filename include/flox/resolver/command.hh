@@ -10,7 +10,9 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <vector>
 
 #include "flox/resolver/manifest-raw.hh"
 #include "flox/resolver/mixins.hh"
@@ -53,6 +55,72 @@ public:
 }; /* End class `LockCommand' */
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Lock many manifest files in a single process.
+ *
+ * Environments are locked in sequence, sharing opened inputs and resolutions
+ * across environments.
+ * With `--jobs N` manifests are split across `N` worker processes.
+ */
+class LockManyCommand
+{
+
+private:
+
+  std::vector<std::filesystem::path>   manifestPaths;
+  std::optional<std::filesystem::path> globalManifestPath;
+  bool                                 gaRegistry = false;
+  size_t                               jobs       = 1;
+
+  command::VerboseParser parser;
+
+
+  /**
+   * @brief Lock a single manifest, emitting a line of JSON to `stdout`.
+   * @return `true` iff the manifest was locked successfully.
+   */
+  [[nodiscard]] bool
+  lockOne( const std::filesystem::path &     manifestPath,
+           std::shared_ptr<EnvironmentCache> cache );
+
+  /**
+   * @brief Fetch the registry inputs of every manifest at once, and mark
+   *        @a cache so that environments don't fetch them again.
+   */
+  void
+  prefetchInputs( const std::shared_ptr<EnvironmentCache> & cache );
+
+  /**
+   * @brief Split @a manifestPaths across @a jobs worker processes.
+   * @return `EXIT_SUCCESS` or `EXIT_FAILURE`.
+   */
+  [[nodiscard]] int
+  runJobs();
+
+
+public:
+
+  LockManyCommand();
+
+  [[nodiscard]] command::VerboseParser &
+  getParser()
+  {
+    return this->parser;
+  }
+
+  /**
+   * @brief Execute the `lock-many` routine.
+   * @return `EXIT_SUCCESS` or `EXIT_FAILURE`.
+   */
+  int
+  run();
+
+
+}; /* End class `LockManyCommand' */
+
+
 /* -------------------------------------------------------------------------- */
 
 /** @brief Diff two manifest files. */
@@ -171,11 +239,12 @@ class ManifestCommand
 
 private:
 
-  command::VerboseParser parser;      /**< `manifest`          parser */
-  LockCommand            cmdLock;     /**< `manifest lock`     command */
-  DiffCommand            cmdDiff;     /**< `manifest diff`     command */
-  UpdateCommand          cmdUpdate;   /**< `manifest update`   command */
-  RegistryCommand        cmdRegistry; /**< `manifest registry` command */
+  command::VerboseParser parser;      /**< `manifest`           parser */
+  LockCommand            cmdLock;     /**< `manifest lock`      command */
+  LockManyCommand        cmdLockMany; /**< `manifest lock-many` command */
+  DiffCommand            cmdDiff;     /**< `manifest diff`      command */
+  UpdateCommand          cmdUpdate;   /**< `manifest update`    command */
+  RegistryCommand        cmdRegistry; /**< `manifest registry`  command */
 
 
 public:
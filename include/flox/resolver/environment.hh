@@ -11,7 +11,9 @@
 
 #include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -81,6 +83,57 @@ using ResolutionFailure = std::vector<std::pair<InstallID, std::string>>;
 using ResolutionResult = std::variant<ResolutionFailure, SystemPackages>;
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Inputs and resolutions which may be shared by environments that are
+ *        locked by the same process.
+ *
+ * Sharing a cache allows environments with common registries to reuse
+ * locked flakes, database connections, and package resolutions rather than
+ * recreating them for each environment.
+ */
+struct EnvironmentCache
+{
+
+  /** Registry inputs shared by each environment's package databases. */
+  std::shared_ptr<pkgdb::PkgDbInputFactory::SharedInputs> inputs
+    = std::make_shared<pkgdb::PkgDbInputFactory::SharedInputs>();
+
+  /**
+   * @brief Inputs pinned by old lockfiles, keyed by locked URL and
+   *        fingerprint.
+   *
+   * These inputs are already locked, so constructing them once avoids
+   * re-locking the same flake for every group and system.
+   * @see flox::resolver::Environment::getLockedInput
+   */
+  std::unordered_map<std::string, std::shared_ptr<pkgdb::PkgDbInput>>
+    lockedInputs;
+
+  /**
+   * @brief Resolved `Packages.id`s for descriptor queries on each system,
+   *        keyed by input fingerprint and a hash of query arguments.
+   *
+   * Descriptors are resolved for all of the queried systems the first time
+   * they are queried in an input, so locking the remaining systems reuses
+   * these results.
+   * Systems without a match are omitted.
+   */
+  std::unordered_map<std::string, std::unordered_map<System, pkgdb::row_id>>
+    resolutions;
+
+  /**
+   * Whether every environment's registry inputs were already fetched with
+   * @a flox::prefetchRegistryInputs, so environments needn't prefetch them.
+   * @see flox::resolver::Environment::getPrefetchRegistryRaw
+   */
+  bool prefetched = false;
+
+
+}; /* End struct `EnvironmentCache' */
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -137,6 +190,28 @@ private:
 
   std::shared_ptr<Registry<pkgdb::PkgDbInputFactory>> dbs;
 
+  /**
+   * @brief Inputs and resolutions, which may be shared with other
+   *        environments.
+   */
+  std::shared_ptr<EnvironmentCache> cache;
+
+  /** @brief Query results to be memoized in a package database. */
+  struct PendingQueries
+  {
+    pkgdb::Fingerprint fingerprint; /**< Fingerprint of the database. */
+    /** Keys from @a flox::pkgdb::getQueryCacheKey, and their results. */
+    std::vector<
+      std::pair<std::string, std::unordered_map<System, pkgdb::row_id>>>
+      results;
+  }; /* End struct `PendingQueries' */
+
+  /**
+   * @brief Results of queries resolved by @a tryResolveGroupIn, keyed by
+   *        database path, to be written by @a saveQueryResults.
+   */
+  std::unordered_map<std::string, PendingQueries> pendingQueries;
+
 
   static LockedPackageRaw
   lockPackage( const LockedInputRaw & input,
@@ -178,10 +253,24 @@ private:
   [[nodiscard]] const Options &
   getCombinedOptions();
 
-  /** @brief Try to resolve a descriptor in a given package database. */
+  /**
+   * @brief Get the query arguments used to resolve a descriptor in a given
+   *        package database for a single system.
+   */
+  [[nodiscard]] pkgdb::PkgQueryArgs
+  getDescriptorQueryArgs( const ManifestDescriptor & descriptor,
+                          const pkgdb::PkgDbInput &  input,
+                          const System &             system );
+
+  /**
+   * @brief Try to resolve a descriptor in a given package database.
+   *
+   * Only the prefixes needed by the descriptor are scraped, so descriptors
+   * with an `abspath` only evaluate that package.
+   */
   [[nodiscard]] std::optional<pkgdb::row_id>
   tryResolveDescriptorIn( const ManifestDescriptor & descriptor,
-                          const pkgdb::PkgDbInput &  input,
+                          pkgdb::PkgDbInput &        input,
                           const System &             system );
 
   /**
@@ -200,12 +289,16 @@ private:
   /**
    * @brief Try to resolve a group of descriptors in a given package database.
    *
+   * Descriptors are resolved for all systems at once and memoized in
+   * @a cache, and in @a pendingQueries to be saved to the input's database
+   * so that later runs may reuse them.
+   *
    * @return InstallID of the package that can't be resolved if resolution
    *         fails, otherwise a set of resolved packages for the system.
    */
   [[nodiscard]] std::variant<InstallID, SystemPackages>
   tryResolveGroupIn( const InstallDescriptors & group,
-                     const pkgdb::PkgDbInput &  input,
+                     pkgdb::PkgDbInput &        input,
                      const System &             system );
 
   /**
@@ -220,6 +313,16 @@ private:
   void
   lockSystem( const System & system );
 
+  /**
+   * @brief Memoize @a pendingQueries in their package databases, opening one
+   *        read/write connection for each database.
+   *
+   * This is best effort, since databases may not be writable, and failures
+   * are reported as warnings.
+   */
+  void
+  saveQueryResults();
+
 
 protected:
 
@@ -252,6 +355,34 @@ protected:
                  const Lockfile &           oldLockfile,
                  const System &             system ) const;
 
+  /**
+   * @brief Merge the global and environment manifest registries, using the
+   *        inputs pinned by @a oldLockfile where available.
+   * @param unpinned Set to the registry's inputs which aren't pinned.
+   * @return The merged registry.
+   */
+  [[nodiscard]] RegistryRaw
+  getPinnedRegistryRaw( RegistryRaw & unpinned );
+
+  /**
+   * @brief Get a package database for a locked input, constructing it only
+   *        if it has not been seen before.
+   *
+   * Inputs are first looked up in @a cache, and then in the combined
+   * registry's DBs ( if they have been initialized ) by fingerprint.
+   * Only if neither contains a match will a new @a flox::pkgdb::PkgDbInput
+   * be created.
+   */
+  [[nodiscard]] nix::ref<pkgdb::PkgDbInput>
+  getLockedInput( const LockedInputRaw & lockedInput );
+
+  /**
+   * @brief Record the fingerprints of inputs used by @a oldLockfile so that
+   *        @a factory can open their databases without locking them.
+   */
+  void
+  addLockedFingerprints( pkgdb::PkgDbInputFactory & factory );
+
   /**
    * @brief Check if lock from @ oldLockfile can be reused for a group.
    *
@@ -269,14 +400,17 @@ protected:
 
 public:
 
-  Environment( std::optional<GlobalManifest> globalManifest,
-               EnvironmentManifest           manifest,
-               std::optional<Lockfile>       oldLockfile,
-               Upgrades                      upgrades = false )
+  Environment( std::optional<GlobalManifest>     globalManifest,
+               EnvironmentManifest               manifest,
+               std::optional<Lockfile>           oldLockfile,
+               Upgrades                          upgrades = false,
+               std::shared_ptr<EnvironmentCache> cache    = nullptr )
     : globalManifest( std::move( globalManifest ) )
     , manifest( std::move( manifest ) )
     , oldLockfile( std::move( oldLockfile ) )
     , upgrades( std::move( upgrades ) )
+    , cache( cache == nullptr ? std::make_shared<EnvironmentCache>()
+                              : std::move( cache ) )
   {}
 
   explicit Environment( EnvironmentManifest     manifest,
@@ -284,6 +418,7 @@ public:
     : globalManifest( std::nullopt )
     , manifest( std::move( manifest ) )
     , oldLockfile( std::move( oldLockfile ) )
+    , cache( std::make_shared<EnvironmentCache>() )
   {}
 
   [[nodiscard]] const std::optional<GlobalManifest> &
@@ -316,7 +451,7 @@ public:
   [[nodiscard]] std::optional<ManifestRaw>
   getOldManifestRaw() const;
 
-  [[nodiscard]] std::optional<Lockfile>
+  [[nodiscard]] const std::optional<Lockfile> &
   getOldLockfile() const
   {
     return this->oldLockfile;
@@ -334,6 +469,18 @@ public:
   [[nodiscard]] RegistryRaw &
   getCombinedRegistryRaw();
 
+  /**
+   * @brief Get the registry inputs which locking this environment fetches.
+   *
+   * These are the inputs which aren't pinned by @a oldLockfile, and pinned
+   * inputs whose fingerprints aren't recorded by @a oldLockfile.
+   * This does not lock any inputs, so the registries of many environments
+   * may be fetched at once with @a flox::prefetchRegistryInputs.
+   * Inputs are keyed by their flake references rather than their names.
+   */
+  [[nodiscard]] RegistryRaw
+  getPrefetchRegistryRaw();
+
   /**
    * @brief Get a base set of @a flox::pkgdb::PkgQueryArgs from
    *        combined options.
@@ -348,7 +495,12 @@ public:
     return this->getManifest().getSystems();
   }
 
-  /** @brief Lazily initialize and get the combined registry's DBs. */
+  /**
+   * @brief Lazily initialize and get the combined registry's DBs.
+   *
+   * Inputs are not scraped here, callers should scrape the prefixes they
+   * need with @a flox::pkgdb::PkgDbInput::scrapeForQuery.
+   */
   [[nodiscard]] nix::ref<Registry<pkgdb::PkgDbInputFactory>>
   getPkgDbRegistry();
 
@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include <optional>
+#include <string>
 #include <unordered_map>
 
 #include <nlohmann/json.hpp>
@@ -171,6 +173,17 @@ operator<<( std::ostream & oss, const LockedPackageRaw & raw );
 using SystemPackages
   = std::unordered_map<InstallID, std::optional<LockedPackageRaw>>;
 
+/**
+ * @brief The version of lockfiles written by `pkgdb`.
+ *
+ * Version 1 added the `inputs-hash` field.
+ * Older versions are still read.
+ */
+constexpr unsigned LOCKFILE_VERSION = 1;
+
+
+/* -------------------------------------------------------------------------- */
+
 /**
  * @brief An environment lockfile in its _raw_ form.
  *
@@ -183,7 +196,13 @@ struct LockfileRaw
   ManifestRaw                                manifest;
   RegistryRaw                                registry;
   std::unordered_map<System, SystemPackages> packages;
-  unsigned                                   lockfileVersion = 0;
+  unsigned                                   lockfileVersion = LOCKFILE_VERSION;
+
+  /**
+   * Hash of the manifests used to create the lockfile.
+   * @see flox::resolver::getLockfileInputsHash
+   */
+  std::optional<std::string> inputsHash;
 
 
   ~LockfileRaw()                     = default;
@@ -226,6 +245,27 @@ void
 to_json( nlohmann::json & jto, const LockfileRaw & raw );
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Hash the manifests which determine the contents of a lockfile.
+ *
+ * Re-locking a lockfile with the same inputs hash will not change it, so
+ * callers may reuse the existing lockfile without opening any databases.
+ * @param manifest The project manifest being locked.
+ * @param globalManifest The global manifest ( if any ).
+ * @param systems The systems being locked.
+ *                Manifests which don't declare `options.systems` fall back to
+ *                the current system, so this must be hashed separately.
+ * @return A base16 `SHA256` hash.
+ */
+[[nodiscard]] std::string
+getLockfileInputsHash(
+  const ManifestRaw &                      manifest,
+  const std::optional<GlobalManifestRaw> & globalManifest,
+  const std::vector<System> &              systems );
+
+
 /* -------------------------------------------------------------------------- */
 
 /**
@@ -340,6 +380,27 @@ public:
     return this->getManifest().getDescriptors();
   }
 
+  /**
+   * @brief Get the locked packages for a system without copying them.
+   * @param system The system to lookup.
+   * @return The `packages.<SYSTEM>` member of the lockfile, or `nullptr` if
+   *         @a system has not been locked.
+   */
+  [[nodiscard]] const SystemPackages *
+  getSystemPackages( const System & system ) const;
+
+  /**
+   * @brief Get a single locked package without copying it.
+   * @param system The system to lookup.
+   * @param iid The _install ID_ to lookup.
+   * @return The `packages.<SYSTEM>.<INSTALL-ID>` member of the lockfile, or
+   *         `nullptr` if it is missing.
+   *         An empty @a std::optional indicates that the package was
+   *         skipped or failed to resolve.
+   */
+  [[nodiscard]] const std::optional<LockedPackageRaw> *
+  getLockedPackage( const System & system, const InstallID & iid ) const;
+
   /**
    * @brief Get the @a packagesRegistryRaw, containing all inputs used by
    *        `packages.**` members of the lockfile.
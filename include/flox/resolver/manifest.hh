@@ -283,6 +283,9 @@ private:
    */
   InstallDescriptors descriptors;
 
+  /** @a descriptors split by _group_, see @a getGroupedDescriptors. */
+  std::vector<InstallDescriptors> groupedDescriptors;
+
 
   /**
    * @brief Assert the validity of the manifest, throwing an exception if it
@@ -349,6 +352,8 @@ private:
           }
       }
     this->check();
+    this->groupedDescriptors
+      = flox::resolver::getGroupedDescriptors( this->descriptors );
   }
 
 
@@ -390,11 +395,13 @@ public:
    * @brief Returns all descriptors, grouping those with a _group_ field, and
    *        returning those without a group field as a map with a
    *        single element.
+   *
+   * Groups are computed once when the manifest is loaded.
    */
-  [[nodiscard]] std::vector<InstallDescriptors>
+  [[nodiscard]] const std::vector<InstallDescriptors> &
   getGroupedDescriptors() const
   {
-    return flox::resolver::getGroupedDescriptors( this->descriptors );
+    return this->groupedDescriptors;
   }
 
 
@@ -108,6 +108,9 @@ private:
   /** Lazily initialized environment wrapper. */
   std::optional<Environment> environment;
 
+  /** Inputs and resolutions shared with other environments ( if any ). */
+  std::shared_ptr<EnvironmentCache> environmentCache;
+
 
 protected:
 
@@ -219,6 +222,15 @@ protected:
     return this->lockfileRaw;
   }
 
+  /**
+   * @brief Share inputs and resolutions with other environments.
+   *
+   * @throws @a EnvironmentMixinException if called after @a environment is
+   * initialized.
+   */
+  void
+  setEnvironmentCache( std::shared_ptr<EnvironmentCache> cache );
+
 
 public:
 
@@ -278,6 +290,35 @@ public:
   [[nodiscard]] Environment &
   getEnvironment();
 
+  /**
+   * @brief Hash the manifests that a new lockfile would be created from.
+   *
+   * This does not initialize @a environment, so it may be used to check
+   * whether an existing lockfile is up to date without initializing `nix`
+   * or opening any databases.
+   * @see flox::resolver::getLockfileInputsHash
+   */
+  [[nodiscard]] std::string
+  getInputsHash();
+
+  /**
+   * @brief Whether the old lockfile was created from the same manifests,
+   *        and may be reused as is.
+   * @see flox::resolver::EnvironmentMixin::getInputsHash
+   */
+  [[nodiscard]] bool
+  hasCurrentLockfile();
+
+  /**
+   * @brief Lock the environment.
+   *
+   * If the old lockfile was created from the same manifests it is returned
+   * without initializing @a environment.
+   * @see flox::resolver::EnvironmentMixin::getInputsHash
+   */
+  [[nodiscard]] LockfileRaw
+  lockEnvironment();
+
   /* -------------------------- argument parsers ---------------------------- */
 
   /**
@@ -341,6 +382,13 @@ private:
 
 protected:
 
+  /** @brief Set whether to override manifest registries for `flox` GA. */
+  void
+  setGARegistry( bool gaRegistry )
+  {
+    this->gaRegistry = gaRegistry;
+  }
+
   /**
    * @brief Initialize the @a globalManifest member variable.
    *        When `--ga-registry` is set it enforces a GA compliant manifest by
@@ -362,6 +410,13 @@ protected:
 
 public:
 
+  /** @brief Whether manifest registries are overridden for `flox` GA. */
+  [[nodiscard]] bool
+  isGARegistry() const
+  {
+    return this->gaRegistry;
+  }
+
   /**
    * @brief Hard codes a manifest with only `github:NixOS/nixpkgs/release-23.05`
    * with `--ga-registry`.
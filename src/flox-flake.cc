@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <exception>
+#include <filesystem>
 #include <functional>
 #include <memory>
 #include <nix/attr-set.hh>
@@ -36,6 +37,42 @@
 
 namespace flox {
 
+/* -------------------------------------------------------------------------- */
+
+eval_cache_mode evalCacheMode = ECM_READ_WRITE;
+
+
+/* -------------------------------------------------------------------------- */
+
+std::filesystem::path
+getEvalCachePath( const nix::flake::Fingerprint & fingerprint )
+{
+  /* Keep aligned with `nix::eval_cache::AttrDb'. */
+  return std::filesystem::path( nix::getCacheDir() ) / "nix" / "eval-cache-v5"
+         / ( fingerprint.to_string( nix::Base16, false ) + ".sqlite" );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Whether to open an eval cache for a locked flake. */
+static bool
+shouldUseEvalCache( const nix::flake::Fingerprint & fingerprint )
+{
+  if ( ! ( nix::evalSettings.useEvalCache && nix::evalSettings.pureEval ) )
+    {
+      return false;
+    }
+  switch ( evalCacheMode )
+    {
+      case ECM_WARM:
+        return std::filesystem::exists( getEvalCachePath( fingerprint ) );
+      case ECM_NONE: return false;
+      default: return true;
+    }
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 FloxFlake::FloxFlake( const nix::ref<nix::EvalState> & state,
@@ -67,7 +104,7 @@ FloxFlake::openEvalCache()
     {
       auto fingerprint = this->lockedFlake.getFingerprint();
       this->_cache     = std::make_shared<nix::eval_cache::EvalCache>(
-        ( nix::evalSettings.useEvalCache && nix::evalSettings.pureEval )
+        shouldUseEvalCache( fingerprint )
               ? std::optional { std::cref( fingerprint ) }
               : std::nullopt,
         *this->state,
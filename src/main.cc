@@ -49,6 +49,12 @@ run( int argc, char * argv[] )
   flox::pkgdb::ListCommand cmdList;
   prog.add_subparser( cmdList.getParser() );
 
+  flox::pkgdb::GcCommand cmdGc;
+  prog.add_subparser( cmdGc.getParser() );
+
+  flox::pkgdb::MergeCommand cmdMerge;
+  prog.add_subparser( cmdMerge.getParser() );
+
   flox::search::SearchCommand cmdSearch;
   prog.add_subparser( cmdSearch.getParser() );
 
@@ -81,6 +87,8 @@ run( int argc, char * argv[] )
   if ( prog.is_subcommand_used( "scrape" ) ) { return cmdScrape.run(); }
   if ( prog.is_subcommand_used( "get" ) ) { return cmdGet.run(); }
   if ( prog.is_subcommand_used( "list" ) ) { return cmdList.run(); }
+  if ( prog.is_subcommand_used( "gc" ) ) { return cmdGc.run(); }
+  if ( prog.is_subcommand_used( "merge" ) ) { return cmdMerge.run(); }
   if ( prog.is_subcommand_used( "search" ) ) { return cmdSearch.run(); }
   if ( prog.is_subcommand_used( "manifest" ) ) { return cmdManifest.run(); }
   if ( prog.is_subcommand_used( "parse" ) ) { return cmdParse.run(); }
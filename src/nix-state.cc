@@ -27,21 +27,14 @@ namespace flox {
 /* -------------------------------------------------------------------------- */
 
 void
-initNix()
+initNixConfig()
 {
-  static bool didNixInit = false;
-  if ( didNixInit ) { return; }
+  static bool didNixConfigInit = false;
+  if ( didNixConfigInit ) { return; }
 
   // NOLINTNEXTLINE
   nix::setStackSize( ( std::size_t( 64 ) * 1024 ) * 1024 );
   nix::initNix();
-  nix::initGC();
-  /* Suppress benign warnings about `nix.conf'. */
-  nix::Verbosity oldVerbosity = nix::verbosity;
-  nix::verbosity              = nix::lvlError;
-  nix::initPlugins();
-  /* Restore verbosity to `nix' global setting */
-  nix::verbosity = oldVerbosity;
 
   nix::evalSettings.enableImportFromDerivation.setDefault( false );
   nix::evalSettings.pureEval.setDefault( true );
@@ -54,6 +47,28 @@ initNix()
   if ( nix::logger != nullptr ) { delete nix::logger; }
   nix::logger = makeFilteredLogger( printBuildLogs );
 
+  didNixConfigInit = true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+initNix()
+{
+  static bool didNixInit = false;
+  if ( didNixInit ) { return; }
+
+  initNixConfig();
+
+  nix::initGC();
+  /* Suppress benign warnings about `nix.conf'. */
+  nix::Verbosity oldVerbosity = nix::verbosity;
+  nix::verbosity              = nix::lvlError;
+  nix::initPlugins();
+  /* Restore verbosity to `nix' global setting */
+  nix::verbosity = oldVerbosity;
+
   didNixInit = true;
 }
 
@@ -0,0 +1,624 @@
+/* ========================================================================== *
+ *
+ * @file pkgdb/cache-index.cc
+ *
+ * @brief An index of package databases in a cache directory.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <nix/error.hh>
+#include <nix/fmt.hh>
+#include <nix/logging.hh>
+#include <sqlite3pp.hh>
+
+#include "flox/core/util.hh"
+#include "flox/pkgdb/cache-index.hh"
+#include "flox/pkgdb/write.hh"
+
+#include "./schemas.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+void
+to_json( nlohmann::json & jto, const CacheEntry & entry )
+{
+  jto = { { "string", entry.lockedRef.string },
+          { "attrs", entry.lockedRef.attrs },
+          { "fingerprint", entry.fingerprint.to_string( nix::Base16, false ) },
+          { "size", entry.size },
+          { "lastAccess", entry.lastAccess },
+          { "prefixes", entry.prefixes } };
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Get the last modification time of a file in seconds since epoch. */
+static std::time_t
+getModifiedTime( const std::filesystem::path & path )
+{
+  auto mtime = std::filesystem::last_write_time( path );
+  auto sctp  = std::chrono::file_clock::to_sys( mtime );
+  return std::chrono::system_clock::to_time_t(
+    std::chrono::time_point_cast<std::chrono::system_clock::duration>( sctp ) );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Get the directory holding shards of a database in a cache
+ *        directory, named after the database's fingerprint.
+ */
+static std::filesystem::path
+getShardDir( const std::filesystem::path & path )
+{
+  return path.parent_path() / path.stem();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Get the size of a database including its journal ( if any ), and
+ *        any shards which have not been merged into it.
+ */
+static std::uintmax_t
+getDbSize( const std::filesystem::path & path )
+{
+  std::uintmax_t size = 0;
+  for ( const char * suffix : { "", "-journal", "-wal" } )
+    {
+      std::error_code ec;
+      auto            part
+        = std::filesystem::file_size( path.string() + suffix, ec );
+      if ( ! ec ) { size += part; }
+    }
+
+  std::error_code ec;
+  for ( const auto & entry :
+        std::filesystem::directory_iterator( getShardDir( path ), ec ) )
+    {
+      if ( entry.is_regular_file( ec ) ) { size += entry.file_size( ec ); }
+    }
+  return size;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Lock a database and each of its shards without waiting.
+ * @param path Path to the database.
+ * @param locks Set to the locked paths and their lock descriptors.
+ * @return `false` if another process holds any of the locks.
+ */
+static bool
+lockDbAndShards(
+  const std::filesystem::path &                                     path,
+  std::vector<std::pair<std::filesystem::path, nix::AutoCloseFD>> & locks )
+{
+  std::vector<std::filesystem::path> paths = { path };
+  std::error_code                    ec;
+  for ( const auto & entry :
+        std::filesystem::directory_iterator( getShardDir( path ), ec ) )
+    {
+      if ( entry.path().extension() == ".sqlite" )
+        {
+          paths.emplace_back( entry.path() );
+        }
+    }
+  for ( auto & dbPath : paths )
+    {
+      nix::AutoCloseFD lock = lockPkgDb( dbPath, false );
+      if ( ! lock ) { return false; }
+      locks.emplace_back( std::move( dbPath ), std::move( lock ) );
+    }
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @return Whether a database or any of its shards exist. */
+static bool
+existsDbOrShards( const std::filesystem::path & path )
+{
+  return std::filesystem::exists( path )
+         || std::filesystem::is_directory( getShardDir( path ) );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Get the completely scraped `<SUBTREE>.<SYSTEM>' prefixes of a db. */
+static std::vector<std::string>
+getScrapedPrefixes( PkgDbReadOnly & pdb )
+{
+  std::vector<std::string> prefixes;
+  sqlite3pp::query         qry(
+    pdb.db,
+    "SELECT Subtrees.attrName || '.' || Systems.attrName FROM AttrSets Systems"
+    "  INNER JOIN AttrSets Subtrees ON ( Systems.parent = Subtrees.id )"
+    "  WHERE ( Subtrees.parent = 0 ) AND Systems.done" );
+  for ( auto row : qry ) { prefixes.emplace_back( row.get<std::string>( 0 ) ); }
+  return prefixes;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Find the databases in a cache directory.
+ *
+ * Shards of databases which haven't been created yet are reported under the
+ * database's path, using the first shard as the database to read
+ * `LockedFlake' info from.
+ * @return Pairs of database paths, and the path of the database or shard to
+ *         read them from.
+ */
+static std::vector<std::pair<std::filesystem::path, std::filesystem::path>>
+findCachedDbs( const std::filesystem::path & cacheDir )
+{
+  std::vector<std::pair<std::filesystem::path, std::filesystem::path>> dbs;
+  for ( const auto & entry : std::filesystem::directory_iterator( cacheDir ) )
+    {
+      std::filesystem::path path  = entry.path();
+      std::filesystem::path shard = entry.path();
+      if ( entry.is_directory() )
+        {
+          path = entry.path().string() + ".sqlite";
+          if ( std::filesystem::exists( path ) ) { continue; }
+          std::optional<std::filesystem::path> first;
+          for ( const auto & file :
+                std::filesystem::directory_iterator( entry.path() ) )
+            {
+              if ( ( file.path().extension() == ".sqlite" )
+                   && isSQLiteDb( file.path() )
+                   && ( ( ! first.has_value() ) || ( file.path() < *first ) ) )
+                {
+                  first = file.path();
+                }
+            }
+          if ( ! first.has_value() ) { continue; }
+          shard = *first;
+        }
+      else if ( ( entry.path().filename() == CACHE_INDEX_NAME )
+                || ( entry.path().extension() != ".sqlite" )
+                || ( ! isSQLiteDb( entry.path() ) ) )
+        {
+          continue;
+        }
+      dbs.emplace_back( std::move( path ), std::move( shard ) );
+    }
+  return dbs;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+CacheIndex::CacheIndex( std::filesystem::path cacheDir )
+  : cacheDir( std::move( cacheDir ) )
+{
+  std::filesystem::create_directories( this->cacheDir );
+  this->db.connect( ( this->cacheDir / CACHE_INDEX_NAME ).string().c_str(),
+                    SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE );
+  this->db.set_busy_handler( busyHandler );
+  this->initTables();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+CacheIndex::initTables()
+{
+  sqlite3pp::command cmd( this->db, sql_cacheIndex );
+  if ( sql_rc rcode = cmd.execute_all(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to initialize cache index tables:(%d) %s",
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+CacheIndex::upsertEntry( PkgDbReadOnly &               pdb,
+                         const std::filesystem::path & path,
+                         std::time_t                   lastAccess )
+{
+  std::string fpStr = pdb.fingerprint.to_string( nix::Base16, false );
+
+  sqlite3pp::transaction txn( this->db );
+
+  sqlite3pp::command cmd(
+    this->db,
+    "INSERT INTO Databases ( fingerprint, path, string, attrs, size"
+    "                      , lastAccess ) VALUES ( ?, ?, ?, ?, ?, ? )"
+    "  ON CONFLICT ( fingerprint ) DO UPDATE SET"
+    "    path = excluded.path, size = excluded.size"
+    "  , lastAccess = max( lastAccess, excluded.lastAccess )" );
+  cmd.bind( 1, fpStr, sqlite3pp::nocopy );
+  cmd.bind( 2, path.string(), sqlite3pp::copy );
+  cmd.bind( 3, pdb.lockedRef.string, sqlite3pp::nocopy );
+  cmd.bind( 4, pdb.lockedRef.attrs.dump(), sqlite3pp::copy );
+  cmd.bind( 5, static_cast<long long>( getDbSize( path ) ) );
+  cmd.bind( 6, static_cast<long long>( lastAccess ) );
+  if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to write cache index entry for '%s':(%d) %s",
+                  pdb.dbPath.string(),
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+
+  /* Record completely scraped `<SUBTREE>.<SYSTEM>' prefixes. */
+  sqlite3pp::command clear(
+    this->db,
+    "DELETE FROM DatabasePrefixes WHERE fingerprint = ?" );
+  clear.bind( 1, fpStr, sqlite3pp::nocopy );
+  if ( sql_rc rcode = clear.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to clear cache index prefixes for '%s':(%d) %s",
+                  pdb.dbPath.string(),
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+
+  for ( const auto & prefix : getScrapedPrefixes( pdb ) )
+    {
+      sqlite3pp::command add(
+        this->db,
+        "INSERT OR IGNORE INTO DatabasePrefixes ( fingerprint, prefix )"
+        "  VALUES ( ?, ? )" );
+      add.bind( 1, fpStr, sqlite3pp::nocopy );
+      add.bind( 2, prefix, sqlite3pp::nocopy );
+      if ( sql_rc rcode = add.execute(); isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to write cache index prefixes for '%s':(%d) %s",
+                      pdb.dbPath.string(),
+                      rcode,
+                      this->db.error_msg() ) );
+        }
+    }
+
+  txn.commit();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+CacheIndex::removeEntry( const Fingerprint & fingerprint )
+{
+  std::string fpStr = fingerprint.to_string( nix::Base16, false );
+  for ( const char * stmt :
+        { "DELETE FROM DatabasePrefixes WHERE fingerprint = ?",
+          "DELETE FROM Databases WHERE fingerprint = ?" } )
+    {
+      sqlite3pp::command cmd( this->db, stmt );
+      cmd.bind( 1, fpStr, sqlite3pp::nocopy );
+      if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to remove cache index entry '%s':(%d) %s",
+                      fpStr,
+                      rcode,
+                      this->db.error_msg() ) );
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+CacheIndex::recordAccess( PkgDbReadOnly & pdb )
+{
+  this->upsertEntry( pdb, pdb.dbPath, std::time( nullptr ) );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::optional<std::time_t>
+CacheIndex::getLastAccess( const std::filesystem::path & cacheDir,
+                           const Fingerprint &           fingerprint )
+{
+  std::filesystem::path path = cacheDir / CACHE_INDEX_NAME;
+  if ( ! std::filesystem::exists( path ) ) { return std::nullopt; }
+
+  SQLiteDb db;
+  if ( sql_rc rcode
+       = db.connect( path.string().c_str(), SQLITE_OPEN_READONLY );
+       isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to open cache index '%s':(%d) %s",
+                  path.string(),
+                  rcode,
+                  db.error_msg() ) );
+    }
+  db.set_busy_handler( busyHandler );
+
+  sqlite3pp::query qry(
+    db,
+    "SELECT lastAccess FROM Databases WHERE fingerprint = ?" );
+  qry.bind( 1, fingerprint.to_string( nix::Base16, false ), sqlite3pp::copy );
+  auto itr = qry.begin();
+  if ( itr == qry.end() ) { return std::nullopt; }
+  return static_cast<std::time_t>( ( *itr ).get<long long>( 0 ) );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+CacheIndex::refresh()
+{
+  /* Collect known databases and their paths. */
+  std::map<std::string, std::filesystem::path> known;
+  {
+    sqlite3pp::query qry( this->db, "SELECT fingerprint, path FROM Databases" );
+    for ( auto row : qry )
+      {
+        known.emplace( row.get<std::string>( 0 ), row.get<std::string>( 1 ) );
+      }
+  }
+
+  /* Drop entries for deleted databases. */
+  for ( const auto & [fpStr, path] : known )
+    {
+      if ( ! existsDbOrShards( path ) )
+        {
+          this->removeEntry(
+            nix::Hash::parseNonSRIUnprefixed( fpStr, nix::htSHA256 ) );
+        }
+    }
+
+  for ( const auto & [path, shard] : findCachedDbs( this->cacheDir ) )
+    {
+      /* Only update sizes of known databases without opening them. */
+      if ( auto old = known.find( path.stem().string() );
+           old != known.end() && ( old->second == path ) )
+        {
+          sqlite3pp::command cmd(
+            this->db,
+            "UPDATE Databases SET size = ? WHERE fingerprint = ?" );
+          cmd.bind( 1, static_cast<long long>( getDbSize( path ) ) );
+          cmd.bind( 2, old->first, sqlite3pp::nocopy );
+          if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+            {
+              throw PkgDbException(
+                nix::fmt( "failed to update cache index entry '%s':(%d) %s",
+                          old->first,
+                          rcode,
+                          this->db.error_msg() ) );
+            }
+          continue;
+        }
+
+      try
+        {
+          PkgDbReadOnly pdb( shard.string() );
+          this->upsertEntry( pdb, path, getModifiedTime( shard ) );
+        }
+      catch ( const PkgDbException & )
+        {
+          /* Skip databases we can't read such as those being created. */
+          nix::ignoreException( nix::lvlDebug );
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<CacheEntry>
+CacheIndex::getEntries()
+{
+  std::map<std::string, std::vector<std::string>> prefixes;
+  {
+    sqlite3pp::query qry( this->db,
+                          "SELECT fingerprint, prefix FROM DatabasePrefixes"
+                          "  ORDER BY prefix" );
+    for ( auto row : qry )
+      {
+        prefixes[row.get<std::string>( 0 )].emplace_back(
+          row.get<std::string>( 1 ) );
+      }
+  }
+
+  std::vector<CacheEntry> entries;
+  sqlite3pp::query        qry(
+    this->db,
+    "SELECT fingerprint, path, string, attrs, size, lastAccess FROM Databases"
+    "  ORDER BY lastAccess DESC, fingerprint" );
+  for ( auto row : qry )
+    {
+      CacheEntry entry;
+      auto       fpStr = row.get<std::string>( 0 );
+      entry.fingerprint
+        = nix::Hash::parseNonSRIUnprefixed( fpStr, nix::htSHA256 );
+      entry.path             = row.get<std::string>( 1 );
+      entry.lockedRef.string = row.get<std::string>( 2 );
+      entry.lockedRef.attrs
+        = nlohmann::json::parse( row.get<std::string>( 3 ) );
+      entry.size       = static_cast<std::uintmax_t>( row.get<long long>( 4 ) );
+      entry.lastAccess = static_cast<std::time_t>( row.get<long long>( 5 ) );
+      if ( auto itr = prefixes.find( fpStr ); itr != prefixes.end() )
+        {
+          entry.prefixes = std::move( itr->second );
+        }
+      entries.emplace_back( std::move( entry ) );
+    }
+  return entries;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<CacheEntry>
+CacheIndex::collectGarbage( std::uintmax_t maxSize, bool dryRun )
+{
+  this->refresh();
+
+  std::vector<CacheEntry> entries = this->getEntries();
+  std::uintmax_t          total   = 0;
+  for ( const auto & entry : entries ) { total += entry.size; }
+
+  /* Evict from the least recently accessed end. */
+  std::vector<CacheEntry> evicted;
+  while ( ( maxSize < total ) && ( ! entries.empty() ) )
+    {
+      CacheEntry entry = std::move( entries.back() );
+      entries.pop_back();
+
+      /* Skip databases and shards being scraped by other processes. */
+      std::vector<std::pair<std::filesystem::path, nix::AutoCloseFD>> locks;
+      if ( ! lockDbAndShards( entry.path, locks ) )
+        {
+          nix::logger->log( nix::lvlTalkative,
+                            nix::fmt( "Skipping database '%s' which is in use",
+                                      entry.path.string() ) );
+          continue;
+        }
+
+      nix::logger->log( nix::lvlTalkative,
+                        nix::fmt( "Deleting database '%s'",
+                                  entry.path.string() ) );
+      if ( ! dryRun )
+        {
+          for ( const char * suffix : { "", "-journal", "-wal", "-shm" } )
+            {
+              std::filesystem::remove( entry.path.string() + suffix );
+            }
+          for ( const auto & [path, lock] : locks )
+            {
+              std::filesystem::remove( path );
+              std::filesystem::remove( path.string() + "-journal" );
+              deletePkgDbLock( path, lock );
+            }
+          /* Only removes the directory if it's empty. */
+          std::error_code err;
+          std::filesystem::remove( getShardDir( entry.path ), err );
+          this->removeEntry( entry.fingerprint );
+        }
+      total -= std::min( total, entry.size );
+      evicted.emplace_back( std::move( entry ) );
+    }
+  return evicted;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<CacheEntry>
+scanCacheDir( const std::filesystem::path & cacheDir )
+{
+  std::vector<CacheEntry> entries;
+  for ( const auto & [path, shard] : findCachedDbs( cacheDir ) )
+    {
+      try
+        {
+          PkgDbReadOnly pdb( shard.string() );
+          CacheEntry    entry;
+          entry.fingerprint = pdb.fingerprint;
+          entry.path        = path;
+          entry.lockedRef   = pdb.lockedRef;
+          entry.size        = getDbSize( path );
+          entry.lastAccess  = getModifiedTime( shard );
+          entry.prefixes    = getScrapedPrefixes( pdb );
+          std::sort( entry.prefixes.begin(), entry.prefixes.end() );
+          entries.emplace_back( std::move( entry ) );
+        }
+      catch ( const PkgDbException & )
+        {
+          /* Skip databases we can't read such as those being created. */
+          nix::ignoreException( nix::lvlDebug );
+        }
+    }
+
+  /* Match the order of `CacheIndex::getEntries()'. */
+  std::sort( entries.begin(),
+             entries.end(),
+             []( const CacheEntry & lhs, const CacheEntry & rhs )
+             {
+               if ( lhs.lastAccess != rhs.lastAccess )
+                 {
+                   return rhs.lastAccess < lhs.lastAccess;
+                 }
+               return lhs.fingerprint.to_string( nix::Base16, false )
+                      < rhs.fingerprint.to_string( nix::Base16, false );
+             } );
+  return entries;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+recordCacheAccess( PkgDbReadOnly &               pdb,
+                   const std::filesystem::path & cacheDir,
+                   bool                          modified )
+{
+  if ( ( pdb.dbPath.parent_path() != cacheDir )
+       || ( access( cacheDir.c_str(), W_OK ) != 0 ) )
+    {
+      return;
+    }
+  try
+    {
+      if ( ! modified )
+        {
+          auto lastAccess = CacheIndex::getLastAccess( cacheDir,
+                                                       pdb.fingerprint );
+          if ( lastAccess.has_value()
+               && ( std::time( nullptr ) - *lastAccess
+                    < CACHE_ACCESS_INTERVAL.count() ) )
+            {
+              return;
+            }
+        }
+      CacheIndex( cacheDir ).recordAccess( pdb );
+    }
+  catch ( ... )
+    {
+      nix::ignoreException( nix::lvlDebug );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
@@ -7,7 +7,9 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <cctype>
 #include <filesystem>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <string>
@@ -43,6 +45,55 @@ class Store;
 
 namespace flox::pkgdb {
 
+/* -------------------------------------------------------------------------- */
+
+std::uintmax_t
+parseSize( const std::string & str )
+{
+  std::size_t    end  = 0;
+  std::uintmax_t size = 0;
+  /* `std::stoull' accepts ( and negates ) a leading `-'. */
+  if ( str.empty() || ( ! std::isdigit( str.front() ) ) )
+    {
+      throw command::InvalidArgException( "invalid size `" + str + "'" );
+    }
+  try
+    {
+      size = std::stoull( str, &end );
+    }
+  catch ( const std::exception & )
+    {
+      throw command::InvalidArgException( "invalid size `" + str + "'" );
+    }
+
+  static const std::uintmax_t kibi   = 1024;
+  std::string                 suffix = str.substr( end );
+  std::uintmax_t              unit   = 0;
+  if ( suffix.empty() ) { return size; }
+  if ( suffix.size() == 1 )
+    {
+      switch ( std::toupper( suffix.front() ) )
+        {
+          case 'K': unit = kibi; break;
+          case 'M': unit = kibi * kibi; break;
+          case 'G': unit = kibi * kibi * kibi; break;
+          default: break;
+        }
+    }
+  if ( unit == 0 )
+    {
+      throw command::InvalidArgException(
+        "invalid size suffix `" + suffix
+        + "', expected one of `K', `M', or `G'" );
+    }
+  if ( ( std::numeric_limits<std::uintmax_t>::max() / unit ) < size )
+    {
+      throw command::InvalidArgException( "size `" + str + "' is too large" );
+    }
+  return size * unit;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 argparse::Argument &
@@ -30,7 +30,7 @@ DbPackage::initRawPackage( PkgDbReadOnly & pkgdb )
       , 'outputs',          json( outputs )
       , 'outputsToInstall', json( outputsToInstall )
       , 'broken',           iif( broken, json( 'true' ), json( 'false' ) )
-      , 'unfree',           iif( broken, json( 'true' ), json( 'false' ) )
+      , 'unfree',           iif( unfree, json( 'true' ), json( 'false' ) )
       , 'description',      description
       ) AS json
       FROM Packages
@@ -40,11 +40,24 @@ DbPackage::initRawPackage( PkgDbReadOnly & pkgdb )
     )SQL" );
   qry.bind( 1, static_cast<long long>( this->pkgId ) );
   auto json = nlohmann::json::parse( ( *qry.begin() ).get<std::string>( 0 ) );
+  /* `outputsToInstall' is `NULL' when it wasn't scraped. */
+  bool defaultOutputs = json["outputsToInstall"].is_null();
+  if ( defaultOutputs ) { json.erase( "outputsToInstall" ); }
   /* We have to stash our `path' because `from_json' would clear it. */
   auto pathTmp = std::move( this->path );
   from_json( json, dynamic_cast<RawPackage &>( *this ) );
   /* Restore original `path'. */
   this->path = std::move( pathTmp );
+  /* Fall back to the outputs preceding and including `out', like `nix'. */
+  if ( defaultOutputs )
+    {
+      this->outputsToInstall.clear();
+      for ( const auto & output : this->outputs )
+        {
+          this->outputsToInstall.emplace_back( output );
+          if ( output == "out" ) { break; }
+        }
+    }
 }
 
 
@@ -0,0 +1,190 @@
+/* ========================================================================== *
+ *
+ * @file pkgdb/eval-watchdog.cc
+ *
+ * @brief Interrupts evaluation of attributes which exceed a time or
+ *        allocation budget.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <exception>
+#include <utility>
+
+#if HAVE_BOEHMGC
+#  include <gc/gc.h>
+#endif
+
+#include <nix/logging.hh>
+
+#include "flox/pkgdb/eval-watchdog.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+/** How often the watchdog thread checks the budget. */
+static const std::chrono::milliseconds pollInterval( 10 );
+
+
+/** @return The number of bytes allocated by this process so far. */
+static std::size_t
+getAllocatedBytes()
+{
+#if HAVE_BOEHMGC
+  return GC_get_total_bytes();
+#else
+  return 0;
+#endif
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+EvalWatchdog::EvalWatchdog(
+  std::optional<std::chrono::milliseconds> timeBudget,
+  std::optional<std::size_t>               allocBudget )
+  : timeBudget( timeBudget ), allocBudget( allocBudget )
+{
+#if ! HAVE_BOEHMGC
+  if ( this->allocBudget.has_value() )
+    {
+      nix::warn( "ignoring allocation budget since `nix' was built without "
+                 "a garbage collector" );
+      this->allocBudget = std::nullopt;
+    }
+#endif
+  if ( ( ! this->timeBudget.has_value() )
+       && ( ! this->allocBudget.has_value() ) )
+    {
+      return;
+    }
+
+  this->prevInterruptCheck = std::exchange(
+    nix::interruptCheck,
+    [this]() { return this->interruptCheck(); } );
+  this->watcher = std::thread( [this]() { this->run(); } );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+EvalWatchdog::~EvalWatchdog()
+{
+  if ( ! this->watcher.joinable() ) { return; }
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    this->stopping = true;
+  }
+  this->changed.notify_all();
+  this->watcher.join();
+  nix::interruptCheck = std::move( this->prevInterruptCheck );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+EvalWatchdog::run()
+{
+  std::unique_lock<std::mutex> lock( this->mutex );
+  while ( ! this->stopping )
+    {
+      if ( ! this->armed )
+        {
+          this->changed.wait( lock,
+                              [&]() { return this->stopping || this->armed; } );
+          continue;
+        }
+
+      this->changed.wait_for( lock, pollInterval );
+      if ( this->stopping || ( ! this->armed ) ) { continue; }
+
+      auto elapsed = std::chrono::steady_clock::now() - this->started;
+      if ( this->timeBudget.has_value() && ( *this->timeBudget < elapsed ) )
+        {
+          this->reason = nix::fmt( "exceeded time budget of %d ms",
+                                   this->timeBudget->count() );
+        }
+      else if ( this->allocBudget.has_value()
+                && ( *this->allocBudget
+                     < ( getAllocatedBytes() - this->startBytes ) ) )
+        {
+          this->reason = nix::fmt( "exceeded allocation budget of %d bytes",
+                                   *this->allocBudget );
+        }
+      else { continue; }
+
+      this->armed = false;
+      this->expired.store( true );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool
+EvalWatchdog::interruptCheck()
+{
+  /* Like `nix::checkInterrupt()', don't throw while an exception is being
+   * handled. */
+  if ( this->expired.load() && ( std::uncaught_exceptions() == 0 ) )
+    {
+      this->expired.store( false );
+      std::string reason;
+      {
+        std::lock_guard<std::mutex> lock( this->mutex );
+        reason = this->reason;
+      }
+      throw EvalBudgetExceeded( "%s", reason );
+    }
+  return ( this->prevInterruptCheck != nullptr )
+         && this->prevInterruptCheck();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+EvalWatchdog::arm()
+{
+  if ( ! this->watcher.joinable() ) { return; }
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    this->armed      = true;
+    this->started    = std::chrono::steady_clock::now();
+    this->startBytes = getAllocatedBytes();
+    this->expired.store( false );
+  }
+  this->changed.notify_all();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+EvalWatchdog::disarm()
+{
+  if ( ! this->watcher.joinable() ) { return; }
+  {
+    std::lock_guard<std::mutex> lock( this->mutex );
+    this->armed = false;
+    this->expired.store( false );
+  }
+  this->changed.notify_all();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
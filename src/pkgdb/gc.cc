@@ -0,0 +1,106 @@
+/* ========================================================================== *
+ *
+ * @file pkgdb/gc.cc
+ *
+ * @brief Implementation of `pkgdb gc` subcommand.
+ *
+ * Used to evict least recently used databases from a cache directory.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <iostream>
+#include <string>
+
+#include "flox/pkgdb/cache-index.hh"
+#include "flox/pkgdb/command.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+GcCommand::GcCommand() : parser( "gc" )
+{
+  this->parser.add_description(
+    "Delete least recently used Package DBs from a cache directory" );
+
+  this->parser.add_argument( "-c", "--cachedir" )
+    .help( "delete databases in a given directory" )
+    .metavar( "PATH" )
+    .nargs( 1 )
+    .action( [&]( const std::string & cacheDir )
+             { this->cacheDir = nix::absPath( cacheDir ); } );
+
+  this->parser.add_argument( "--max-size" )
+    .help( "maximum total size of databases, with an optional `K', `M', "
+           "or `G' suffix" )
+    .required()
+    .metavar( "SIZE" )
+    .nargs( 1 )
+    .action( [&]( const std::string & size )
+             { this->maxSize = parseSize( size ); } );
+
+  this->parser.add_argument( "-n", "--dry-run" )
+    .help( "list databases that would be deleted without deleting them" )
+    .nargs( 0 )
+    .action( [&]( const std::string & ) { this->dryRun = true; } );
+
+  this->parser.add_argument( "-j", "--json" )
+    .help( "output as JSON" )
+    .nargs( 0 )
+    .action( [&]( const std::string & ) { this->json = true; } );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+GcCommand::run()
+{
+  std::filesystem::path cacheDir
+    = this->cacheDir.value_or( getPkgDbCachedir() );
+
+  if ( ! std::filesystem::exists( cacheDir ) )
+    {
+      if ( this->cacheDir.has_value() )
+        {
+          std::cerr << "No such cachedir: " << cacheDir << std::endl;
+          return EXIT_FAILURE;
+        }
+      return EXIT_SUCCESS;
+    }
+
+  CacheIndex index( cacheDir );
+  auto evicted = index.collectGarbage( this->maxSize.value(), this->dryRun );
+
+  if ( this->json )
+    {
+      nlohmann::json dbs = nlohmann::json::object();
+      for ( const auto & entry : evicted ) { dbs[entry.path.string()] = entry; }
+      std::cout << dbs.dump() << std::endl;
+    }
+  else
+    {
+      for ( const auto & entry : evicted )
+        {
+          std::cout << entry.path.string() << std::endl;
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
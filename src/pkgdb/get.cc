@@ -142,7 +142,8 @@ GetCommand::runFlake()
     = { { "string", this->db->lockedRef.string },
         { "attrs", this->db->lockedRef.attrs },
         { "fingerprint",
-          this->db->fingerprint.to_string( nix::Base16, false ) } };
+          this->db->fingerprint.to_string( nix::Base16, false ) },
+        { "fields", this->db->getScrapeFields() } };
   std::cout << flakeInfo.dump() << std::endl;
   return EXIT_SUCCESS;
 }
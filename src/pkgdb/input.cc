@@ -7,6 +7,7 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <algorithm>
 #include <assert.h>
 #include <list>
 #include <map>
@@ -19,10 +20,15 @@
 #include <optional>
 #include <ostream>
 #include <sqlite3pp.hh>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #include "flox/core/exceptions.hh"
+#include "flox/pkgdb/cache-index.hh"
+#include "flox/pkgdb/eval-watchdog.hh"
 #include "flox/pkgdb/input.hh"
+#include "flox/pkgdb/package-writer.hh"
 #include "flox/pkgdb/write.hh"
 
 
@@ -53,8 +59,11 @@ PkgDbInput::init()
       PkgDb( this->getFlake()->lockedFlake, this->dbPath.string() );
     }
 
+  /* Avoid locking the flake if we already know its fingerprint. */
   this->dbRO = std::make_shared<PkgDbReadOnly>(
-    this->getFlake()->lockedFlake.getFingerprint(),
+    this->knownFingerprint.has_value()
+      ? *this->knownFingerprint
+      : this->getFlake()->lockedFlake.getFingerprint(),
     this->dbPath.string() );
 
   /* If the schema version is bad, delete the DB so it will be recreated. */
@@ -85,6 +94,39 @@ PkgDbInput::init()
                   dbVersions.tables,
                   dbVersions.views ) );
     }
+
+  if ( this->cacheDir.has_value() )
+    {
+      this->mergeShards();
+      recordCacheAccess( *this->dbRO, *this->cacheDir );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDbInput::mergeShards()
+{
+  assert( this->cacheDir.has_value() );
+  std::filesystem::path shardDir
+    = getPkgDbShardDir( this->dbRO->fingerprint, *this->cacheDir );
+  if ( ! std::filesystem::is_directory( shardDir ) ) { return; }
+
+  /* Avoid locking the flake, the shards carry their own `LockedFlake'. */
+  try
+    {
+      PkgDb dbRW( this->dbRO->fingerprint, this->dbPath.string() );
+      mergePkgDbShards( dbRW, shardDir );
+    }
+  catch ( const PkgDbException & )
+    {
+      nix::ignoreException( nix::lvlWarn );
+    }
+  catch ( const std::filesystem::filesystem_error & )
+    {
+      nix::ignoreException( nix::lvlWarn );
+    }
 }
 
 
@@ -105,9 +147,33 @@ PkgDbInput::getDbReadWrite()
 /* -------------------------------------------------------------------------- */
 
 void
-PkgDbInput::scrapePrefix( const flox::AttrPath & prefix )
+PkgDbInput::scrapePrefix( const flox::AttrPath & prefix,
+                          const ScrapeOptions &  options )
 {
-  if ( this->getDbReadOnly()->completedAttrSet( prefix ) ) { return; }
+  /* Skeleton prefixes must be backfilled unless a skeleton is requested. */
+  auto isScraped = [&]()
+  {
+    auto dbRO = this->getDbReadOnly();
+    return dbRO->completedAttrSet( prefix )
+           && ( options.skeleton || ( ! dbRO->skeletonAttrSet( prefix ) ) );
+  };
+  if ( isScraped() ) { return; }
+
+  /* Only one process scrapes a database at a time, others wait for it to
+   * finish and reuse its results.
+   * The lock is released when `lock' is closed. */
+  nix::AutoCloseFD lock = lockPkgDb( this->dbPath, false );
+  if ( ! lock )
+    {
+      nix::logger->log(
+        nix::lvlInfo,
+        nix::fmt( "waiting for another process to scrape '%s'",
+                  this->dbPath.string() ) );
+      lock = lockPkgDb( this->dbPath );
+    }
+  /* Another process may have finished scraping the prefix between our
+   * first check and taking the lock. */
+  if ( isScraped() ) { return; }
 
   Todos       todo;
   bool        wasRW = this->dbRW != nullptr;
@@ -122,18 +188,47 @@ PkgDbInput::scrapePrefix( const flox::AttrPath & prefix )
   todo.emplace(
     std::make_tuple( prefix, static_cast<flox::Cursor>( root ), row ) );
 
-  /* Start a transaction */
-  sqlite3pp::transaction txn( dbRW->db );
+  /* Interrupts attributes which exceed their budget, for every target. */
+  EvalWatchdog watchdog( options.timeBudget, options.allocBudget );
+
+  /* Start a transaction, reserving the write lock up front so that readers
+   * which hold a shared lock can't cause a deadlock. */
+  sqlite3pp::transaction txn( dbRW->db, false, true );
   try
     {
-      while ( ! todo.empty() )
+      if ( ! dbRW->completedAttrSet( prefix ) )
+        {
+          /* Packages are written by another thread while we evaluate. */
+          PackageWriter writer( *dbRW );
+          while ( ! todo.empty() )
+            {
+              dbRW->scrape( this->getFlake()->state->symbols,
+                            todo.front(),
+                            todo,
+                            writer,
+                            watchdog,
+                            options );
+              todo.pop();
+            }
+          writer.finish();
+
+          /* Mark the prefix and its descendants as "done" */
+          dbRW->setPrefixDone( row, true, options.skeleton );
+        }
+
+      /* Fill in `meta' for packages scraped as a skeleton, either previously
+       * or by a scrape of a child prefix. */
+      if ( ! options.skeleton )
         {
-          dbRW->scrape( this->getFlake()->state->symbols, todo.front(), todo );
-          todo.pop();
+          dbRW->backfill( row, static_cast<flox::Cursor>( root ), watchdog );
         }
 
-      /* Mark the prefix and its descendants as "done" */
-      dbRW->setPrefixDone( row, true );
+      /* Memoized queries and names may be missing newly added packages. */
+      dbRW->clearQueryCache();
+      this->packageNames.clear();
+
+      /* Rank default candidates for completed `<SUBTREE>.<SYSTEM>' sets. */
+      if ( prefix.size() <= 2 ) { dbRW->updateBestCandidates( prefix ); }
     }
   catch ( const nix::EvalError & err )
     {
@@ -148,6 +243,12 @@ PkgDbInput::scrapePrefix( const flox::AttrPath & prefix )
 
   /* Close the r/w connection if we opened it. */
   if ( ! wasRW ) { this->closeDbReadWrite(); }
+
+  /* Update the database's size and scraped prefixes. */
+  if ( this->cacheDir.has_value() )
+    {
+      recordCacheAccess( *this->dbRO, *this->cacheDir, true );
+    }
 }
 
 
@@ -171,6 +272,334 @@ PkgDbInput::scrapeSystems( const std::vector<System> & systems )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+bool
+PkgDbInput::scrapeAttrPath( const flox::AttrPath & absPath,
+                            const ScrapeOptions &  options )
+{
+  if ( absPath.size() < 3 ) { return false; }
+
+  auto dbRO = this->getDbReadOnly();
+  if ( dbRO->hasAttrSet( flox::AttrPath( absPath.begin(), absPath.end() - 1 ) )
+       && dbRO->hasPackage( absPath ) )
+    {
+      return true;
+    }
+
+  /* A completed prefix already has every package it would contain. */
+  flox::AttrPath prefix( absPath.begin(), absPath.begin() + 2 );
+  if ( dbRO->completedAttrSet( prefix ) ) { return true; }
+
+  /* `packages' is never recursed into by `PkgDb::scrape'. */
+  bool tryRecur = prefix.front() != "packages";
+  if ( ( ! tryRecur ) && ( absPath.size() != 3 ) ) { return true; }
+
+  /* Attributes along the path which failed to evaluate during an earlier
+   * scrape are skipped by `PkgDb::scrape', so they have no packages. */
+  for ( auto itr = absPath.begin() + 2; itr != absPath.end(); ++itr )
+    {
+      flox::AttrPath parent( absPath.begin(), itr );
+      if ( ! dbRO->hasAttrSet( parent ) ) { break; }
+      auto failed = dbRO->getEvalErrors( dbRO->getAttrSetId( parent ) );
+      if ( failed.contains( *itr ) ) { return true; }
+    }
+
+  /* The package is charged to the same budget as it would be when scraping
+   * its prefix, which doesn't include opening the flake. */
+  EvalWatchdog watchdog( options.timeBudget, options.allocBudget );
+  PackageRow   row;
+  try
+    {
+      MaybeCursor cursor = this->getFlake()->maybeOpenCursor( prefix );
+      watchdog.arm();
+
+      /* Follow the same rules as `PkgDb::scrape' for intermediate
+       * attribute sets. */
+      for ( auto itr = absPath.begin() + 2;
+            ( cursor != nullptr ) && ( itr != ( absPath.end() - 1 ) );
+            ++itr )
+        {
+          cursor = cursor->maybeGetAttr( *itr );
+          if ( ( cursor == nullptr ) || cursor->isDerivation() )
+            {
+              return true;
+            }
+          if ( ( prefix.front() == "legacyPackages" ) && ( *itr == "darwin" ) )
+            {
+              continue;
+            }
+          MaybeCursor recur = cursor->maybeGetAttr( "recurseForDerivations" );
+          if ( ( recur == nullptr ) || ( ! recur->getBool() ) ) { return true; }
+        }
+
+      if ( cursor != nullptr )
+        {
+          cursor = cursor->maybeGetAttr( absPath.back() );
+        }
+      if ( ( cursor == nullptr ) || ( ! cursor->isDerivation() ) )
+        {
+          return true;
+        }
+
+      /* Evaluate the package before taking any locks. */
+      row = mkPackageRow( 0,
+                          absPath.back(),
+                          static_cast<flox::Cursor>( cursor ),
+                          false,
+                          dbRO->getScrapeFields() );
+      watchdog.disarm();
+    }
+  catch ( const nix::EvalError & )
+    {
+      nix::ignoreException( nix::lvlDebug );
+      return false;
+    }
+  catch ( const EvalBudgetExceeded & )
+    {
+      /* Scraping the prefix records the attribute as skipped. */
+      nix::ignoreException( nix::lvlDebug );
+      return false;
+    }
+
+  /* Writers follow the same protocol as `scrapePrefix'. */
+  nix::AutoCloseFD lock = lockPkgDb( this->dbPath, false );
+  if ( ! lock )
+    {
+      nix::logger->log(
+        nix::lvlInfo,
+        nix::fmt( "waiting for another process to scrape '%s'",
+                  this->dbPath.string() ) );
+      lock = lockPkgDb( this->dbPath );
+    }
+  /* Another process may have added the package, or scraped its prefix. */
+  if ( dbRO->hasPackage( absPath ) || dbRO->completedAttrSet( prefix ) )
+    {
+      return true;
+    }
+
+  /* Open a read/write connection. */
+  bool wasRW = this->dbRW != nullptr;
+  auto dbRW  = this->getDbReadWrite();
+
+  /* Start a transaction, reserving the write lock up front so that readers
+   * which hold a shared lock can't cause a deadlock. */
+  sqlite3pp::transaction txn( dbRW->db, false, true );
+  try
+    {
+      /* Parents are left as "not done" so the prefix may be scraped later. */
+      row.parentId = dbRW->addOrGetAttrSetId(
+        flox::AttrPath( absPath.begin(), absPath.end() - 1 ) );
+      dbRW->addPackage( row );
+
+      /* Memoized queries and names may be missing newly added packages. */
+      dbRW->clearQueryCache();
+      this->packageNames.clear();
+    }
+  catch ( const PkgDbException & )
+    {
+      txn.rollback();
+      /* Close the r/w connection if we opened it. */
+      if ( ! wasRW ) { this->closeDbReadWrite(); }
+      nix::ignoreException( nix::lvlDebug );
+      return false;
+    }
+
+  /* Close the transaction. */
+  txn.commit();
+
+  /* Close the r/w connection if we opened it. */
+  if ( ! wasRW ) { this->closeDbReadWrite(); }
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<flox::AttrPath>
+PkgDbInput::getQueryPrefixes( const PkgQueryArgs & args )
+{
+  std::vector<flox::AttrPath> prefixes;
+  for ( const auto & subtree : this->getSubtrees() )
+    {
+      /* Skip subtrees that the query filters out. */
+      if ( args.subtrees.has_value()
+           && ( std::find( args.subtrees->begin(),
+                           args.subtrees->end(),
+                           subtree )
+                == args.subtrees->end() ) )
+        {
+          continue;
+        }
+      for ( const auto & system : args.systems )
+        {
+          prefixes.emplace_back( flox::AttrPath {
+            static_cast<std::string>( to_string( subtree ) ),
+            system } );
+        }
+    }
+  return prefixes;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDbInput::scrapeForQuery( const PkgQueryArgs & args )
+{
+  /* Packages' `meta' fields are only needed up front to match packages by
+   * them, while `broken' and `unfree' only rule out candidates. */
+  ScrapeOptions               options;
+  std::vector<flox::AttrPath> prefixes = this->getQueryPrefixes( args );
+  options.skeleton                     = ! args.matchesMeta();
+  for ( const auto & prefix : prefixes )
+    {
+      /* Only one package may match `relPath', so avoid scraping the
+       * whole prefix unless evaluating it directly fails. */
+      if ( args.relPath.has_value()
+           && ( options.skeleton
+                || ( ! this->getDbReadOnly()->skeletonAttrSet( prefix ) ) ) )
+        {
+          flox::AttrPath absPath = prefix;
+          absPath.insert( absPath.end(),
+                          args.relPath->begin(),
+                          args.relPath->end() );
+          if ( ! this->scrapeAttrPath( absPath, options ) )
+            {
+              this->scrapePrefix( prefix, options );
+            }
+        }
+      else { this->scrapePrefix( prefix, options ); }
+    }
+  if ( ! args.needsMeta() ) { return; }
+
+  /* Backfill candidates in skeleton prefixes so that they may be filtered
+   * by `broken' and `unfree'. */
+  std::vector<flox::AttrPath> skeletons;
+  for ( const auto & prefix : prefixes )
+    {
+      if ( this->getDbReadOnly()->skeletonAttrSet( prefix ) )
+        {
+          skeletons.emplace_back( prefix );
+        }
+    }
+  if ( skeletons.empty() ) { return; }
+
+  PkgQueryArgs candidateArgs = args;
+  candidateArgs.allowBroken  = true;
+  candidateArgs.allowUnfree  = true;
+  std::vector<row_id> candidates
+    = PkgQuery( candidateArgs ).execute( this->getDbReadOnly()->db );
+  for ( const auto & prefix : skeletons )
+    {
+      this->backfillPackages( prefix, candidates, options );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDbInput::backfillPackages( const flox::AttrPath &      prefix,
+                              const std::vector<row_id> & packageIds,
+                              const ScrapeOptions &       options )
+{
+  if ( packageIds.empty() ) { return; }
+
+  nix::AutoCloseFD lock = lockPkgDb( this->dbPath, false );
+  if ( ! lock )
+    {
+      nix::logger->log(
+        nix::lvlInfo,
+        nix::fmt( "waiting for another process to scrape '%s'",
+                  this->dbPath.string() ) );
+      lock = lockPkgDb( this->dbPath );
+    }
+
+  MaybeCursor root = this->getFlake()->maybeOpenCursor( prefix );
+  if ( root == nullptr ) { return; }
+
+  bool   wasRW = this->dbRW != nullptr;
+  auto   dbRW  = this->getDbReadWrite();
+  row_id row   = dbRW->addOrGetAttrSetId( prefix );
+
+  sqlite3pp::transaction txn( dbRW->db, false, true );
+  try
+    {
+      EvalWatchdog watchdog( options.timeBudget, options.allocBudget );
+      dbRW->backfill( row,
+                      static_cast<flox::Cursor>( root ),
+                      watchdog,
+                      packageIds );
+      dbRW->clearQueryCache();
+    }
+  catch ( const nix::EvalError & err )
+    {
+      txn.rollback();
+      if ( ! wasRW ) { this->closeDbReadWrite(); }
+      throw NixEvalException( "error scraping flake", err );
+    }
+  txn.commit();
+
+  if ( ! wasRW ) { this->closeDbReadWrite(); }
+
+  if ( this->cacheDir.has_value() )
+    {
+      recordCacheAccess( *this->dbRO, *this->cacheDir, true );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool
+PkgDbInput::mayHaveMatches( const PkgQueryArgs & args )
+{
+  /* Collect names that a matching package must have. */
+  std::vector<std::string> required;
+  if ( args.relPath.has_value() && ( ! args.relPath->empty() ) )
+    {
+      required.emplace_back( args.relPath->back() );
+    }
+  if ( args.pname.has_value() && ( ! args.pname->empty() ) )
+    {
+      required.emplace_back( *args.pname );
+    }
+  if ( args.pnameOrAttrName.has_value() && ( ! args.pnameOrAttrName->empty() ) )
+    {
+      required.emplace_back( *args.pnameOrAttrName );
+    }
+  if ( required.empty() ) { return true; }
+
+  for ( const auto & prefix : this->getQueryPrefixes( args ) )
+    {
+      auto names = this->packageNames.find( prefix );
+      if ( names == this->packageNames.end() )
+        {
+          auto maybeNames = this->getDbReadOnly()->getPackageNames( prefix );
+          /* We can't rule out prefixes that haven't been scraped yet. */
+          if ( ! maybeNames.has_value() ) { return true; }
+          names
+            = this->packageNames.emplace( prefix, std::move( *maybeNames ) )
+                .first;
+        }
+      if ( std::all_of( required.begin(),
+                        required.end(),
+                        [&]( const std::string & name )
+                        {
+                          return std::binary_search( names->second.begin(),
+                                                     names->second.end(),
+                                                     name );
+                        } ) )
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 nlohmann::json
@@ -183,6 +612,49 @@ PkgDbInput::getRowJSON( row_id row )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+std::shared_ptr<PkgDbInput>
+PkgDbInputFactory::mkInput( const std::string &   name,
+                            const RegistryInput & input )
+{
+  std::string key;
+  if ( this->sharedInputs != nullptr )
+    {
+      key = name + ":" + nlohmann::json( input ).dump();
+      if ( auto shared = this->sharedInputs->find( key );
+           shared != this->sharedInputs->end() )
+        {
+          return shared->second;
+        }
+    }
+
+  std::shared_ptr<PkgDbInput> dbInput;
+  if ( auto known = this->fingerprints.find( input.getFlakeRef()->to_string() );
+       known != this->fingerprints.end() )
+    {
+      dbInput = std::make_shared<PkgDbInput>( this->store,
+                                              input,
+                                              known->second,
+                                              this->cacheDir,
+                                              name );
+    }
+  else
+    {
+      dbInput = std::make_shared<PkgDbInput>( this->store,
+                                              input,
+                                              this->cacheDir,
+                                              name );
+    }
+
+  if ( this->sharedInputs != nullptr )
+    {
+      this->sharedInputs->emplace( std::move( key ), dbInput );
+    }
+  return dbInput;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 void
@@ -192,6 +664,7 @@ PkgDbRegistryMixin::initRegistry()
     {
       nix::ref<nix::Store>     store = this->getStore();
       pkgdb::PkgDbInputFactory factory( store );  // TODO: cacheDir
+      prefetchRegistryInputs( this->getRegistryRaw(), store );
       this->registry
         = std::make_shared<Registry<PkgDbInputFactory>>( this->getRegistryRaw(),
                                                          factory );
@@ -218,7 +691,7 @@ PkgDbRegistryMixin::scrapeIfNeeded()
 nix::ref<Registry<PkgDbInputFactory>>
 PkgDbRegistryMixin::getPkgDbRegistry()
 {
-  if ( this->registry == nullptr ) { this->scrapeIfNeeded(); }
+  if ( this->registry == nullptr ) { this->initRegistry(); }
   assert( this->registry != nullptr );
   return static_cast<nix::ref<Registry<PkgDbInputFactory>>>( this->registry );
 }
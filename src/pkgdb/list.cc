@@ -10,7 +10,10 @@
  * -------------------------------------------------------------------------- */
 
 #include <iostream>
+#include <unistd.h>
+#include <vector>
 
+#include "flox/pkgdb/cache-index.hh"
 #include "flox/pkgdb/command.hh"
 
 
@@ -72,25 +75,32 @@ ListCommand::run()
       std::cerr << "pkgdb cachedir: " << cacheDir.string() << std::endl;
     }
 
-  for ( const auto & entry : std::filesystem::directory_iterator( cacheDir ) )
+  /* Read summaries from the cache index, adding any new databases.
+   * The index can't be created or refreshed in a read-only cache directory,
+   * so summarize its databases directly instead. */
+  std::vector<CacheEntry> entries;
+  if ( access( cacheDir.c_str(), W_OK ) == 0 )
     {
-      if ( ! isSQLiteDb( entry.path() ) ) { continue; }
-
-      PkgDbReadOnly db( entry.path().string() );
+      CacheIndex index( cacheDir );
+      index.refresh();
+      entries = index.getEntries();
+    }
+  else { entries = scanCacheDir( cacheDir ); }
 
-      std::string dbPath = this->basenames ? entry.path().filename().string()
-                                           : entry.path().string();
+  for ( const auto & entry : entries )
+    {
+      std::string dbPath = this->basenames ? entry.path.filename().string()
+                                           : entry.path.string();
 
-      if ( this->json )
+      if ( this->json ) { dbs[dbPath] = entry; }
+      else
         {
-          dbs[dbPath] = { { "string", db.lockedRef.string },
-                          { "attrs", db.lockedRef.attrs },
-                          { "fingerprint",
-                            db.fingerprint.to_string( nix::Base16, false ) } };
+          std::cout << entry.lockedRef.string << ' ' << dbPath << std::endl;
         }
-      else { std::cout << db.lockedRef.string << ' ' << dbPath << std::endl; }
     }
 
+  if ( this->json ) { std::cout << dbs.dump() << std::endl; }
+
   return EXIT_SUCCESS;
 }
 
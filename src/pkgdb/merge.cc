@@ -0,0 +1,122 @@
+/* ========================================================================== *
+ *
+ * @file pkgdb/merge.cc
+ *
+ * @brief Implementation of `pkgdb merge` subcommand.
+ *
+ * Used to consolidate database shards created by `pkgdb scrape --shard`.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "flox/pkgdb/command.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+MergeCommand::MergeCommand() : parser( "merge" )
+{
+  this->parser.add_description(
+    "Merge database shards created by `pkgdb scrape --shard' into a single "
+    "database" );
+
+  this->parser.add_argument( "shard-dir" )
+    .help( "directory holding shards, named after the flake's fingerprint" )
+    .required()
+    .metavar( "SHARD-DIR" )
+    .action( [&]( const std::string & shardDir )
+             { this->shardDir = nix::absPath( shardDir ); } );
+
+  this->addDatabasePathOption( this->parser )
+    .help( "merge into database at PATH ( default: `SHARD-DIR.sqlite' )" );
+
+  this->parser.add_argument( "-a", "--all" )
+    .help( "merge shards which haven't been completely scraped" )
+    .nargs( 0 )
+    .action( [&]( const std::string & ) { this->all = true; } );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+MergeCommand::run()
+{
+  if ( ! std::filesystem::is_directory( this->shardDir ) )
+    {
+      std::cerr << "No such shard directory: " << this->shardDir << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  std::filesystem::path dbPath
+    = this->dbPath.value_or( this->shardDir.string() + ".sqlite" );
+
+  /* Start from an empty copy of a shard, which carries the `LockedFlake'
+   * info needed to create the database without locking the flake. */
+  if ( ! std::filesystem::exists( dbPath ) )
+    {
+      std::vector<std::filesystem::path> shards;
+      for ( const auto & entry :
+            std::filesystem::directory_iterator( this->shardDir ) )
+        {
+          if ( entry.path().extension() == ".sqlite" )
+            {
+              shards.emplace_back( entry.path() );
+            }
+        }
+      if ( shards.empty() )
+        {
+          std::cerr << "No shards in directory: " << this->shardDir
+                    << std::endl;
+          return EXIT_FAILURE;
+        }
+      std::filesystem::copy_file( *std::min_element( shards.begin(),
+                                                     shards.end() ),
+                                  dbPath );
+      PkgDb pdb( static_cast<std::string>( dbPath ) );
+      if ( sql_rc rcode = pdb.execute_all( R"SQL(
+             DELETE FROM BestCandidates;
+             DELETE FROM QueryCache;
+             DELETE FROM Packages;
+             DELETE FROM Descriptions;
+             DELETE FROM EvalErrors;
+             DELETE FROM AttrSets
+           )SQL" );
+           isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to initialize database '%s':(%d) %s",
+                      dbPath.string(),
+                      rcode,
+                      pdb.db.error_msg() ) );
+        }
+    }
+
+  PkgDb pdb( static_cast<std::string>( dbPath ) );
+  mergePkgDbShards( pdb, this->shardDir, ! this->all );
+
+  /* Print path to database. */
+  std::cout << dbPath.string() << std::endl;
+  return EXIT_SUCCESS;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
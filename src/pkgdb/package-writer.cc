@@ -0,0 +1,151 @@
+/* ========================================================================== *
+ *
+ * @file pkgdb/package-writer.cc
+ *
+ * @brief Writes packages to a database from a dedicated thread so that
+ *        evaluation may continue while rows are inserted.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "flox/pkgdb/package-writer.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+namespace flox::pkgdb {
+
+/* -------------------------------------------------------------------------- */
+
+PackageWriter::PackageWriter( PkgDb &     db,
+                              std::size_t capacity,
+                              std::size_t batchSize )
+  : db( db )
+  , capacity( std::max<std::size_t>( capacity, 1 ) )
+  , batchSize( std::max<std::size_t>( batchSize, 1 ) )
+  , writer( [this]() { this->run(); } )
+{}
+
+
+/* -------------------------------------------------------------------------- */
+
+PackageWriter::~PackageWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock( this->queueMutex );
+    this->queue.clear();
+  }
+  this->close();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PackageWriter::run()
+{
+  std::vector<PackageRow> batch;
+  while ( true )
+    {
+      {
+        std::unique_lock<std::mutex> lock( this->queueMutex );
+        this->notEmpty.wait(
+          lock,
+          [&]() { return this->closed || ( ! this->queue.empty() ); } );
+        if ( this->queue.empty() ) { return; } /* Closed and drained. */
+        batch.assign( std::make_move_iterator( this->queue.begin() ),
+                      std::make_move_iterator( this->queue.end() ) );
+        this->queue.clear();
+      }
+      this->notFull.notify_all();
+
+      try
+        {
+          for ( auto itr = batch.cbegin(); itr != batch.cend(); )
+            {
+              auto count = std::min<std::ptrdiff_t>(
+                static_cast<std::ptrdiff_t>( this->batchSize ),
+                std::distance( itr, batch.cend() ) );
+              auto end = itr + count;
+              std::lock_guard<std::mutex> dbLock( this->dbMutex );
+              this->db.addPackages( itr, end );
+              itr = end;
+            }
+        }
+      catch ( ... )
+        {
+          std::lock_guard<std::mutex> lock( this->queueMutex );
+          this->error  = std::current_exception();
+          this->closed = true;
+          this->queue.clear();
+          this->notFull.notify_all();
+          return;
+        }
+      batch.clear();
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PackageWriter::close()
+{
+  {
+    std::lock_guard<std::mutex> lock( this->queueMutex );
+    this->closed = true;
+  }
+  this->notEmpty.notify_all();
+  if ( this->writer.joinable() ) { this->writer.join(); }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PackageWriter::push( PackageRow row )
+{
+  {
+    std::unique_lock<std::mutex> lock( this->queueMutex );
+    this->notFull.wait( lock,
+                        [&]()
+                        {
+                          return this->closed
+                                 || ( this->queue.size() < this->capacity );
+                        } );
+    if ( this->error != nullptr ) { std::rethrow_exception( this->error ); }
+    if ( this->closed )
+      {
+        throw PkgDbException( "cannot write packages after finishing" );
+      }
+    this->queue.emplace_back( std::move( row ) );
+  }
+  this->notEmpty.notify_one();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PackageWriter::finish()
+{
+  this->close();
+  if ( this->error != nullptr ) { std::rethrow_exception( this->error ); }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+}  // namespace flox::pkgdb
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <list>
+#include <map>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -22,12 +23,15 @@
 
 #include <nix/config.hh>
 #include <nix/globals.hh>
+#include <nix/hash.hh>
+#include <nix/util.hh>
 #include <nlohmann/json.hpp>
 #include <sqlite3pp.hh>
 
 #include "flox/core/types.hh"
 #include "flox/core/util.hh"
 #include "flox/pkgdb/pkg-query.hh"
+#include "flox/pkgdb/read.hh"
 #include "versions.hh"
 
 
@@ -114,6 +118,22 @@ to_json( nlohmann::json & jto, const PkgQueryArgs & args )
   };
 }
 
+/* -------------------------------------------------------------------------- */
+
+std::string
+getQueryCacheKey( const PkgQueryArgs & args )
+{
+  /* Results only cover the requested systems, but their order is
+   * irrelevant. */
+  std::vector<System> systems = args.systems;
+  std::sort( systems.begin(), systems.end() );
+  nlohmann::json jargs = args;
+  jargs["systems"]     = systems;
+  return nix::hashString( nix::htSHA256, jargs.dump() )
+    .to_string( nix::Base16, false );
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 void
@@ -136,6 +156,48 @@ PkgQueryArgs::clear()
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+bool
+PkgQueryArgs::needsMeta() const
+{
+  return ( ! this->allowBroken ) || ( ! this->allowUnfree )
+         || this->matchesMeta();
+}
+
+
+bool
+PkgQueryArgs::matchesMeta() const
+{
+  return ( this->licenses.has_value() && ( ! this->licenses->empty() ) )
+         || ( this->partialMatch.has_value()
+              && ( ! this->partialMatch->empty() ) );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgQueryArgs::checkScrapeFields( const ScrapeFields & scraped ) const
+{
+  /* Skipped `broken' and `unfree' columns are unknown rather than `false',
+   * and their filters already pass `NULL' values, so only `licenses' which
+   * must match a value is rejected. */
+  if ( ( ! this->licenses.has_value() ) || this->licenses->empty()
+       || scraped.license )
+    {
+      return;
+    }
+
+  /* Existing packages limit the columns of later scrapes, so only a new
+   * database can add them. */
+  throw InvalidPkgQueryArg(
+    "the database was scraped without the `license' column needed by this "
+    "query, scrape a new database with `--fields' including it, or allow "
+    "packages regardless of their license" );
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 void
@@ -463,6 +525,10 @@ PkgQuery::init()
       this->addWhere( "( unfree IS NULL ) OR ( unfree = FALSE )" );
     }
 
+  /* Skeleton packages' `meta' fields are `NULL' until they're backfilled,
+   * so they can't be filtered by them. */
+  if ( this->needsMeta() ) { this->addWhere( "NOT skeleton" ); }
+
   /* Handle `relPath' filtering */
   if ( this->relPath.has_value() )
     {
@@ -504,21 +570,27 @@ PkgQuery::str() const
 
 /* -------------------------------------------------------------------------- */
 
-std::unordered_set<std::string>
-PkgQuery::filterSemvers(
-  const std::unordered_set<std::string> & versions ) const
+/**
+ * @brief Filter a set of semantic version numbers by the range @a semver.
+ *
+ * If @a semver is unset or matches any version, return the original set
+ * _as is_.
+ */
+static std::unordered_set<std::string>
+filterSemversBy( const std::optional<std::string> &      semver,
+                 const std::unordered_set<std::string> & versions )
 {
   static const std::vector<std::string> ignores
     = { "", "*", "any", "^*", "~*", "x", "X" };
-  if ( ( ! this->semver.has_value() )
-       || ( std::find( ignores.begin(), ignores.end(), *this->semver )
+  if ( ( ! semver.has_value() )
+       || ( std::find( ignores.begin(), ignores.end(), *semver )
             != ignores.end() ) )
     {
       return versions;
     }
   std::list<std::string>          args( versions.begin(), versions.end() );
   std::unordered_set<std::string> rsl;
-  for ( auto & version : versions::semverSat( *this->semver, args ) )
+  for ( auto & version : versions::semverSat( *semver, args ) )
     {
       rsl.emplace( std::move( version ) );
     }
@@ -526,6 +598,205 @@ PkgQuery::filterSemvers(
 }
 
 
+std::unordered_set<std::string>
+PkgQuery::filterSemvers(
+  const std::unordered_set<std::string> & versions ) const
+{
+  return filterSemversBy( this->semver, versions );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Get the `AttrSets.id` for @a path using the `( parent, attrName )`
+ *        index, or `std::nullopt` if it does not exist.
+ */
+static std::optional<row_id>
+lookupAttrSetId( sqlite3pp::database & pdb, const flox::AttrPath & path )
+{
+  row_id row = 0;
+  for ( const auto & part : path )
+    {
+      sqlite3pp::query qry( pdb,
+                            "SELECT id FROM AttrSets "
+                            "WHERE ( attrName = ? ) AND ( parent = ? )" );
+      qry.bind( 1, part, sqlite3pp::copy );
+      qry.bind( 2, static_cast<long long>( row ) );
+      auto itr = qry.begin();
+      if ( itr == qry.end() ) { return std::nullopt; }
+      row = ( *itr ).get<long long>( 0 );
+    }
+  return row;
+}
+
+
+std::optional<std::vector<row_id>>
+lookupRelPath( sqlite3pp::database & pdb,
+               const PkgQueryArgs &  args,
+               const System &        system )
+{
+  /* Version constraints and partial matches require ranking. */
+  if ( ( ! args.relPath.has_value() ) || args.relPath->empty()
+       || args.version.has_value() || args.semver.has_value()
+       || ( args.partialMatch.has_value() && ( ! args.partialMatch->empty() ) )
+       || ( args.partialNameMatch.has_value()
+            && ( ! args.partialNameMatch->empty() ) ) )
+    {
+      return std::nullopt;
+    }
+
+  std::vector<Subtree> subtrees = args.subtrees.value_or(
+    std::vector<Subtree> { ST_PACKAGES, ST_LEGACY } );
+
+  std::vector<row_id> rsl;
+  bool                found = false;
+  for ( auto subtree = subtrees.begin(); subtree != subtrees.end(); ++subtree )
+    {
+      /* Skip duplicates. */
+      if ( std::find( subtrees.begin(), subtree, *subtree ) != subtree )
+        {
+          continue;
+        }
+
+      flox::AttrPath parentPath
+        = { static_cast<std::string>( to_string( *subtree ) ), system };
+      parentPath.insert( parentPath.end(),
+                         args.relPath->begin(),
+                         args.relPath->end() - 1 );
+      auto parentId = lookupAttrSetId( pdb, parentPath );
+      if ( ! parentId.has_value() ) { continue; }
+
+      sqlite3pp::query qry( pdb, R"SQL(
+        SELECT id, name, pname, license, broken, unfree, skeleton
+        FROM Packages WHERE ( parentId = ? ) AND ( attrName = ? )
+      )SQL" );
+      qry.bind( 1, static_cast<long long>( *parentId ) );
+      qry.bind( 2, args.relPath->back(), sqlite3pp::copy );
+      auto itr = qry.begin();
+      if ( itr == qry.end() ) { continue; }
+
+      /* Matches in different subtrees may be ranked by other fields. */
+      if ( found ) { return std::nullopt; }
+      found = true;
+
+      const auto & row     = *itr;
+      auto         getText = [&]( int col ) -> std::optional<std::string>
+      {
+        if ( row.column_type( col ) == SQLITE_NULL ) { return std::nullopt; }
+        return row.get<std::string>( col );
+      };
+      auto getBool = [&]( int col ) -> bool
+      {
+        return ( row.column_type( col ) != SQLITE_NULL )
+               && row.get<bool>( col );
+      };
+
+      /* Apply the same filters as `PkgQuery'. */
+      std::optional<std::string> pname   = getText( 2 );
+      std::optional<std::string> license = getText( 3 );
+      if ( args.name.has_value() && ( getText( 1 ) != args.name ) )
+        {
+          continue;
+        }
+      if ( args.pname.has_value() && ( pname != args.pname ) ) { continue; }
+      if ( args.pnameOrAttrName.has_value()
+           && ( ! args.pnameOrAttrName->empty() )
+           && ( pname != args.pnameOrAttrName )
+           && ( args.relPath->back() != *args.pnameOrAttrName ) )
+        {
+          continue;
+        }
+      if ( args.licenses.has_value() && ( ! args.licenses->empty() )
+           && ( ( ! license.has_value() )
+                || ( std::find( args.licenses->begin(),
+                                args.licenses->end(),
+                                *license )
+                     == args.licenses->end() ) ) )
+        {
+          continue;
+        }
+      if ( ( ! args.allowBroken ) && getBool( 4 ) ) { continue; }
+      if ( ( ! args.allowUnfree ) && getBool( 5 ) ) { continue; }
+      if ( args.needsMeta() && getBool( 6 ) ) { continue; }
+
+      rsl.emplace_back( row.get<long long>( 0 ) );
+    }
+
+  return rsl;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::optional<std::vector<row_id>>
+lookupBestCandidate( sqlite3pp::database & pdb,
+                     const PkgQueryArgs &  args,
+                     const System &        system )
+{
+  /* Rankings are only recorded for default parameters. */
+  if ( ( ! args.pnameOrAttrName.has_value() ) || args.pnameOrAttrName->empty()
+       || args.name.has_value() || args.pname.has_value()
+       || args.version.has_value() || args.semver.has_value()
+       || ( args.partialMatch.has_value() && ( ! args.partialMatch->empty() ) )
+       || ( args.partialNameMatch.has_value()
+            && ( ! args.partialNameMatch->empty() ) )
+       || ( args.licenses.has_value() && ( ! args.licenses->empty() ) )
+       || args.relPath.has_value() || args.preferPreReleases )
+    {
+      return std::nullopt;
+    }
+
+  std::vector<Subtree> subtrees = args.subtrees.value_or(
+    std::vector<Subtree> { ST_PACKAGES, ST_LEGACY } );
+
+  std::vector<row_id> rsl;
+  for ( auto subtree = subtrees.begin(); subtree != subtrees.end(); ++subtree )
+    {
+      /* Skip duplicates. */
+      if ( std::find( subtrees.begin(), subtree, *subtree ) != subtree )
+        {
+          continue;
+        }
+
+      std::string subtreeS( to_string( *subtree ) );
+
+      /* Prefixes that don't exist don't have any packages. */
+      auto prefixId
+        = lookupAttrSetId( pdb, flox::AttrPath { subtreeS, system } );
+      if ( ! prefixId.has_value() ) { continue; }
+
+      /* Rankings are only complete for scraped prefixes, and only account
+       * for `broken' and `unfree' once they've been backfilled. */
+      sqlite3pp::query qryDone(
+        pdb,
+        "SELECT done AND ( NOT skeleton ) FROM AttrSets WHERE ( id = ? )" );
+      qryDone.bind( 1, static_cast<long long>( *prefixId ) );
+      if ( ! ( *qryDone.begin() ).get<bool>( 0 ) ) { return std::nullopt; }
+
+      sqlite3pp::query qry( pdb, R"SQL(
+        SELECT packageId FROM BestCandidates
+        WHERE ( name = ? ) AND ( subtree = ? ) AND ( system = ? )
+          AND ( allowBroken = ? ) AND ( allowUnfree = ? )
+      )SQL" );
+      qry.bind( 1, *args.pnameOrAttrName, sqlite3pp::copy );
+      qry.bind( 2, subtreeS, sqlite3pp::copy );
+      qry.bind( 3, system, sqlite3pp::copy );
+      qry.bind( 4, static_cast<int>( args.allowBroken ) );
+      qry.bind( 5, static_cast<int>( args.allowUnfree ) );
+      if ( auto itr = qry.begin(); itr != qry.end() )
+        {
+          rsl.emplace_back( ( *itr ).get<long long>( 0 ) );
+        }
+    }
+
+  /* Candidates in different subtrees must be ranked together. */
+  if ( 1 < rsl.size() ) { return std::nullopt; }
+
+  return rsl;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 std::shared_ptr<sqlite3pp::query>
@@ -547,6 +818,18 @@ PkgQuery::bind( sqlite3pp::database & pdb ) const
 std::vector<row_id>
 PkgQuery::execute( sqlite3pp::database & pdb ) const
 {
+  this->checkScrapeFields( getScrapeFields( pdb ) );
+
+  /* Fully specified paths can skip ranking. */
+  if ( this->systems.size() == 1 )
+    {
+      if ( auto direct = lookupRelPath( pdb, *this, this->systems.front() );
+           direct.has_value() )
+        {
+          return *direct;
+        }
+    }
+
   std::shared_ptr<sqlite3pp::query> qry = this->bind( pdb );
   std::vector<row_id>               rsl;
 
@@ -585,6 +868,350 @@ PkgQuery::execute( sqlite3pp::database & pdb ) const
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+void
+PkgQueryBatch::check() const
+{
+  if ( this->queries.empty() ) { return; }
+  const PkgQueryArgs & first = this->queries.front();
+  for ( const auto & query : this->queries )
+    {
+      query.check();
+
+      if ( query.name.has_value() || query.pname.has_value()
+           || query.partialMatch.has_value()
+           || query.partialNameMatch.has_value() )
+        {
+          throw InvalidPkgQueryArg(
+            "batched queries may not use `name', `pname', `partialMatch', "
+            "or `partialNameMatch' parameters." );
+        }
+
+      if ( ( query.licenses != first.licenses )
+           || ( query.allowBroken != first.allowBroken )
+           || ( query.allowUnfree != first.allowUnfree ) )
+        {
+          throw InvalidPkgQueryArg(
+            "batched queries must use the same `licenses', `allowBroken', "
+            "and `allowUnfree' parameters." );
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::string
+PkgQueryBatch::str() const
+{
+  if ( this->queries.empty() ) { return ""; }
+
+  /* Parameters shared by all members. */
+  const PkgQueryArgs & first = this->queries.front();
+
+  std::stringstream qry;
+
+  /* Declare a table of members with one row per query and system. */
+  qry << R"SQL(
+    WITH Queries ( queryId, querySystem, queryName, queryVersion, querySemver
+                 , queryPreferPreReleases, queryRelPath
+                 , queryPackagesRank, queryLegacyPackagesRank
+                 ) AS ( VALUES )SQL";
+  bool firstRow = true;
+  for ( const auto & query : this->queries )
+    {
+      for ( size_t idx = 0; idx < query.systems.size(); ++idx )
+        {
+          if ( firstRow ) { firstRow = false; }
+          else { qry << ", "; }
+          qry << "( ?, ?, ?, ?, ?, ?, ?, ?, ? )";
+        }
+    }
+  qry << " )";
+
+  /* Select the best match for each member and system, or all ranked matches
+   * for members which need to be filtered by `semver'. */
+  qry << R"SQL(
+    SELECT queryId, querySystem, id, semver FROM (
+      SELECT queryId, querySystem, id, semver, querySemver, ROW_NUMBER() OVER (
+        PARTITION BY queryId, querySystem ORDER BY
+          exactPname    DESC
+        , exactAttrName DESC
+        , depth         ASC
+        , subtreesRank  ASC
+        , pname         ASC
+        , versionType   ASC
+        , iif( queryPreferPreReleases, NULL, preTag ) DESC NULLS FIRST
+        , major DESC NULLS LAST
+        , minor DESC NULLS LAST
+        , patch DESC NULLS LAST
+        , iif( queryPreferPreReleases, preTag, NULL ) DESC NULLS FIRST
+        , versionDate DESC NULLS LAST
+        -- Lexicographic as fallback for misc. versions
+        , version ASC NULLS LAST
+        , brokenRank ASC
+        , unfreeRank ASC
+        , attrName ASC
+      ) AS queryRank
+      FROM ( SELECT *
+                  , ( queryName = pname ) AS exactPname
+                  , ( queryName = attrName ) AS exactAttrName
+                  , CASE subtree
+                      WHEN 'packages'       THEN queryPackagesRank
+                      WHEN 'legacyPackages' THEN queryLegacyPackagesRank
+                    END AS subtreesRank
+             FROM Queries INNER JOIN v_PackagesSearch ON
+               ( system = querySystem )
+               AND ( ( queryName IS NULL ) OR ( queryName = pname )
+                     OR ( queryName = attrName ) )
+               AND ( ( queryVersion IS NULL ) OR ( queryVersion = version ) )
+               AND ( ( NOT querySemver ) OR ( semver IS NOT NULL ) )
+               AND ( ( queryRelPath IS NULL ) OR ( queryRelPath = relPath ) )
+             WHERE ( subtreesRank IS NOT NULL )
+  )SQL";
+
+  /* Handle `licenses' filtering. */
+  if ( first.licenses.has_value() && ( ! first.licenses->empty() ) )
+    {
+      qry << " AND ( license IS NOT NULL ) AND ( license";
+      addIn( qry, *first.licenses );
+      qry << " )";
+    }
+
+  /* Handle `broken' filtering. */
+  if ( ! first.allowBroken )
+    {
+      qry << " AND ( ( broken IS NULL ) OR ( broken = FALSE ) )";
+    }
+
+  /* Handle `unfree' filtering. */
+  if ( ! first.allowUnfree )
+    {
+      qry << " AND ( ( unfree IS NULL ) OR ( unfree = FALSE ) )";
+    }
+
+  /* Handle skeleton packages, whose `meta' fields aren't known yet. */
+  if ( first.needsMeta() ) { qry << " AND ( NOT skeleton )"; }
+
+  qry << R"SQL(
+           )
+    ) WHERE ( queryRank = 1 ) OR querySemver
+      ORDER BY queryId ASC, querySystem ASC, queryRank ASC
+  )SQL";
+
+  return qry.str();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgQueryBatch::bindQueries( sqlite3pp::query & qry ) const
+{
+  int param = 1;
+  for ( size_t idx = 0; idx < this->queries.size(); ++idx )
+    {
+      const PkgQueryArgs & query = this->queries.at( idx );
+
+      /* Rank subtrees in the order they were given, leaving `NULL' for
+       * subtrees that should be skipped. */
+      std::optional<int> packagesRank;
+      std::optional<int> legacyPackagesRank;
+      if ( query.subtrees.has_value() )
+        {
+          int rank = 0;
+          for ( const auto subtree : *query.subtrees )
+            {
+              if ( ( subtree == ST_PACKAGES )
+                   && ( ! packagesRank.has_value() ) )
+                {
+                  packagesRank = rank;
+                }
+              else if ( ( subtree == ST_LEGACY )
+                        && ( ! legacyPackagesRank.has_value() ) )
+                {
+                  legacyPackagesRank = rank;
+                }
+              ++rank;
+            }
+        }
+      else
+        {
+          packagesRank       = 0;
+          legacyPackagesRank = 0;
+        }
+
+      for ( const auto & system : query.systems )
+        {
+          qry.bind( param++, static_cast<long long>( idx ) );
+          qry.bind( param++, system, sqlite3pp::copy );
+
+          if ( query.pnameOrAttrName.has_value()
+               && ( ! query.pnameOrAttrName->empty() ) )
+            {
+              qry.bind( param++, *query.pnameOrAttrName, sqlite3pp::copy );
+            }
+          else { qry.bind( param++ ); }
+
+          if ( query.version.has_value() )
+            {
+              qry.bind( param++, *query.version, sqlite3pp::copy );
+            }
+          else { qry.bind( param++ ); }
+
+          qry.bind( param++, static_cast<int>( query.semver.has_value() ) );
+          qry.bind( param++, static_cast<int>( query.preferPreReleases ) );
+
+          if ( query.relPath.has_value() )
+            {
+              nlohmann::json relPath = *query.relPath;
+              qry.bind( param++, relPath.dump(), sqlite3pp::copy );
+            }
+          else { qry.bind( param++ ); }
+
+          for ( const auto & rank : { packagesRank, legacyPackagesRank } )
+            {
+              if ( rank.has_value() ) { qry.bind( param++, *rank ); }
+              else { qry.bind( param++ ); }
+            }
+        }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<std::unordered_map<System, row_id>>
+PkgQueryBatch::executeBySystem( sqlite3pp::database & pdb ) const
+{
+  std::vector<std::unordered_map<System, row_id>> rsl( this->queries.size() );
+  if ( this->queries.empty() ) { return rsl; }
+
+  ScrapeFields scraped = getScrapeFields( pdb );
+  for ( const auto & query : this->queries )
+    {
+      query.checkScrapeFields( scraped );
+    }
+
+  /* Resolve members with fully specified paths or default parameters
+   * directly, and only rank the members and systems that remain. */
+  std::vector<PkgQueryArgs> ranked;
+  std::vector<size_t>       rankedIdxs;
+  bool                      resolvedDirectly = false;
+  for ( size_t idx = 0; idx < this->queries.size(); ++idx )
+    {
+      PkgQueryArgs query = this->queries.at( idx );
+      query.systems.clear();
+      for ( const auto & system : this->queries.at( idx ).systems )
+        {
+          auto direct = lookupRelPath( pdb, query, system );
+          if ( ! direct.has_value() )
+            {
+              direct = lookupBestCandidate( pdb, query, system );
+            }
+          if ( ! direct.has_value() )
+            {
+              query.systems.emplace_back( system );
+              continue;
+            }
+          resolvedDirectly = true;
+          if ( ! direct->empty() )
+            {
+              rsl.at( idx ).emplace( system, direct->front() );
+            }
+        }
+      if ( ! query.systems.empty() )
+        {
+          ranked.emplace_back( std::move( query ) );
+          rankedIdxs.emplace_back( idx );
+        }
+    }
+  if ( resolvedDirectly )
+    {
+      if ( ranked.empty() ) { return rsl; }
+      PkgQueryBatch remaining( std::move( ranked ) );
+      auto          remainingRsl = remaining.executeBySystem( pdb );
+      for ( size_t idx = 0; idx < rankedIdxs.size(); ++idx )
+        {
+          rsl.at( rankedIdxs.at( idx ) ).merge( remainingRsl.at( idx ) );
+        }
+      return rsl;
+    }
+
+  std::string      stmt = this->str();
+  sqlite3pp::query qry( pdb, stmt.c_str() );
+  this->bindQueries( qry );
+
+  /* Ranked candidates for members that need `semver' post-processing. */
+  std::map<std::pair<size_t, System>,
+           std::vector<std::pair<row_id, std::string>>>
+    candidates;
+
+  for ( const auto & row : qry )
+    {
+      auto   idx    = static_cast<size_t>( row.get<long long>( 0 ) );
+      System system = row.get<std::string>( 1 );
+      const PkgQueryArgs & query = this->queries.at( idx );
+      if ( query.semver.has_value() )
+        {
+          candidates[std::make_pair( idx, system )].emplace_back(
+            std::make_pair( row.get<long long>( 2 ),
+                            row.get<std::string>( 3 ) ) );
+        }
+      else { rsl.at( idx ).emplace( system, row.get<long long>( 2 ) ); }
+    }
+
+  /* Pick the highest ranked candidate with a satisfactory version. */
+  for ( const auto & [key, idVersions] : candidates )
+    {
+      const auto & [idx, system] = key;
+      std::unordered_set<std::string> versions;
+      for ( const auto & [_, version] : idVersions )
+        {
+          versions.emplace( version );
+        }
+      versions = filterSemversBy( this->queries.at( idx ).semver, versions );
+      for ( const auto & [rowId, version] : idVersions )
+        {
+          if ( versions.find( version ) != versions.end() )
+            {
+              rsl.at( idx ).emplace( system, rowId );
+              break;
+            }
+        }
+    }
+
+  return rsl;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<std::optional<row_id>>
+PkgQueryBatch::execute( sqlite3pp::database & pdb ) const
+{
+  std::vector<std::optional<row_id>> rsl;
+  auto                               bySystem = this->executeBySystem( pdb );
+  for ( size_t idx = 0; idx < this->queries.size(); ++idx )
+    {
+      /* Prefer systems in the order they were given. */
+      std::optional<row_id> best;
+      for ( const auto & system : this->queries.at( idx ).systems )
+        {
+          if ( auto found = bySystem.at( idx ).find( system );
+               found != bySystem.at( idx ).end() )
+            {
+              best = found->second;
+              break;
+            }
+        }
+      rsl.emplace_back( best );
+    }
+  return rsl;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 }  // namespace flox::pkgdb
@@ -7,11 +7,16 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <limits>
 #include <list>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -47,6 +52,71 @@ operator<<( std::ostream & oss, const SqlVersions & versions )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+ScrapeFields
+ScrapeFields::intersect( const ScrapeFields & other ) const
+{
+  return ScrapeFields {
+    .outputsToInstall = this->outputsToInstall && other.outputsToInstall,
+    .license          = this->license && other.license,
+    .broken           = this->broken && other.broken,
+    .unfree           = this->unfree && other.unfree,
+    .description      = this->description && other.description
+  };
+}
+
+
+void
+to_json( nlohmann::json & jto, const ScrapeFields & fields )
+{
+  jto = nlohmann::json::array();
+  if ( fields.outputsToInstall ) { jto.emplace_back( "outputsToInstall" ); }
+  if ( fields.license ) { jto.emplace_back( "license" ); }
+  if ( fields.broken ) { jto.emplace_back( "broken" ); }
+  if ( fields.unfree ) { jto.emplace_back( "unfree" ); }
+  if ( fields.description ) { jto.emplace_back( "description" ); }
+}
+
+
+void
+from_json( const nlohmann::json & jfrom, ScrapeFields & fields )
+{
+  fields = ScrapeFields::none();
+  for ( const auto & jname : jfrom )
+    {
+      auto name = jname.get<std::string>();
+      if ( name == "outputsToInstall" ) { fields.outputsToInstall = true; }
+      else if ( name == "license" ) { fields.license = true; }
+      else if ( name == "broken" ) { fields.broken = true; }
+      else if ( name == "unfree" ) { fields.unfree = true; }
+      else if ( name == "description" ) { fields.description = true; }
+      else
+        {
+          throw PkgDbException(
+            nix::fmt( "unrecognized scrape field '%s', expected one of "
+                      "`outputsToInstall', `license', `broken', `unfree', "
+                      "or `description'",
+                      name ) );
+        }
+    }
+}
+
+
+ScrapeFields
+getScrapeFields( sqlite3pp::database & pdb )
+{
+  sqlite3pp::query qry(
+    pdb,
+    "SELECT version FROM DbVersions WHERE name = 'pkgdb_scrape_fields'" );
+  auto itr = qry.begin();
+  /* Databases which predate configurable fields scraped all of them. */
+  if ( itr == qry.end() ) { return ScrapeFields {}; }
+  return nlohmann::json::parse( ( *itr ).get<std::string>( 0 ) )
+    .get<ScrapeFields>();
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 std::filesystem::path
@@ -81,6 +151,57 @@ genPkgDbName( const Fingerprint &           fingerprint,
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+std::filesystem::path
+getPkgDbShardDir( const Fingerprint &           fingerprint,
+                  const std::filesystem::path & cacheDir )
+{
+  return cacheDir / fingerprint.to_string( nix::Base16, false );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::filesystem::path
+genPkgDbShardName( const Fingerprint &           fingerprint,
+                   const flox::AttrPath &        prefix,
+                   const std::filesystem::path & cacheDir )
+{
+  if ( prefix.size() < 2 )
+    {
+      throw PkgDbException(
+        nix::fmt( "database shards require a `<SUBTREE>.<SYSTEM>' prefix, "
+                  "but got '%s'",
+                  nix::concatStringsSep( ".", prefix ) ) );
+    }
+  return getPkgDbShardDir( fingerprint, cacheDir )
+         / ( prefix.at( 0 ) + "." + prefix.at( 1 ) + ".sqlite" );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+busyHandler( int attempts )
+{
+  /* Delays double from 1ms up to a maximum of 128ms. */
+  static const int maxShift = 7;
+  auto delay = []( int attempt )
+  { return std::chrono::milliseconds( 1 << std::min( attempt, maxShift ) ); };
+
+  std::chrono::milliseconds waited( 0 );
+  for ( int attempt = 0; attempt < attempts; ++attempt )
+    {
+      waited += delay( attempt );
+      if ( DB_BUSY_TIMEOUT <= waited ) { return 0; }
+    }
+
+  std::this_thread::sleep_for( delay( attempts ) );
+  return 1;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 void
@@ -91,6 +212,7 @@ PkgDbReadOnly::init()
       throw NoSuchDatabase( *this );
     }
   this->db.connect( this->dbPath.string().c_str(), SQLITE_OPEN_READONLY );
+  this->db.set_busy_handler( busyHandler );
   this->loadLockedFlake();
 }
 
@@ -150,6 +272,15 @@ PkgDbReadOnly::getDbVersion()
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+ScrapeFields
+PkgDbReadOnly::getScrapeFields()
+{
+  return flox::pkgdb::getScrapeFields( this->db );
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 bool
@@ -188,6 +319,47 @@ PkgDbReadOnly::completedAttrSet( const flox::AttrPath & path )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+bool
+PkgDbReadOnly::skeletonAttrSet( const flox::AttrPath & path )
+{
+  row_id row = 0;
+  for ( const auto & part : path )
+    {
+      sqlite3pp::query qryId( this->db,
+                              "SELECT id, done, skeleton FROM AttrSets "
+                              "WHERE ( attrName = ? ) AND ( parent = ? )" );
+      qryId.bind( 1, part, sqlite3pp::copy );
+      qryId.bind( 2, static_cast<long long>( row ) );
+      auto itr = qryId.begin();
+      if ( itr == qryId.end() ) { return false; } /* No such path. */
+      /* The nearest `done' ancestor determines how children were scraped. */
+      if ( ( *itr ).get<bool>( 1 ) ) { return ( *itr ).get<bool>( 2 ); }
+      row = ( *itr ).get<long long>( 0 );
+    }
+  return false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::unordered_map<std::string, std::string>
+PkgDbReadOnly::getEvalErrors( row_id parentId )
+{
+  sqlite3pp::query qry(
+    this->db,
+    "SELECT attrName, errorClass FROM EvalErrors WHERE ( parentId = ? )" );
+  qry.bind( 1, static_cast<long long>( parentId ) );
+  std::unordered_map<std::string, std::string> errors;
+  for ( const auto & row : qry )
+    {
+      errors.emplace( row.get<std::string>( 0 ), row.get<std::string>( 1 ) );
+    }
+  return errors;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 bool
@@ -417,6 +589,49 @@ PkgDbReadOnly::getPackage( const flox::AttrPath & path )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+std::optional<std::unordered_map<System, row_id>>
+PkgDbReadOnly::getCachedQuery( const std::string & key )
+{
+  sqlite3pp::query qry( this->db,
+                        "SELECT results FROM QueryCache WHERE key = ?" );
+  qry.bind( 1, key, sqlite3pp::copy );
+  auto itr = qry.begin();
+  if ( itr == qry.end() ) { return std::nullopt; }
+  return nlohmann::json::parse( ( *itr ).get<std::string>( 0 ) )
+    .get<std::unordered_map<System, row_id>>();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::optional<std::vector<std::string>>
+PkgDbReadOnly::getPackageNames( const flox::AttrPath & prefix )
+{
+  if ( ( prefix.size() != 2 ) || ( ! this->completedAttrSet( prefix ) ) )
+    {
+      return std::nullopt;
+    }
+
+  /* Rankings which allow broken and unfree packages include every name. */
+  sqlite3pp::query qry( this->db, R"SQL(
+    SELECT DISTINCT name FROM BestCandidates
+    WHERE ( subtree = ? ) AND ( system = ? )
+      AND allowBroken AND allowUnfree
+    ORDER BY name ASC
+  )SQL" );
+  qry.bind( 1, prefix.front(), sqlite3pp::copy );
+  qry.bind( 2, prefix.at( 1 ), sqlite3pp::copy );
+  std::vector<std::string> names;
+  for ( const auto & row : qry )
+    {
+      names.emplace_back( row.get<std::string>( 0 ) );
+    }
+  return names;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 }  // namespace flox::pkgdb
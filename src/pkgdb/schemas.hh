@@ -43,12 +43,17 @@ CREATE TRIGGER IF NOT EXISTS IT_LockedFlake AFTER INSERT ON LockedFlake
 
 /* -------------------------------------------------------------------------- */
 
+/**
+ * `skeleton` marks `done` attribute sets whose packages have yet to have their
+ * `meta` fields backfilled.
+ */
 static const char * sql_attrSets = R"SQL(
 CREATE TABLE IF NOT EXISTS AttrSets (
   id        INTEGER       PRIMARY KEY
 , parent    INTEGER
 , attrName  VARCHAR( 255) NOT NULL
 , done      BOOL          NOT NULL DEFAULT FALSE
+, skeleton  BOOL          NOT NULL DEFAULT FALSE
 , CONSTRAINT  UC_AttrSets UNIQUE ( parent, attrName )
 );
 
@@ -70,6 +75,10 @@ CREATE TRIGGER IF NOT EXISTS IT_AttrSets AFTER INSERT ON AttrSets
 
 /* -------------------------------------------------------------------------- */
 
+/**
+ * `skeleton` marks packages whose `meta` fields have yet to be backfilled,
+ * so their `NULL` values aren't authoritative.
+ */
 static const char * sql_packages = R"SQL(
 CREATE TABLE IF NOT EXISTS Descriptions (
   id           INTEGER PRIMARY KEY
@@ -93,6 +102,7 @@ CREATE TABLE IF NOT EXISTS Packages (
 , broken            BOOL
 , unfree            BOOL
 , descriptionId     INTEGER
+, skeleton          BOOL           NOT NULL DEFAULT FALSE
 , FOREIGN KEY ( parentId      ) REFERENCES AttrSets  ( id )
 , FOREIGN KEY ( descriptionId ) REFERENCES Descriptions ( id     )
 , CONSTRAINT UC_Packages UNIQUE ( parentId, attrName )
@@ -103,6 +113,55 @@ CREATE UNIQUE INDEX IF NOT EXISTS idx_Packages
 )SQL";
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Attributes which failed to evaluate while scraping, skipped by later scrapes
+ * unless they are asked to retry them.
+ */
+static const char * sql_evalErrors = R"SQL(
+CREATE TABLE IF NOT EXISTS EvalErrors (
+  parentId    INTEGER        NOT NULL
+, attrName    VARCHAR( 255 ) NOT NULL
+, errorClass  VARCHAR( 255 ) NOT NULL
+, message     TEXT
+, FOREIGN KEY ( parentId ) REFERENCES AttrSets ( id )
+, PRIMARY KEY ( parentId, attrName )
+)
+)SQL";
+
+
+/* -------------------------------------------------------------------------- */
+
+/* Memoized results of package queries, cleared whenever packages are added. */
+static const char * sql_queryCache = R"SQL(
+CREATE TABLE IF NOT EXISTS QueryCache (
+  key      TEXT  PRIMARY KEY
+, results  JSON  NOT NULL
+)
+)SQL";
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * The best package for each `pname` or `attrName` in a completed
+ * `<SUBTREE>.<SYSTEM>` prefix, ranked using default query parameters.
+ */
+static const char * sql_bestCandidates = R"SQL(
+CREATE TABLE IF NOT EXISTS BestCandidates (
+  name         TEXT     NOT NULL
+, subtree      TEXT     NOT NULL
+, system       TEXT     NOT NULL
+, allowBroken  BOOL     NOT NULL
+, allowUnfree  BOOL     NOT NULL
+, packageId    INTEGER  NOT NULL
+, FOREIGN KEY ( packageId ) REFERENCES Packages ( id )
+, PRIMARY KEY ( name, subtree, system, allowBroken, allowUnfree )
+)
+)SQL";
+
+
 /* -------------------------------------------------------------------------- */
 
 static const char * sql_views = R"SQL(
@@ -219,6 +278,7 @@ CREATE VIEW IF NOT EXISTS v_PackagesSearch AS SELECT
 , Packages.unfree
 , iif( ( unfree IS NULL ), 1, iif( unfree, 2, 0 ) ) AS unfreeRank
 , Descriptions.description
+, Packages.skeleton
 FROM Packages
 LEFT OUTER JOIN Descriptions ON ( Packages.descriptionId = Descriptions.id )
 LEFT OUTER JOIN v_Semvers    ON ( Packages.semver = v_Semvers.semver )
@@ -228,6 +288,30 @@ LEFT OUTER JOIN v_Semvers    ON ( Packages.semver = v_Semvers.semver )
 )SQL";
 
 
+/* -------------------------------------------------------------------------- */
+
+/* Index of package databases in a cache directory. */
+static const char * sql_cacheIndex = R"SQL(
+CREATE TABLE IF NOT EXISTS Databases (
+  fingerprint  TEXT     PRIMARY KEY
+, path         TEXT     NOT NULL
+, string       TEXT     NOT NULL
+, attrs        JSON     NOT NULL
+, size         INTEGER  NOT NULL DEFAULT 0
+, lastAccess   INTEGER  NOT NULL DEFAULT 0
+);
+
+CREATE INDEX IF NOT EXISTS idx_Databases_lastAccess
+  ON Databases ( lastAccess );
+
+CREATE TABLE IF NOT EXISTS DatabasePrefixes (
+  fingerprint  TEXT  NOT NULL
+, prefix       TEXT  NOT NULL
+, PRIMARY KEY ( fingerprint, prefix )
+)
+)SQL";
+
+
 /* -------------------------------------------------------------------------- */
 
 }  /* End namespace `flox::pkgdb' */
@@ -7,8 +7,12 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <vector>
 
+#include "flox/flox-flake.hh"
 #include "flox/pkgdb/command.hh"
 
 
@@ -27,6 +31,100 @@ ScrapeCommand::ScrapeCommand() : parser( "scrape" )
     .help( "force re-evaluation of flake" )
     .nargs( 0 )
     .action( [&]( const auto & ) { this->force = true; } );
+  this->parser.add_argument( "--shard" )
+    .help( "write to a database shard for the `<SUBTREE>.<SYSTEM>' prefix, "
+           "allowing prefixes to be scraped concurrently" )
+    .nargs( 0 )
+    .action( [&]( const auto & ) { this->shard = true; } );
+  this->parser.add_argument( "--skeleton" )
+    .help( "only scrape attribute names, `pname', and `version', leaving "
+           "`meta' fields to be backfilled by a later scrape" )
+    .nargs( 0 )
+    .action( [&]( const auto & ) { this->options.skeleton = true; } );
+  this->parser.add_argument( "--retry-errors" )
+    .help( "evaluate attributes which failed to evaluate during previous "
+           "scrapes instead of skipping them, implies `--force'" )
+    .nargs( 0 )
+    .action( [&]( const auto & ) { this->options.retryErrors = true; } );
+  this->parser.add_argument( "--time-budget" )
+    .help( "skip attributes which take longer than SECONDS to evaluate, "
+           "recording them so that later scrapes skip them as well" )
+    .metavar( "SECONDS" )
+    .nargs( 1 )
+    .action(
+      [&]( const std::string & str )
+      {
+        std::size_t end     = 0;
+        double      seconds = -1;
+        try
+          {
+            seconds = std::stod( str, &end );
+          }
+        catch ( const std::exception & )
+          {}
+        if ( ( end != str.size() ) || ( seconds <= 0 ) )
+          {
+            throw command::InvalidArgException( "invalid time budget `" + str
+                                                + "'" );
+          }
+        this->options.timeBudget
+          = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::duration<double>( seconds ) );
+      } );
+  this->parser.add_argument( "--alloc-budget" )
+    .help( "skip attributes which allocate more than SIZE bytes while "
+           "evaluating, with an optional `K', `M', or `G' suffix" )
+    .metavar( "SIZE" )
+    .nargs( 1 )
+    .action( [&]( const std::string & size )
+             { this->options.allocBudget = parseSize( size ); } );
+  this->parser.add_argument( "--eval-cache" )
+    .help( "how to use `nix' eval caches, one of `rw' to create and update "
+           "them, `warm' to only use existing caches, or `none' to evaluate "
+           "in memory ( default: `rw' )" )
+    .metavar( "MODE" )
+    .nargs( 1 )
+    .action(
+      [&]( const std::string & mode )
+      {
+        if ( mode == "rw" ) { evalCacheMode = ECM_READ_WRITE; }
+        else if ( mode == "warm" ) { evalCacheMode = ECM_WARM; }
+        else if ( mode == "none" ) { evalCacheMode = ECM_NONE; }
+        else
+          {
+            throw command::InvalidArgException(
+              "invalid eval cache mode `" + mode
+              + "', expected one of `rw', `warm', or `none'" );
+          }
+      } );
+  this->parser.add_argument( "--fields" )
+    .help( "comma separated list of optional columns to scrape, or `none', "
+           "from `outputsToInstall', `license', `broken', `unfree', and "
+           "`description' ( default: all )" )
+    .metavar( "FIELDS" )
+    .nargs( 1 )
+    .action(
+      [&]( const std::string & str )
+      {
+        nlohmann::json names = nlohmann::json::array();
+        if ( str != "none" )
+          {
+            for ( const auto & name : nix::tokenizeString<
+                    std::vector<std::string>>( str, "," ) )
+              {
+                names.emplace_back( name );
+              }
+          }
+        try
+          {
+            this->fields = names.get<ScrapeFields>();
+          }
+        catch ( const PkgDbException & err )
+          {
+            throw command::InvalidArgException(
+              err.getContextMessage().value_or( err.what() ) );
+          }
+      } );
   this->addDatabasePathOption( this->parser );
   this->addFlakeRefArg( this->parser );
   this->addAttrPathArgs( this->parser );
@@ -39,6 +137,28 @@ void
 ScrapeCommand::initInput()
 {
   nix::ref<nix::Store> store = this->getStore();
+
+  /* Write to the prefix's shard, which is merged into the database the next
+   * time it's opened.
+   * The shard is named by the flake's fingerprint, so the flake is locked
+   * here and reused rather than being locked again by `PkgDbInput'. */
+  if ( this->shard )
+    {
+      if ( this->dbPath.has_value() )
+        {
+          throw command::InvalidArgException(
+            "`--shard' may not be used with `--database'" );
+        }
+      FloxFlakeInput flakeInput( store, this->getRegistryInput() );
+      this->dbPath = genPkgDbShardName(
+        flakeInput.getFlake()->lockedFlake.getFingerprint(),
+        this->attrPath );
+      this->input = std::make_optional<PkgDbInput>( std::move( flakeInput ),
+                                                    *this->dbPath,
+                                                    PkgDbInput::db_path_tag() );
+      return;
+    }
+
   /* Change the database path if `--database' was given. */
   if ( this->dbPath.has_value() )
     {
@@ -66,14 +186,30 @@ ScrapeCommand::run()
 
   /* If `--force' was given, clear the `done' fields for the prefix and its
    * descendants to force them to re-evaluate. */
-  if ( this->force )
+  if ( this->force || this->options.retryErrors )
     {
       this->input->getDbReadWrite()->setPrefixDone( this->attrPath, false );
       this->input->closeDbReadWrite();
     }
 
+  /* Record the requested columns, keeping only those which every existing
+   * package has as well. */
+  if ( this->fields.has_value() )
+    {
+      ScrapeFields fields
+        = this->input->getDbReadWrite()->setScrapeFields( *this->fields );
+      this->input->closeDbReadWrite();
+      if ( fields != *this->fields )
+        {
+          nix::logger->log(
+            nix::lvlWarn,
+            nix::fmt( "existing packages limit scraped fields to %s",
+                      nlohmann::json( fields ).dump() ) );
+        }
+    }
+
   /* scrape it up! */
-  this->input->scrapePrefix( this->attrPath );
+  this->input->scrapePrefix( this->attrPath, this->options );
 
   /* Print path to database. */
   std::cout << ( static_cast<std::string>( *this->dbPath ) ) << std::endl;
@@ -7,11 +7,31 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <algorithm>
+#include <filesystem>
 #include <limits>
 #include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <nix/eval-cache.hh>
+#include <nix/logging.hh>
+#include <nix/names.hh>
+#include <nix/nixexpr.hh>
+#include <nix/pathlocks.hh>
+#include <sys/stat.h>
 
 #include "flox/flake-package.hh"
+#include "flox/pkgdb/eval-watchdog.hh"
+#include "flox/pkgdb/package-writer.hh"
 #include "flox/pkgdb/write.hh"
+#include "versions.hh"
 
 #include "./schemas.hh"
 
@@ -113,6 +133,30 @@ PkgDb::initTables()
                   rcode,
                   this->db.error_msg() ) );
     }
+
+  if ( sql_rc rcode = this->execute( sql_evalErrors ); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to initialize EvalErrors table:(%d) %s",
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+
+  if ( sql_rc rcode = this->execute( sql_queryCache ); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to initialize QueryCache table:(%d) %s",
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+
+  if ( sql_rc rcode = this->execute( sql_bestCandidates ); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to initialize BestCandidates table:(%d) %s",
+                  rcode,
+                  this->db.error_msg() ) );
+    }
 }
 
 
@@ -263,109 +307,281 @@ PkgDb::addOrGetDescriptionId( const std::string & description )
 
 /* -------------------------------------------------------------------------- */
 
-row_id
-PkgDb::addPackage( row_id               parentId,
-                   std::string_view     attrName,
-                   const flox::Cursor & cursor,
-                   bool                 replace,
-                   bool                 checkDrv )
+/**
+ * @brief Read a field of an attribute set which may be missing or have an
+ *        unexpected type.
+ *
+ * Missing fields are detected without throwing, only values which fail to
+ * evaluate or have the wrong type are caught.
+ * @param parent The attribute set to read from, or `nullptr`.
+ * @param name The name of the field.
+ * @param get Reads a value from the field's cursor.
+ * @return The value read by @a get, or `std::nullopt` if the field is missing
+ *         or could not be read.
+ */
+template<typename T, typename Getter>
+static std::optional<T>
+readField( const MaybeCursor & parent, std::string_view name, Getter && get )
 {
-#define ADD_PKG_BODY                                                   \
-  " INTO Packages ("                                                   \
-  "  parentId, attrName, name, pname, version, semver, license"        \
-  ", outputs, outputsToInstall, broken, unfree, descriptionId"         \
-  ") VALUES ("                                                         \
-  "  :parentId, :attrName, :name, :pname, :version, :semver, :license" \
-  ", :outputs, :outputsToInstall, :broken, :unfree, :descriptionId"    \
-  ")"
-  static const char * qryIgnore  = "INSERT OR IGNORE" ADD_PKG_BODY;
-  static const char * qryReplace = "INSERT OR REPLACE" ADD_PKG_BODY;
+  if ( parent == nullptr ) { return std::nullopt; }
+  MaybeCursor field = parent->maybeGetAttr( name );
+  if ( field == nullptr ) { return std::nullopt; }
+  try
+    {
+      return get( *field );
+    }
+  catch ( const nix::Error & )
+    {
+      return std::nullopt;
+    }
+}
 
-  sqlite3pp::command cmd( this->db, replace ? qryReplace : qryIgnore );
 
-  /* We don't need to reference any `attrPath' related info here, so
-   * we can avoid looking up the parent path by passing a phony one to the
-   * `FlakePackage' constructor here. */
-  FlakePackage pkg( cursor, { "packages", "x86_64-linux", "phony" }, checkDrv );
-  std::string  attrNameS( attrName );
+/* -------------------------------------------------------------------------- */
 
-  cmd.bind( ":parentId", static_cast<long long>( parentId ) );
-  cmd.bind( ":attrName", attrNameS, sqlite3pp::copy );
-  cmd.bind( ":name", pkg._fullName, sqlite3pp::nocopy );
-  cmd.bind( ":pname", pkg._pname, sqlite3pp::nocopy );
+PackageRow
+mkPackageRow( row_id               parentId,
+              std::string_view     attrName,
+              const flox::Cursor & cursor,
+              bool                 checkDrv,
+              const ScrapeFields & fields )
+{
+  if ( checkDrv && ( ! cursor->isDerivation() ) )
+    {
+      throw PackageInitException(
+        "mkPackageRow(): Packages must be derivations but the attrset at '"
+        + cursor->getAttrPathStr()
+        + "' does not set `.type = \"derivation\"'." );
+    }
 
-  if ( pkg._version.empty() ) { cmd.bind( ":version" ); /* bind NULL */ }
-  else { cmd.bind( ":version", pkg._version, sqlite3pp::nocopy ); }
+  auto getString = []( nix::eval_cache::AttrCursor & attr )
+  { return attr.getString(); };
+  auto getBool = []( nix::eval_cache::AttrCursor & attr )
+  { return attr.getBool(); };
+
+  PackageRow row;
+  row.parentId = parentId;
+  row.attrName = attrName;
+  row.name     = cursor->getAttr( "name" )->getString();
+
+  /* Explicit `pname' and `version' fields take priority over those parsed
+   * from `name'. */
+  nix::DrvName dname( row.name );
+  row.pname = readField<std::string>( cursor, "pname", getString )
+                .value_or( dname.name );
+  std::string version = readField<std::string>( cursor, "version", getString )
+                          .value_or( dname.version );
+  if ( ! version.empty() )
+    {
+      row.semver  = versions::coerceSemver( version );
+      row.version = std::move( version );
+    }
 
-  if ( pkg._semver.has_value() )
+  if ( MaybeCursor outputs = cursor->maybeGetAttr( "outputs" );
+       outputs != nullptr )
     {
-      cmd.bind( ":semver", *pkg._semver, sqlite3pp::nocopy );
+      row.outputs = outputs->getListOfStrings();
     }
-  else { cmd.bind( ":semver" ); /* binds NULL */ }
+  else { row.outputs = { "out" }; }
 
-  {
-    nlohmann::json jOutputs = pkg.getOutputs();
-    cmd.bind( ":outputs", jOutputs.dump(), sqlite3pp::copy );
-  }
-  {
-    nlohmann::json jOutsInstall = pkg.getOutputsToInstall();
-    cmd.bind( ":outputsToInstall", jOutsInstall.dump(), sqlite3pp::copy );
-  }
+  /* Avoid forcing `meta' at all if none of its fields are wanted. */
+  if ( ! fields.anyMeta() ) { return row; }
 
+  /* Each `meta' field is read from a single cursor. */
+  MaybeCursor meta = cursor->maybeGetAttr( "meta" );
 
-  if ( pkg._hasMetaAttr )
+  if ( fields.outputsToInstall )
     {
-      if ( auto maybe = pkg.getLicense(); maybe.has_value() )
+      row.outputsToInstall = readField<std::vector<std::string>>(
+        meta,
+        "outputsToInstall",
+        []( nix::eval_cache::AttrCursor & attr )
+        { return attr.getListOfStrings(); } );
+      if ( ! row.outputsToInstall.has_value() )
         {
-          cmd.bind( ":license", *maybe, sqlite3pp::copy );
+          row.outputsToInstall = std::vector<std::string> {};
+          for ( const std::string & output : row.outputs )
+            {
+              row.outputsToInstall->emplace_back( output );
+              if ( output == "out" ) { break; }
+            }
         }
-      else { cmd.bind( ":license" ); }
+    }
 
-      if ( auto maybe = pkg.isBroken(); maybe.has_value() )
-        {
-          cmd.bind( ":broken", static_cast<int>( *maybe ) );
-        }
-      else { cmd.bind( ":broken" ); }
+  if ( meta == nullptr ) { return row; }
 
-      if ( auto maybe = pkg.isUnfree(); maybe.has_value() )
+  if ( fields.license )
+    {
+      row.license = readField<std::string>(
+        meta,
+        "license",
+        []( nix::eval_cache::AttrCursor & attr ) -> std::optional<std::string>
         {
-          cmd.bind( ":unfree", static_cast<int>( *maybe ) );
-        }
-      else /* TODO: Derive value from `license'? */ { cmd.bind( ":unfree" ); }
+          MaybeCursor spdxId = attr.maybeGetAttr( "spdxId" );
+          if ( spdxId == nullptr ) { return std::nullopt; }
+          return spdxId->getString();
+        } );
+    }
+  if ( fields.broken )
+    {
+      row.broken = readField<bool>( meta, "broken", getBool );
+    }
+  /* TODO: Derive value from `license'? */
+  if ( fields.unfree )
+    {
+      row.unfree = readField<bool>( meta, "unfree", getBool );
+    }
+  if ( fields.description )
+    {
+      row.description
+        = readField<std::string>( meta, "description", getString );
+    }
 
-      if ( auto maybe = pkg.getDescription(); maybe.has_value() )
-        {
-          row_id descriptionId = this->addOrGetDescriptionId( *maybe );
-          cmd.bind( ":descriptionId", static_cast<long long>( descriptionId ) );
-        }
-      else { cmd.bind( ":descriptionId" ); }
+  return row;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+#define ADD_PKG_BODY                                                   \
+  " INTO Packages ("                                                   \
+  "  parentId, attrName, name, pname, version, semver, license"        \
+  ", outputs, outputsToInstall, broken, unfree, descriptionId"         \
+  ", skeleton"                                                         \
+  ") VALUES ("                                                         \
+  "  :parentId, :attrName, :name, :pname, :version, :semver, :license" \
+  ", :outputs, :outputsToInstall, :broken, :unfree, :descriptionId"    \
+  ", :skeleton"                                                        \
+  ")"
+static const char * qryAddPkgIgnore  = "INSERT OR IGNORE" ADD_PKG_BODY;
+static const char * qryAddPkgReplace = "INSERT OR REPLACE" ADD_PKG_BODY;
+#undef ADD_PKG_BODY
+
+
+/**
+ * @brief Bind an optional value to a named parameter, binding `NULL` if
+ *        @a maybe is empty.
+ */
+template<typename T>
+static void
+bindMaybe( sqlite3pp::command &     cmd,
+           const char *             name,
+           const std::optional<T> & maybe )
+{
+  if ( ! maybe.has_value() ) { cmd.bind( name ); /* binds NULL */ }
+  else if constexpr ( std::is_same_v<T, bool> )
+    {
+      cmd.bind( name, static_cast<int>( *maybe ) );
     }
-  else
+  else { cmd.bind( name, *maybe, sqlite3pp::nocopy ); }
+}
+
+
+/**
+ * @brief Bind the columns of a @a flox::pkgdb::PackageRow read from `meta`,
+ *        and its `skeleton` marker.
+ */
+static void
+bindPackageMeta( PkgDb &              pdb,
+                 sqlite3pp::command & cmd,
+                 const PackageRow &   row )
+{
+  bindMaybe( cmd, ":license", row.license );
+  if ( row.outputsToInstall.has_value() )
     {
-      /* binds NULL */
-      cmd.bind( ":license" );
-      cmd.bind( ":broken" );
-      cmd.bind( ":unfree" );
-      cmd.bind( ":descriptionId" );
+      cmd.bind( ":outputsToInstall",
+                nlohmann::json( *row.outputsToInstall ).dump(),
+                sqlite3pp::copy );
     }
+  else { cmd.bind( ":outputsToInstall" ); /* binds NULL */ }
+  bindMaybe( cmd, ":broken", row.broken );
+  bindMaybe( cmd, ":unfree", row.unfree );
+
+  if ( row.description.has_value() )
+    {
+      row_id descriptionId = pdb.addOrGetDescriptionId( *row.description );
+      cmd.bind( ":descriptionId", static_cast<long long>( descriptionId ) );
+    }
+  else { cmd.bind( ":descriptionId" ); /* binds NULL */ }
+
+  cmd.bind( ":skeleton", static_cast<int>( row.skeleton ) );
+}
+
+
+/**
+ * @brief Bind a @a flox::pkgdb::PackageRow to an `INSERT INTO Packages`
+ *        statement and execute it.
+ */
+static row_id
+insertPackage( PkgDb & pdb, sqlite3pp::command & cmd, const PackageRow & row )
+{
+  cmd.bind( ":parentId", static_cast<long long>( row.parentId ) );
+  cmd.bind( ":attrName", row.attrName, sqlite3pp::nocopy );
+  cmd.bind( ":name", row.name, sqlite3pp::nocopy );
+  cmd.bind( ":pname", row.pname, sqlite3pp::nocopy );
+  bindMaybe( cmd, ":version", row.version );
+  bindMaybe( cmd, ":semver", row.semver );
+  cmd.bind( ":outputs",
+            nlohmann::json( row.outputs ).dump(),
+            sqlite3pp::copy );
+  bindPackageMeta( pdb, cmd, row );
+
   if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
     {
       throw PkgDbException( nix::fmt( "failed to write Package '%s':(%d) %s",
-                                      pkg._fullName,
+                                      row.name,
                                       rcode,
-                                      this->db.error_msg() ) );
+                                      pdb.db.error_msg() ) );
+    }
+  return pdb.db.last_insert_rowid();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+row_id
+PkgDb::addPackage( row_id               parentId,
+                   std::string_view     attrName,
+                   const flox::Cursor & cursor,
+                   bool                 replace,
+                   bool                 checkDrv )
+{
+  return this->addPackage( mkPackageRow( parentId, attrName, cursor, checkDrv ),
+                           replace );
+}
+
+
+row_id
+PkgDb::addPackage( const PackageRow & row, bool replace )
+{
+  sqlite3pp::command cmd( this->db,
+                          replace ? qryAddPkgReplace : qryAddPkgIgnore );
+  return insertPackage( *this, cmd, row );
+}
+
+
+void
+PkgDb::addPackages( std::vector<PackageRow>::const_iterator begin,
+                    std::vector<PackageRow>::const_iterator end,
+                    bool                                    replace )
+{
+  sqlite3pp::command cmd( this->db,
+                          replace ? qryAddPkgReplace : qryAddPkgIgnore );
+  for ( auto row = begin; row != end; ++row )
+    {
+      insertPackage( *this, cmd, *row );
+      cmd.reset();
     }
-  return this->db.last_insert_rowid();
 }
 
 
 /* -------------------------------------------------------------------------- */
 
 void
-PkgDb::setPrefixDone( row_id prefixId, bool done )
+PkgDb::setPrefixDone( row_id prefixId, bool done, bool skeleton )
 {
   sqlite3pp::command cmd( this->db, R"SQL(
-    UPDATE AttrSets SET done = ? WHERE id in (
+    UPDATE AttrSets SET done = ?, skeleton = ? WHERE id in (
       WITH RECURSIVE Tree AS (
         SELECT id, parent, 0 as depth FROM AttrSets
         WHERE ( id = ? )
@@ -377,7 +593,8 @@ PkgDb::setPrefixDone( row_id prefixId, bool done )
     )
   )SQL" );
   cmd.bind( 1, static_cast<int>( done ) );
-  cmd.bind( 2, static_cast<long long>( prefixId ) );
+  cmd.bind( 2, static_cast<int>( done && skeleton ) );
+  cmd.bind( 3, static_cast<long long>( prefixId ) );
   if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
     {
       throw PkgDbException( nix::fmt(
@@ -389,9 +606,559 @@ PkgDb::setPrefixDone( row_id prefixId, bool done )
 }
 
 void
-PkgDb::setPrefixDone( const flox::AttrPath & prefix, bool done )
+PkgDb::setPrefixDone( const flox::AttrPath & prefix,
+                      bool                   done,
+                      bool                   skeleton )
+{
+  this->setPrefixDone( this->addOrGetAttrSetId( prefix ), done, skeleton );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDb::updateBestCandidates( const flox::AttrPath & prefix )
+{
+  if ( ( prefix.empty() ) || ( 2 < prefix.size() ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "cannot rank candidates for prefix '%s'",
+                  nix::concatStringsSep( ".", prefix ) ) );
+    }
+
+  auto bindPrefix = [&]( sqlite3pp::statement & stmt )
+  {
+    stmt.bind( ":subtree", prefix.front(), sqlite3pp::copy );
+    if ( prefix.size() < 2 ) { stmt.bind( ":system" ); /* binds NULL */ }
+    else { stmt.bind( ":system", prefix.at( 1 ), sqlite3pp::copy ); }
+  };
+
+  sqlite3pp::command clear( this->db, R"SQL(
+    DELETE FROM BestCandidates WHERE ( subtree = :subtree )
+      AND ( ( :system IS NULL ) OR ( system = :system ) )
+  )SQL" );
+  bindPrefix( clear );
+  if ( sql_rc rcode = clear.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to clear BestCandidates for '%s':(%d) %s",
+                  nix::concatStringsSep( ".", prefix ),
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+
+  /* This uses the same ordering as `PkgQueryBatch' for a member with
+   * only `pnameOrAttrName' set. */
+  sqlite3pp::command cmd( this->db, R"SQL(
+    WITH Variants ( allowBroken, allowUnfree ) AS (
+      VALUES ( FALSE, FALSE ), ( FALSE, TRUE ), ( TRUE, FALSE ), ( TRUE, TRUE )
+    ), Candidates AS (
+      SELECT pname AS candidateName, id, subtree, system, depth, pname
+           , attrName, versionType, preTag, major, minor, patch, versionDate
+           , version, broken, brokenRank, unfree, unfreeRank
+      FROM v_PackagesSearch
+      WHERE ( subtree = :subtree )
+        AND ( ( :system IS NULL ) OR ( system = :system ) )
+        AND ( pname IS NOT NULL )
+      UNION
+      SELECT attrName AS candidateName, id, subtree, system, depth, pname
+           , attrName, versionType, preTag, major, minor, patch, versionDate
+           , version, broken, brokenRank, unfree, unfreeRank
+      FROM v_PackagesSearch
+      WHERE ( subtree = :subtree )
+        AND ( ( :system IS NULL ) OR ( system = :system ) )
+    )
+    INSERT INTO BestCandidates (
+      name, subtree, system, allowBroken, allowUnfree, packageId
+    ) SELECT candidateName, subtree, system, allowBroken, allowUnfree, id
+    FROM (
+      SELECT candidateName, subtree, system, Variants.allowBroken
+           , Variants.allowUnfree, id, ROW_NUMBER() OVER (
+        PARTITION BY candidateName, system, Variants.allowBroken
+                   , Variants.allowUnfree
+        ORDER BY
+          ( candidateName = pname )    DESC
+        , ( candidateName = attrName ) DESC
+        , depth       ASC
+        , pname       ASC
+        , versionType ASC
+        , preTag      DESC NULLS FIRST
+        , major       DESC NULLS LAST
+        , minor       DESC NULLS LAST
+        , patch       DESC NULLS LAST
+        , versionDate DESC NULLS LAST
+        -- Lexicographic as fallback for misc. versions
+        , version     ASC NULLS LAST
+        , brokenRank  ASC
+        , unfreeRank  ASC
+        , attrName    ASC
+      ) AS candidateRank
+      FROM Candidates CROSS JOIN Variants
+      WHERE ( Variants.allowBroken OR ( broken IS NULL ) OR ( broken = FALSE ) )
+        AND ( Variants.allowUnfree OR ( unfree IS NULL ) OR ( unfree = FALSE ) )
+    ) WHERE ( candidateRank = 1 )
+  )SQL" );
+  bindPrefix( cmd );
+  if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to rank BestCandidates for '%s':(%d) %s",
+                  nix::concatStringsSep( ".", prefix ),
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDb::cacheQuery( const std::string &                        key,
+                   const std::unordered_map<System, row_id> & results )
+{
+  sqlite3pp::command cmd(
+    this->db,
+    "INSERT OR REPLACE INTO QueryCache ( key, results ) VALUES ( ?, ? )" );
+  cmd.bind( 1, key, sqlite3pp::copy );
+  cmd.bind( 2, nlohmann::json( results ).dump(), sqlite3pp::copy );
+  if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException( nix::fmt( "failed to cache query '%s':(%d) %s",
+                                      key,
+                                      rcode,
+                                      this->db.error_msg() ) );
+    }
+}
+
+
+void
+PkgDb::clearQueryCache()
+{
+  if ( sql_rc rcode = this->execute( "DELETE FROM QueryCache" );
+       isSQLError( rcode ) )
+    {
+      throw PkgDbException( nix::fmt( "failed to clear QueryCache:(%d) %s",
+                                      rcode,
+                                      this->db.error_msg() ) );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+ScrapeFields
+PkgDb::setScrapeFields( const ScrapeFields & fields )
+{
+  /* An empty database may switch fields freely. */
+  ScrapeFields recorded = fields;
+  {
+    sqlite3pp::query qry( this->db, "SELECT COUNT( * ) FROM Packages" );
+    if ( 0 < ( *qry.begin() ).get<long long>( 0 ) )
+      {
+        recorded = this->getScrapeFields().intersect( fields );
+      }
+  }
+
+  sqlite3pp::command cmd( this->db, R"SQL(
+    INSERT OR REPLACE INTO DbVersions ( name, version )
+    VALUES ( 'pkgdb_scrape_fields', ? )
+  )SQL" );
+  cmd.bind( 1, nlohmann::json( recorded ).dump(), sqlite3pp::copy );
+  if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException( nix::fmt( "failed to write scrape fields:(%d) %s",
+                                      rcode,
+                                      this->db.error_msg() ) );
+    }
+  return recorded;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDb::addEvalError( row_id           parentId,
+                     std::string_view attrName,
+                     std::string_view errorClass,
+                     std::string_view message )
+{
+  sqlite3pp::command cmd( this->db, R"SQL(
+    INSERT OR REPLACE INTO EvalErrors (
+      parentId, attrName, errorClass, message
+    ) VALUES ( ?, ?, ?, ? )
+  )SQL" );
+  cmd.bind( 1, static_cast<long long>( parentId ) );
+  cmd.bind( 2, std::string( attrName ), sqlite3pp::copy );
+  cmd.bind( 3, std::string( errorClass ), sqlite3pp::copy );
+  cmd.bind( 4, std::string( message ), sqlite3pp::copy );
+  if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to record evaluation error for '%s':(%d) %s",
+                  attrName,
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+}
+
+
+void
+PkgDb::clearEvalErrors( row_id parentId )
+{
+  sqlite3pp::command cmd( this->db,
+                          "DELETE FROM EvalErrors WHERE ( parentId = ? )" );
+  cmd.bind( 1, static_cast<long long>( parentId ) );
+  if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to clear evaluation errors:(%d) %s",
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDb::mergeShard( const std::filesystem::path & shardPath )
+{
+  if ( ! std::filesystem::exists( shardPath ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "no such database shard '%s'", shardPath.string() ) );
+    }
+
+  sqlite3pp::command attach( this->db, "ATTACH DATABASE ? AS Shard" );
+  attach.bind( 1, shardPath.string(), sqlite3pp::copy );
+  if ( sql_rc rcode = attach.execute(); isSQLError( rcode ) )
+    {
+      throw PkgDbException(
+        nix::fmt( "failed to attach database shard '%s':(%d) %s",
+                  shardPath.string(),
+                  rcode,
+                  this->db.error_msg() ) );
+    }
+
+  try
+    {
+      sqlite3pp::transaction txn( this->db, false, true );
+
+      /* Refuse to mix packages from different flakes. */
+      {
+        sqlite3pp::query qry( this->db,
+                              "SELECT fingerprint FROM Shard.LockedFlake" );
+        auto rsl = qry.begin();
+        if ( ( rsl == qry.end() )
+             || ( ( *rsl ).get<std::string>( 0 )
+                  != this->fingerprint.to_string( nix::Base16, false ) ) )
+          {
+            throw PkgDbException(
+              nix::fmt( "database shard '%s' does not belong to flake '%s'",
+                        shardPath.string(),
+                        this->lockedRef.string ) );
+          }
+      }
+
+      if ( sql_rc rcode = this->execute( R"SQL(
+             INSERT OR IGNORE INTO Descriptions ( description )
+               SELECT description FROM Shard.Descriptions
+           )SQL" );
+           isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to merge Descriptions:(%d) %s",
+                      rcode,
+                      this->db.error_msg() ) );
+        }
+
+      /* Parents always precede their children, so a single pass in `id'
+       * order can map every shard `AttrSets.id' to ours. */
+      std::vector<std::tuple<row_id, row_id, std::string, bool, bool>>
+        attrSets;
+      {
+        sqlite3pp::query qry( this->db, R"SQL(
+          SELECT id, parent, attrName, done, skeleton FROM Shard.AttrSets
+          ORDER BY id
+        )SQL" );
+        for ( const auto & row : qry )
+          {
+            attrSets.emplace_back( row.get<long long>( 0 ),
+                                   row.get<long long>( 1 ),
+                                   row.get<std::string>( 2 ),
+                                   row.get<bool>( 3 ),
+                                   row.get<bool>( 4 ) );
+          }
+      }
+
+      if ( sql_rc rcode = this->execute_all( R"SQL(
+             CREATE TEMP TABLE IF NOT EXISTS ShardAttrSets (
+               shardId  INTEGER  PRIMARY KEY
+             , id       INTEGER  NOT NULL
+             );
+             DELETE FROM ShardAttrSets
+           )SQL" );
+           isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to create ShardAttrSets table:(%d) %s",
+                      rcode,
+                      this->db.error_msg() ) );
+        }
+
+      std::unordered_map<row_id, row_id>      ids   = { { 0, 0 } };
+      std::unordered_map<row_id, std::string> roots;
+      std::vector<flox::AttrPath>             done;
+      for ( const auto & [shardId, shardParent, attrName, isDone, isSkeleton] :
+            attrSets )
+        {
+          auto parent = ids.find( shardParent );
+          if ( parent == ids.end() )
+            {
+              throw PkgDbException(
+                nix::fmt( "database shard '%s' has no AttrSets.id %d",
+                          shardPath.string(),
+                          shardParent ) );
+            }
+          row_id id = this->addOrGetAttrSetId( attrName, parent->second );
+          ids.emplace( shardId, id );
+
+          sqlite3pp::command cmd(
+            this->db,
+            "INSERT INTO ShardAttrSets ( shardId, id ) VALUES ( ?, ? )" );
+          cmd.bind( 1, static_cast<long long>( shardId ) );
+          cmd.bind( 2, static_cast<long long>( id ) );
+          if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+            {
+              throw PkgDbException(
+                nix::fmt( "failed to map AttrSets.id %d:(%d) %s",
+                          shardId,
+                          rcode,
+                          this->db.error_msg() ) );
+            }
+
+          if ( shardParent == 0 ) { roots.emplace( shardId, attrName ); }
+          if ( ! isDone ) { continue; }
+          /* Sets which we've already completed keep their `skeleton'
+           * marker, packages we already have aren't replaced. */
+          sqlite3pp::command setDone( this->db, R"SQL(
+            UPDATE AttrSets SET skeleton = iif( done, skeleton, ? ), done = TRUE
+            WHERE ( id = ? )
+          )SQL" );
+          setDone.bind( 1, static_cast<int>( isSkeleton ) );
+          setDone.bind( 2, static_cast<long long>( id ) );
+          if ( sql_rc rcode = setDone.execute(); isSQLError( rcode ) )
+            {
+              throw PkgDbException(
+                nix::fmt( "failed to set AttrSets.done for id %d:(%d) %s",
+                          id,
+                          rcode,
+                          this->db.error_msg() ) );
+            }
+          if ( auto root = roots.find( shardParent ); root != roots.end() )
+            {
+              done.emplace_back( flox::AttrPath { root->second, attrName } );
+            }
+        }
+
+      /* Columns skipped by the shard are no longer authoritative here. */
+      {
+        sqlite3pp::query qry( this->db, R"SQL(
+          SELECT version FROM Shard.DbVersions
+          WHERE name = 'pkgdb_scrape_fields'
+        )SQL" );
+        if ( auto rsl = qry.begin(); rsl != qry.end() )
+          {
+            this->setScrapeFields(
+              nlohmann::json::parse( ( *rsl ).get<std::string>( 0 ) )
+                .get<ScrapeFields>() );
+          }
+      }
+
+      if ( sql_rc rcode = this->execute( R"SQL(
+             INSERT OR IGNORE INTO Packages (
+               parentId, attrName, name, pname, version, semver, license
+             , outputs, outputsToInstall, broken, unfree, descriptionId
+             , skeleton
+             ) SELECT ShardAttrSets.id, P.attrName, P.name, P.pname, P.version
+                    , P.semver, P.license, P.outputs, P.outputsToInstall
+                    , P.broken, P.unfree, Descriptions.id, P.skeleton
+               FROM Shard.Packages AS P
+               JOIN ShardAttrSets ON ( P.parentId = ShardAttrSets.shardId )
+               LEFT JOIN Shard.Descriptions AS D
+                 ON ( P.descriptionId = D.id )
+               LEFT JOIN Descriptions
+                 ON ( D.description = Descriptions.description )
+           )SQL" );
+           isSQLError( rcode ) )
+        {
+          throw PkgDbException( nix::fmt( "failed to merge Packages:(%d) %s",
+                                          rcode,
+                                          this->db.error_msg() ) );
+        }
+
+      if ( sql_rc rcode = this->execute( R"SQL(
+             INSERT OR IGNORE INTO EvalErrors (
+               parentId, attrName, errorClass, message
+             ) SELECT ShardAttrSets.id, E.attrName, E.errorClass, E.message
+               FROM Shard.EvalErrors AS E
+               JOIN ShardAttrSets ON ( E.parentId = ShardAttrSets.shardId )
+           )SQL" );
+           isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to merge EvalErrors:(%d) %s",
+                      rcode,
+                      this->db.error_msg() ) );
+        }
+
+      this->execute( "DROP TABLE ShardAttrSets" );
+
+      /* Memoized queries may be missing newly added packages. */
+      this->clearQueryCache();
+      for ( const auto & prefix : done )
+        {
+          this->updateBestCandidates( prefix );
+        }
+
+      txn.commit();
+    }
+  catch ( ... )
+    {
+      this->execute( "DETACH DATABASE Shard" );
+      throw;
+    }
+
+  this->execute( "DETACH DATABASE Shard" );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+nix::AutoCloseFD
+lockPkgDb( const std::filesystem::path & dbPath, bool wait )
+{
+  std::string path = dbPath.string() + ".lock";
+  while ( true )
+    {
+      nix::AutoCloseFD lock = nix::openLockFile( path, true );
+      if ( ! nix::lockFile( lock.get(), nix::ltWrite, wait ) )
+        {
+          return nix::AutoCloseFD();
+        }
+
+      /* `nix::deleteLockFile' marks lock files as stale before deleting
+       * them, in which case we retry with a new lock file. */
+      struct stat info
+      {};
+      if ( fstat( lock.get(), &info ) == -1 )
+        {
+          throw nix::SysError( "statting lock file '%s'", path );
+        }
+      if ( info.st_size == 0 ) { return lock; }
+    }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+deletePkgDbLock( const std::filesystem::path & dbPath,
+                 const nix::AutoCloseFD &      lock )
 {
-  this->setPrefixDone( this->addOrGetAttrSetId( prefix ), done );
+  nix::deleteLockFile( dbPath.string() + ".lock", lock.get() );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::vector<std::filesystem::path>
+mergePkgDbShards( PkgDb &                       pdb,
+                  const std::filesystem::path & shardDir,
+                  bool                          completeOnly )
+{
+  std::vector<std::filesystem::path> merged;
+  if ( ! std::filesystem::is_directory( shardDir ) ) { return merged; }
+
+  std::vector<std::filesystem::path> shards;
+  for ( const auto & entry : std::filesystem::directory_iterator( shardDir ) )
+    {
+      if ( entry.path().extension() == ".sqlite" )
+        {
+          shards.emplace_back( entry.path() );
+        }
+    }
+  std::sort( shards.begin(), shards.end() );
+
+  for ( const auto & shard : shards )
+    {
+      /* Skip shards which are still being scraped. */
+      nix::AutoCloseFD lock = lockPkgDb( shard, false );
+      if ( ! lock ) { continue; }
+      {
+        PkgDbReadOnly shardDb( shard.string() );
+        /* Tables can't be copied between incompatible schemas. */
+        if ( shardDb.getDbVersion() != sqlVersions )
+          {
+            nix::warn( "skipping database shard '%s' with an incompatible "
+                       "schema version",
+                       shard.string() );
+            continue;
+          }
+        if ( completeOnly )
+          {
+            /* Shards are named `<SUBTREE>.<SYSTEM>.sqlite'. */
+            std::string    stem = shard.stem().string();
+            auto           dot  = stem.find( '.' );
+            flox::AttrPath prefix
+              = { stem.substr( 0, dot ),
+                  ( dot == std::string::npos ) ? ""
+                                               : stem.substr( dot + 1 ) };
+            if ( ! shardDb.completedAttrSet( prefix ) ) { continue; }
+          }
+      }
+
+      nix::logger->log(
+        nix::lvlTalkative,
+        nix::fmt( "Merging database shard '%s' into '%s'",
+                  shard.string(),
+                  pdb.dbPath.string() ) );
+      pdb.mergeShard( shard );
+      std::filesystem::remove( shard );
+      std::filesystem::remove( shard.string() + "-journal" );
+      deletePkgDbLock( shard, lock );
+      merged.emplace_back( shard );
+    }
+
+  /* Only removes the directory if it's empty. */
+  std::error_code err;
+  std::filesystem::remove( shardDir, err );
+
+  return merged;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Classify an evaluation error for the `EvalErrors` table. */
+static std::string
+getEvalErrorClass( const nix::EvalError & err )
+{
+  /* `ThrownError' is a subclass of `AssertionError'. */
+  if ( dynamic_cast<const nix::ThrownError *>( &err ) != nullptr )
+    {
+      return "throw";
+    }
+  if ( dynamic_cast<const nix::AssertionError *>( &err ) != nullptr )
+    {
+      return "assert";
+    }
+  if ( dynamic_cast<const nix::Abort *>( &err ) != nullptr ) { return "abort"; }
+  if ( dynamic_cast<const nix::TypeError *>( &err ) != nullptr )
+    {
+      return "type";
+    }
+  return "eval";
 }
 
 
@@ -405,13 +1172,38 @@ PkgDb::setPrefixDone( const flox::AttrPath & prefix, bool done )
 void
 PkgDb::scrape( nix::SymbolTable & syms, const Target & target, Todos & todo )
 {
-  const auto & [prefix, cursor, parentId] = target;
+  PackageWriter writer( *this );
+  EvalWatchdog  watchdog( std::nullopt, std::nullopt );
+  this->scrape( syms, target, todo, writer, watchdog );
+  writer.finish();
+}
 
-  /* If it has previously been scraped then bail out. */
-  if ( this->completedAttrSet( parentId ) ) { return; }
+
+void
+PkgDb::scrape( nix::SymbolTable &    syms,
+               const Target &        target,
+               Todos &               todo,
+               PackageWriter &       writer,
+               EvalWatchdog &        watchdog,
+               const ScrapeOptions & options )
+{
+  const auto & [prefix, cursor, parentId] = target;
 
   bool tryRecur = prefix.front() != "packages";
 
+  /* If it has previously been scraped then bail out. */
+  ScrapeFields                                 fields = ScrapeFields::none();
+  std::unordered_map<std::string, std::string> failed;
+  {
+    auto lock = writer.lockDb();
+    if ( this->completedAttrSet( parentId ) ) { return; }
+    if ( ! options.skeleton ) { fields = this->getScrapeFields(); }
+    /* Evaluation errors are only recorded for `legacyPackages', but
+     * attributes which exceeded their budget are recorded for any prefix. */
+    if ( options.retryErrors ) { this->clearEvalErrors( parentId ); }
+    else { failed = this->getEvalErrors( parentId ); }
+  }
+
   nix::Activity act( *nix::logger,
                      nix::lvlInfo,
                      nix::actUnknown,
@@ -429,6 +1221,16 @@ PkgDb::scrape( nix::SymbolTable & syms, const Target & target, Todos & todo )
             ? nix::concatStringsSep( ".", prefix ) + "." + syms[aname]
             : "";
 
+      /* Skip attributes which failed to evaluate previously. */
+      if ( auto error = failed.find( syms[aname] ); error != failed.end() )
+        {
+          nix::logger->log( nix::lvlTalkative,
+                            "\tskipping attribute '" + pathS
+                              + "' which previously failed to evaluate ( "
+                              + error->second + " )" );
+          continue;
+        }
+
       nix::Activity act( *nix::logger,
                          nix::lvlTalkative,
                          nix::actUnknown,
@@ -436,10 +1238,16 @@ PkgDb::scrape( nix::SymbolTable & syms, const Target & target, Todos & todo )
 
       try
         {
+          watchdog.arm();
           flox::Cursor child = cursor->getAttr( aname );
           if ( child->isDerivation() )
             {
-              this->addPackage( parentId, syms[aname], child );
+              /* We just checked `isDerivation'. */
+              PackageRow row
+                = mkPackageRow( parentId, syms[aname], child, false, fields );
+              watchdog.disarm();
+              row.skeleton = options.skeleton;
+              writer.push( std::move( row ) );
               continue;
             }
           if ( ! tryRecur ) { continue; }
@@ -458,7 +1266,12 @@ PkgDb::scrape( nix::SymbolTable & syms, const Target & target, Todos & todo )
                   nix::logger->log( nix::lvlTalkative,
                                     "\tpushing target '" + pathS + "'" );
                 }
-              row_id childId = this->addOrGetAttrSetId( syms[aname], parentId );
+              watchdog.disarm();
+              row_id childId = 0;
+              {
+                auto lock = writer.lockDb();
+                childId   = this->addOrGetAttrSetId( syms[aname], parentId );
+              }
               todo.emplace( std::make_tuple( std::move( path ),
                                              std::move( child ),
                                              childId ) );
@@ -469,12 +1282,163 @@ PkgDb::scrape( nix::SymbolTable & syms, const Target & target, Todos & todo )
           /* Ignore errors in `legacyPackages' */
           if ( tryRecur )
             {
+              /* Remember the failure so that later scrapes may skip it. */
+              {
+                auto lock = writer.lockDb();
+                this->addEvalError(
+                  parentId,
+                  syms[aname],
+                  getEvalErrorClass( err ),
+                  nix::filterANSIEscapes( err.info().msg.str(), true ) );
+              }
               /* Only print eval errors in "debug" mode. */
               nix::ignoreException( nix::lvlDebug );
             }
           else { throw; }
         }
+      catch ( const EvalBudgetExceeded & err )
+        {
+          /* Skip the attribute, and remember it so that later scrapes may
+           * skip it without evaluating it. */
+          std::string reason
+            = nix::filterANSIEscapes( err.info().msg.str(), true );
+          nix::warn( "skipping attribute '%s': %s",
+                     nix::concatStringsSep( ".", prefix ) + "." + syms[aname],
+                     reason );
+          auto lock = writer.lockDb();
+          this->addEvalError( parentId, syms[aname], "budget", reason );
+        }
     }
+  watchdog.disarm();
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+PkgDb::backfill( row_id                                    prefixId,
+                 const flox::Cursor &                      cursor,
+                 EvalWatchdog &                            watchdog,
+                 const std::optional<std::vector<row_id>> & packageIds )
+{
+  ScrapeFields   fields = this->getScrapeFields();
+  flox::AttrPath prefix = this->getAttrSetPath( prefixId );
+
+  nix::Activity act( *nix::logger,
+                     nix::lvlInfo,
+                     nix::actUnknown,
+                     nix::fmt( "backfilling package set '%s'",
+                               nix::concatStringsSep( ".", prefix ) ) );
+
+  /* Collect skeleton packages grouped by parent so that each parent's
+   * cursor is only opened once. */
+  std::vector<std::tuple<row_id, row_id, std::string>> skeletons;
+  {
+    std::stringstream stmt;
+    stmt << R"SQL(
+      WITH RECURSIVE Tree ( id ) AS (
+        SELECT ?
+        UNION ALL SELECT AttrSets.id FROM AttrSets
+        JOIN Tree ON ( AttrSets.parent = Tree.id )
+      ) SELECT Packages.id, Packages.parentId, Packages.attrName
+        FROM Packages JOIN Tree ON ( Packages.parentId = Tree.id )
+        WHERE Packages.skeleton
+    )SQL";
+    if ( packageIds.has_value() )
+      {
+        if ( packageIds->empty() ) { return; }
+        stmt << " AND ( Packages.id IN ( ";
+        for ( auto itr = packageIds->begin(); itr != packageIds->end(); ++itr )
+          {
+            if ( itr != packageIds->begin() ) { stmt << ", "; }
+            stmt << *itr;
+          }
+        stmt << " ) )";
+      }
+    stmt << " ORDER BY Packages.parentId";
+    sqlite3pp::query qry( this->db, stmt.str().c_str() );
+    qry.bind( 1, static_cast<long long>( prefixId ) );
+    for ( const auto & row : qry )
+      {
+        skeletons.emplace_back( row.get<long long>( 0 ),
+                                row.get<long long>( 1 ),
+                                row.get<std::string>( 2 ) );
+      }
+  }
+
+  sqlite3pp::command cmd( this->db, R"SQL(
+    UPDATE Packages SET
+      license          = :license
+    , outputsToInstall = :outputsToInstall
+    , broken           = :broken
+    , unfree           = :unfree
+    , descriptionId    = :descriptionId
+    , skeleton         = :skeleton
+    WHERE ( id = :id )
+  )SQL" );
+
+  row_id      lastParent = 0;
+  MaybeCursor parent;
+  for ( const auto & [id, parentId, attrName] : skeletons )
+    {
+      /* Packages which fail to evaluate keep `NULL' values. */
+      PackageRow row;
+      try
+        {
+          watchdog.arm();
+          if ( parentId != lastParent )
+            {
+              lastParent = parentId;
+              parent     = nullptr;
+              MaybeCursor    attrs = static_cast<MaybeCursor>( cursor );
+              flox::AttrPath path  = this->getAttrSetPath( parentId );
+              for ( auto itr = path.begin() + prefix.size();
+                    ( attrs != nullptr ) && ( itr != path.end() );
+                    ++itr )
+                {
+                  attrs = attrs->maybeGetAttr( *itr );
+                }
+              parent = std::move( attrs );
+            }
+          MaybeCursor child = nullptr;
+          if ( parent != nullptr ) { child = parent->maybeGetAttr( attrName ); }
+          if ( child != nullptr )
+            {
+              row = mkPackageRow( parentId,
+                                  attrName,
+                                  static_cast<flox::Cursor>( child ),
+                                  false,
+                                  fields );
+            }
+          watchdog.disarm();
+        }
+      catch ( const nix::EvalError & )
+        {
+          nix::ignoreException( nix::lvlDebug );
+        }
+      catch ( const EvalBudgetExceeded & err )
+        {
+          flox::AttrPath path = this->getAttrSetPath( parentId );
+          path.emplace_back( attrName );
+          nix::warn( "skipping `meta' of attribute '%s': %s",
+                     nix::concatStringsSep( ".", path ),
+                     nix::filterANSIEscapes( err.info().msg.str(), true ) );
+        }
+
+      bindPackageMeta( *this, cmd, row );
+      cmd.bind( ":id", static_cast<long long>( id ) );
+      if ( sql_rc rcode = cmd.execute(); isSQLError( rcode ) )
+        {
+          throw PkgDbException(
+            nix::fmt( "failed to backfill Package '%s':(%d) %s",
+                      attrName,
+                      rcode,
+                      this->db.error_msg() ) );
+        }
+      cmd.reset();
+    }
+
+  if ( ! packageIds.has_value() ) { this->setPrefixDone( prefixId, true ); }
 }
 
 
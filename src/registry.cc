@@ -7,7 +7,9 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <nix/fetchers.hh>
 #include <nix/flake/flakeref.hh>
+#include <nix/thread-pool.hh>
 
 #include "flox/core/util.hh"
 #include "flox/pkgdb/input.hh"
@@ -359,11 +361,44 @@ to_json( nlohmann::json & jto, const InputPreferences & prefs )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+void
+prefetchRegistryInputs( const RegistryRaw &          registry,
+                        const nix::ref<nix::Store> & store )
+{
+  /* Nothing to gain from a thread pool with a single input. */
+  if ( registry.inputs.size() < 2 ) { return; }
+
+  nix::ThreadPool pool( registry.inputs.size() );
+  for ( const auto & [name, input] : registry.inputs )
+    {
+      if ( input.from == nullptr ) { continue; }
+      pool.enqueue(
+        [&, ref = *input.from]()
+        {
+          try
+            {
+              (void) ref.fetchTree( store );
+            }
+          catch ( ... )
+            {
+              nix::ignoreException( nix::lvlDebug );
+            }
+        } );
+    }
+  pool.process();
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 RegistryRaw
-lockRegistry( const RegistryRaw & unlocked, const nix::ref<nix::Store> & store )
+lockRegistry( const RegistryRaw &          unlocked,
+              const nix::ref<nix::Store> & store,
+              bool                         prefetch )
 {
+  if ( prefetch ) { prefetchRegistryInputs( unlocked, store ); }
   auto factory  = FloxFlakeInputFactory( store );
   auto locked   = unlocked;
   locked.inputs = FlakeRegistry( unlocked, factory ).getLockedInputs();
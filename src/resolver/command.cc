@@ -7,8 +7,14 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include <fcntl.h>
+#include <list>
+#include <unistd.h>
+
+#include <nix/util.hh>
 #include <nlohmann/json.hpp>
 
+#include "flox/registry.hh"
 #include "flox/resolver/command.hh"
 
 
@@ -36,14 +42,283 @@ int
 LockCommand::run()
 {
   // TODO: `RegistryRaw' should drop empty fields.
-  nlohmann::json lockfile
-    = this->getEnvironment().createLockfile().getLockfileRaw();
+  nlohmann::json lockfile = this->lockEnvironment();
   /* Print that bad boii */
   std::cout << lockfile.dump() << std::endl;
   return EXIT_SUCCESS;
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+/** @brief Locks a single manifest for @a flox::resolver::LockManyCommand. */
+class LockManyTarget : public GAEnvironmentMixin
+{
+
+public:
+
+  LockManyTarget( const std::filesystem::path &               manifestPath,
+                  const std::optional<std::filesystem::path> & globalPath,
+                  bool                                         gaRegistry,
+                  std::shared_ptr<EnvironmentCache>            cache )
+  {
+    this->setGARegistry( gaRegistry );
+    if ( globalPath.has_value() ) { this->setGlobalManifestRaw( globalPath ); }
+    this->setManifestRaw( manifestPath );
+    if ( auto lockfilePath = manifestPath.parent_path() / "manifest.lock";
+         std::filesystem::exists( lockfilePath ) )
+      {
+        this->setLockfileRaw( lockfilePath );
+      }
+    this->setEnvironmentCache( std::move( cache ) );
+  }
+
+
+}; /* End class `LockManyTarget' */
+
+}  // namespace
+
+
+/* -------------------------------------------------------------------------- */
+
+LockManyCommand::LockManyCommand() : parser( "lock-many" )
+{
+  this->parser.add_description(
+    "Lock many manifests, emitting a line of JSON for each" );
+
+  this->parser.add_argument( "--global-manifest" )
+    .help( "the path to the user's global `manifest.{toml,yaml,json}' file." )
+    .metavar( "PATH" )
+    .nargs( 1 )
+    .action( [&]( const std::string & strPath )
+             { this->globalManifestPath = nix::absPath( strPath ); } );
+
+  this->parser.add_argument( "--ga-registry" )
+    .help( "use a hard coded manifest registry for `flox' GA." )
+    .nargs( 0 )
+    .action( [&]( const auto & ) { this->gaRegistry = true; } );
+
+  this->parser.add_argument( "--jobs", "-j" )
+    .help( "number of worker processes to lock manifests with." )
+    .metavar( "N" )
+    .nargs( 1 )
+    .action(
+      [&]( const std::string & jobs )
+      {
+        bool valid = ( ! jobs.empty() )
+                     && ( jobs.find_first_not_of( "0123456789" )
+                          == std::string::npos );
+        try
+          {
+            if ( valid ) { this->jobs = std::stoul( jobs ); }
+          }
+        catch ( const std::exception & )
+          {
+            valid = false;
+          }
+        if ( ( ! valid ) || ( this->jobs < 1 ) )
+          {
+            throw command::InvalidArgException(
+              "`--jobs' must be a positive integer" );
+          }
+      } );
+
+  this->parser.add_argument( "manifest" )
+    .help( "paths to projects' `manifest.{toml,yaml,json}' files." )
+    .metavar( "MANIFEST-PATH..." )
+    .remaining()
+    .action( [&]( const std::string & strPath )
+             { this->manifestPaths.emplace_back( nix::absPath( strPath ) ); } );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool
+LockManyCommand::lockOne( const std::filesystem::path &     manifestPath,
+                          std::shared_ptr<EnvironmentCache> cache )
+{
+  nlohmann::json line = { { "manifest", manifestPath.string() } };
+  bool           rsl  = false;
+  try
+    {
+      LockManyTarget target( manifestPath,
+                             this->globalManifestPath,
+                             this->gaRegistry,
+                             std::move( cache ) );
+      line["lockfile"] = target.lockEnvironment();
+      rsl              = true;
+    }
+  catch ( const FloxException & err )
+    {
+      line["error"] = err;
+    }
+  catch ( const nix::Error & err )
+    {
+      line["error"] = {
+        { "exit_code", EC_NIX },
+        { "message", nix::filterANSIEscapes( err.what(), true ) },
+      };
+    }
+  catch ( const std::exception & err )
+    {
+      line["error"] = {
+        { "exit_code", EC_FAILURE },
+        { "message", err.what() },
+      };
+    }
+  std::cout << line.dump() << std::endl;
+  return rsl;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+LockManyCommand::prefetchInputs(
+  const std::shared_ptr<EnvironmentCache> & cache )
+{
+  /* Inputs are keyed by flake reference, so inputs shared by many
+   * environments are only fetched once. */
+  RegistryRaw inputs;
+  for ( const auto & manifestPath : this->manifestPaths )
+    {
+      try
+        {
+          LockManyTarget target( manifestPath,
+                                 this->globalManifestPath,
+                                 this->gaRegistry,
+                                 cache );
+          if ( target.hasCurrentLockfile() ) { continue; }
+          inputs.inputs.merge(
+            target.getEnvironment().getPrefetchRegistryRaw().inputs );
+        }
+      catch ( ... )
+        {
+          /* Errors are reported when the manifest is locked. */
+          nix::ignoreException( nix::lvlDebug );
+        }
+    }
+  prefetchRegistryInputs( inputs, NixStoreMixin().getStore() );
+  cache->prefetched = true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+LockManyCommand::runJobs()
+{
+  auto self = nix::getSelfExe();
+  if ( ! self.has_value() )
+    {
+      throw FloxException( "unable to locate `pkgdb' executable for workers" );
+    }
+
+  nix::Strings baseArgs = { *self, "manifest", "lock-many" };
+  if ( this->globalManifestPath.has_value() )
+    {
+      baseArgs.emplace_back( "--global-manifest" );
+      baseArgs.emplace_back( this->globalManifestPath->string() );
+    }
+  if ( this->gaRegistry ) { baseArgs.emplace_back( "--ga-registry" ); }
+
+  /* Workers inherit our verbosity, relative to the default `lvlInfo'. */
+  for ( int level = nix::lvlInfo; level < nix::verbosity; ++level )
+    {
+      baseArgs.emplace_back( "--verbose" );
+    }
+  for ( int level = nix::lvlInfo; nix::verbosity < level; --level )
+    {
+      baseArgs.emplace_back( "--quiet" );
+    }
+
+  /* Split manifests into contiguous shards so output order is preserved. */
+  size_t nJobs = std::min( this->jobs, this->manifestPaths.size() );
+  size_t shard = ( this->manifestPaths.size() + nJobs - 1 ) / nJobs;
+
+  nix::AutoDelete          tmpDir( nix::createTempDir() );
+  std::list<nix::Pid>      workers;
+  std::vector<std::string> outputs;
+  for ( size_t begin = 0; begin < this->manifestPaths.size(); begin += shard )
+    {
+      nix::Strings args = baseArgs;
+      size_t       end  = std::min( begin + shard, this->manifestPaths.size() );
+      for ( size_t idx = begin; idx < end; ++idx )
+        {
+          args.emplace_back( this->manifestPaths.at( idx ).string() );
+        }
+
+      std::string output
+        = ( std::filesystem::path( tmpDir.path() )
+            / ( "worker-" + std::to_string( outputs.size() ) + ".jsonl" ) )
+            .string();
+      outputs.emplace_back( output );
+
+      workers.emplace_back( nix::startProcess(
+        [&]()
+        {
+          int fd = open( output.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                         0600 );
+          if ( ( fd == -1 ) || ( dup2( fd, STDOUT_FILENO ) == -1 ) )
+            {
+              throw nix::SysError( "redirecting worker output to `%s'",
+                                   output );
+            }
+          execv( self->c_str(), nix::stringsToCharPtrs( args ).data() );
+          throw nix::SysError( "executing `%s'", *self );
+        } ) );
+    }
+
+  bool success = true;
+  for ( auto & worker : workers )
+    {
+      if ( ! nix::statusOk( worker.wait() ) ) { success = false; }
+    }
+
+  /* Emit worker outputs in the order manifests were given. */
+  for ( const auto & output : outputs )
+    {
+      if ( std::filesystem::exists( output ) )
+        {
+          std::cout << nix::readFile( output );
+        }
+    }
+  std::cout.flush();
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+LockManyCommand::run()
+{
+  if ( this->manifestPaths.empty() )
+    {
+      throw command::InvalidArgException(
+        "you must provide at least one manifest file." );
+    }
+
+  if ( 1 < this->jobs ) { return this->runJobs(); }
+
+  /* The evaluator and our databases are not thread safe, so environments are
+   * locked in sequence while sharing inputs and resolutions. */
+  auto cache = std::make_shared<EnvironmentCache>();
+  this->prefetchInputs( cache );
+  bool success = true;
+  for ( const auto & manifestPath : this->manifestPaths )
+    {
+      if ( ! this->lockOne( manifestPath, cache ) ) { success = false; }
+    }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 DiffCommand::DiffCommand() : parser( "diff" )
@@ -220,7 +495,7 @@ RegistryCommand::run()
       registries["global-locked"] = nullptr;
     }
 
-  if ( auto maybeLock = this->getEnvironment().getOldLockfile();
+  if ( const auto & maybeLock = this->getEnvironment().getOldLockfile();
        maybeLock.has_value() )
     {
       registries["lockfile"]          = maybeLock->getRegistryRaw();
@@ -243,6 +518,7 @@ ManifestCommand::ManifestCommand() : parser( "manifest" ), cmdLock(), cmdDiff()
 {
   this->parser.add_description( "Manifest subcommands" );
   this->parser.add_subparser( this->cmdLock.getParser() );
+  this->parser.add_subparser( this->cmdLockMany.getParser() );
   this->parser.add_subparser( this->cmdDiff.getParser() );
   this->parser.add_subparser( this->cmdRegistry.getParser() );
   this->parser.add_subparser( this->cmdUpdate.getParser() );
@@ -258,6 +534,10 @@ ManifestCommand::run()
     {
       return this->cmdLock.run();
     }
+  if ( this->parser.is_subcommand_used( "lock-many" ) )
+    {
+      return this->cmdLockMany.run();
+    }
   if ( this->parser.is_subcommand_used( "diff" ) )
     {
       return this->cmdDiff.run();
@@ -17,14 +17,19 @@
 #include <utility>
 #include <vector>
 
+#include <nix/error.hh>
 #include <nix/flake/flakeref.hh>
+#include <nix/hash.hh>
+#include <nix/logging.hh>
 #include <nix/ref.hh>
 #include <nlohmann/json.hpp>
+#include <sqlite3pp.hh>
 
 #include "flox/core/types.hh"
 #include "flox/pkgdb/input.hh"
 #include "flox/pkgdb/pkg-query.hh"
 #include "flox/pkgdb/read.hh"
+#include "flox/pkgdb/write.hh"
 #include "flox/registry.hh"
 #include "flox/resolver/descriptor.hh"
 #include "flox/resolver/environment.hh"
@@ -48,46 +53,117 @@ namespace flox::resolver {
 
 /* -------------------------------------------------------------------------- */
 
-RegistryRaw &
-Environment::getCombinedRegistryRaw()
+RegistryRaw
+Environment::getPinnedRegistryRaw( RegistryRaw & unpinned )
 {
-  if ( ! this->combinedRegistryRaw.has_value() )
+  /* Start with the global manifest's registry ( if any ), and merge it with
+   * the environment manifest's registry. */
+  RegistryRaw combined;
+  if ( auto maybeGlobal = this->getGlobalManifest(); maybeGlobal.has_value() )
     {
-      /* Start with the global manifest's registry ( if any ), and merge it with
-       * the environment manifest's registry. */
-      if ( auto maybeGlobal = this->getGlobalManifest();
-           maybeGlobal.has_value() )
-        {
-          this->combinedRegistryRaw = maybeGlobal->getLockedRegistry();
-          this->combinedRegistryRaw->merge(
-            this->getManifest().getLockedRegistry() );
-        }
-      else
+      combined = maybeGlobal->getRegistryRaw();
+      combined.merge( this->getManifest().getRegistryRaw() );
+    }
+  else { combined = this->getManifest().getRegistryRaw(); }
+
+  /* If there's a lockfile, use pinned inputs.
+   * However, do not preserve any inputs that were removed from
+   * the manifest. */
+  unpinned = combined;
+  unpinned.inputs.clear();
+  unpinned.priority.clear();
+  const auto & maybeLock = this->getOldLockfile();
+  for ( auto & [name, input] : combined.inputs )
+    {
+      /* Use the pinned input from the lock if it exists. */
+      if ( maybeLock.has_value() )
         {
-          this->combinedRegistryRaw = this->getManifest().getLockedRegistry();
+          const auto & lockedRegistry = maybeLock->getRegistryRaw();
+          if ( auto locked = lockedRegistry.inputs.find( name );
+               locked != lockedRegistry.inputs.end() )
+            {
+              input = locked->second;
+              continue;
+            }
         }
+      unpinned.inputs.emplace( name, input );
+    }
+  return combined;
+}
 
-      /* If there's a lockfile, use pinned inputs.
-       * However, do not preserve any inputs that were removed from
-       * the manifest. */
-      if ( auto maybeLock = this->getOldLockfile(); maybeLock.has_value() )
+
+/* -------------------------------------------------------------------------- */
+
+RegistryRaw &
+Environment::getCombinedRegistryRaw()
+{
+  if ( ! this->combinedRegistryRaw.has_value() )
+    {
+      /* Only inputs which aren't pinned are locked, so a fully locked
+       * environment doesn't need to lock any flakes. */
+      RegistryRaw unpinned;
+      RegistryRaw combined = this->getPinnedRegistryRaw( unpinned );
+      if ( ! unpinned.inputs.empty() )
         {
-          auto lockedRegistry = maybeLock->getRegistryRaw();
-          for ( auto & [name, input] : this->combinedRegistryRaw->inputs )
+          for ( auto & [name, input] :
+                lockRegistry( unpinned,
+                              this->getStore(),
+                              ! this->cache->prefetched )
+                  .inputs )
             {
-              /* Use the pinned input from the lock if it exists. */
-              if ( auto locked = lockedRegistry.inputs.find( name );
-                   locked != lockedRegistry.inputs.end() )
-                {
-                  input = locked->second;
-                }
+              combined.inputs.at( name ) = std::move( input );
             }
         }
+
+      this->combinedRegistryRaw = std::move( combined );
     }
   return *this->combinedRegistryRaw;
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+RegistryRaw
+Environment::getPrefetchRegistryRaw()
+{
+  RegistryRaw unpinned;
+  RegistryRaw pinned = this->getPinnedRegistryRaw( unpinned );
+
+  /* Pinned inputs with known fingerprints are only fetched if scraped. */
+  nix::ref<nix::Store>     store = this->getStore();
+  pkgdb::PkgDbInputFactory factory( store );
+  this->addLockedFingerprints( factory );
+
+  RegistryRaw prefetch;
+  for ( const auto & [name, input] : pinned.inputs )
+    {
+      if ( ( input.from == nullptr ) || factory.hasFingerprint( *input.from ) )
+        {
+          continue;
+        }
+      prefetch.inputs.emplace( input.from->to_string(), input );
+    }
+  return prefetch;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void
+Environment::addLockedFingerprints( pkgdb::PkgDbInputFactory & factory )
+{
+  const auto & oldLockfile = this->getOldLockfile();
+  if ( ! oldLockfile.has_value() ) { return; }
+  for ( const auto & [fingerprint, input] :
+        oldLockfile->getPackagesRegistryRaw().inputs )
+    {
+      factory.addFingerprint(
+        *input.getFlakeRef(),
+        nix::Hash::parseNonSRIUnprefixed( fingerprint, nix::htSHA256 ) );
+    }
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 nix::ref<Registry<pkgdb::PkgDbInputFactory>>
@@ -95,16 +171,27 @@ Environment::getPkgDbRegistry()
 {
   if ( this->dbs == nullptr )
     {
-      nix::ref<nix::Store> store   = this->getStore();
-      auto                 factory = pkgdb::PkgDbInputFactory( store );
+      nix::ref<nix::Store> store = this->getStore();
+      auto factory = pkgdb::PkgDbInputFactory( store, this->cache->inputs );
+      this->addLockedFingerprints( factory );
+
+      /* Inputs with known fingerprints are only fetched if scraped. */
+      if ( ! this->cache->prefetched )
+        {
+          RegistryRaw unknown = this->getCombinedRegistryRaw();
+          std::erase_if(
+            unknown.inputs,
+            [&]( const auto & pair )
+            {
+              return ( pair.second.from == nullptr )
+                     || factory.hasFingerprint( *pair.second.from );
+            } );
+          prefetchRegistryInputs( unknown, store );
+        }
       this->dbs = std::make_shared<Registry<pkgdb::PkgDbInputFactory>>(
         this->getCombinedRegistryRaw(),
         factory );
-      /* Scrape if needed. */
-      for ( auto & [name, input] : *this->dbs )
-        {
-          input->scrapeSystems( this->getSystems() );
-        }
+      /* Inputs are scraped lazily by `tryResolveGroupIn'. */
     }
   return static_cast<nix::ref<Registry<pkgdb::PkgDbInputFactory>>>( this->dbs );
 }
@@ -147,12 +234,11 @@ Environment::groupIsLocked( const InstallDescriptors & group,
                             const Lockfile &           oldLockfile,
                             const System &             system ) const
 {
-  auto packages = oldLockfile.getLockfileRaw().packages;
-  if ( ! packages.contains( system ) ) { return false; }
-
-  SystemPackages oldSystemPackages = packages.at( system );
+  const SystemPackages * oldSystemPackages
+    = oldLockfile.getSystemPackages( system );
+  if ( oldSystemPackages == nullptr ) { return false; }
 
-  InstallDescriptors oldDescriptors = oldLockfile.getDescriptors();
+  const InstallDescriptors & oldDescriptors = oldLockfile.getDescriptors();
 
   /* Check for upgrades. */
   for ( auto & [iid, descriptor] : group )
@@ -169,7 +255,8 @@ Environment::groupIsLocked( const InstallDescriptors & group,
         {
           /* If the current iid is being upgraded, the group needs to be
            * locked again. */
-          auto upgrades = std::get<std::vector<InstallID>>( this->upgrades );
+          const auto & upgrades
+            = std::get<std::vector<InstallID>>( this->upgrades );
           if ( std::find( upgrades.begin(), upgrades.end(), iid )
                != upgrades.end() )
             {
@@ -212,8 +299,8 @@ Environment::groupIsLocked( const InstallDescriptors & group,
         }
 
       /* Check if the descriptor exists in the lockfile lock */
-      if ( auto oldLockedPackagePair = oldSystemPackages.find( iid );
-           oldLockedPackagePair == oldSystemPackages.end() )
+      if ( auto oldLockedPackagePair = oldSystemPackages->find( iid );
+           oldLockedPackagePair == oldSystemPackages->end() )
         {
           /* If the descriptor doesn't even exist in the lockfile lock, it needs
            * to be locked again.
@@ -239,21 +326,20 @@ Environment::groupIsLocked( const InstallDescriptors & group,
 std::vector<InstallDescriptors>
 Environment::getUnlockedGroups( const System & system )
 {
-  auto lockfile           = this->getOldLockfile();
-  auto groupedDescriptors = this->getManifest().getGroupedDescriptors();
+  const auto & lockfile           = this->getOldLockfile();
+  const auto & groupedDescriptors = this->getManifest().getGroupedDescriptors();
   if ( ! lockfile.has_value() ) { return groupedDescriptors; }
 
-  for ( auto group = groupedDescriptors.begin();
-        group != groupedDescriptors.end(); )
+  std::vector<InstallDescriptors> unlocked;
+  for ( const auto & group : groupedDescriptors )
     {
-      if ( groupIsLocked( *group, *lockfile, system ) )
+      if ( ! groupIsLocked( group, *lockfile, system ) )
         {
-          group = groupedDescriptors.erase( group );
+          unlocked.emplace_back( group );
         }
-      else { ++group; }
     }
 
-  return groupedDescriptors;
+  return unlocked;
 }
 
 
@@ -262,23 +348,20 @@ Environment::getUnlockedGroups( const System & system )
 std::vector<InstallDescriptors>
 Environment::getLockedGroups( const System & system )
 {
-  auto lockfile = this->getOldLockfile();
+  const auto & lockfile = this->getOldLockfile();
   if ( ! lockfile.has_value() ) { return std::vector<InstallDescriptors> {}; }
 
-  auto groupedDescriptors = this->getManifest().getGroupedDescriptors();
-
-  /* Remove all groups that are *not* already locked. */
-  for ( auto group = groupedDescriptors.begin();
-        group != groupedDescriptors.end(); )
+  /* Collect all groups that are already locked. */
+  std::vector<InstallDescriptors> locked;
+  for ( const auto & group : this->getManifest().getGroupedDescriptors() )
     {
-      if ( ! groupIsLocked( *group, *lockfile, system ) )
+      if ( groupIsLocked( group, *lockfile, system ) )
         {
-          group = groupedDescriptors.erase( group );
+          locked.emplace_back( group );
         }
-      else { ++group; }
     }
 
-  return groupedDescriptors;
+  return locked;
 }
 
 
@@ -328,11 +411,27 @@ Environment::getCombinedBaseQueryArgs()
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+pkgdb::PkgQueryArgs
+Environment::getDescriptorQueryArgs( const ManifestDescriptor & descriptor,
+                                     const pkgdb::PkgDbInput &  input,
+                                     const System &             system )
+{
+  pkgdb::PkgQueryArgs args = this->getCombinedBaseQueryArgs();
+  input.fillPkgQueryArgs( args );
+  descriptor.fillPkgQueryArgs( args );
+  /* Limit results to the target system. */
+  args.systems = std::vector<System> { system };
+  return args;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 std::optional<pkgdb::row_id>
 Environment::tryResolveDescriptorIn( const ManifestDescriptor & descriptor,
-                                     const pkgdb::PkgDbInput &  input,
+                                     pkgdb::PkgDbInput &        input,
                                      const System &             system )
 {
   /* Skip unrequested systems. */
@@ -345,11 +444,10 @@ Environment::tryResolveDescriptorIn( const ManifestDescriptor & descriptor,
       return std::nullopt;
     }
 
-  pkgdb::PkgQueryArgs args = this->getCombinedBaseQueryArgs();
-  input.fillPkgQueryArgs( args );
-  descriptor.fillPkgQueryArgs( args );
-  /* Limit results to the target system. */
-  args.systems = std::vector<System> { system };
+  pkgdb::PkgQueryArgs args
+    = this->getDescriptorQueryArgs( descriptor, input, system );
+  if ( ! input.mayHaveMatches( args ) ) { return std::nullopt; }
+  input.scrapeForQuery( args );
   pkgdb::PkgQuery query( args );
   auto            rows = query.execute( input.getDbReadOnly()->db );
   if ( rows.empty() ) { return std::nullopt; }
@@ -388,19 +486,19 @@ Environment::getGroupInput( const InstallDescriptors & group,
                             const Lockfile &           oldLockfile,
                             const System &             system ) const
 {
-  auto packages = oldLockfile.getLockfileRaw().packages;
-  if ( ! packages.contains( system ) ) { return std::nullopt; }
-  SystemPackages oldSystemPackages = packages.at( system );
+  const SystemPackages * oldSystemPackages
+    = oldLockfile.getSystemPackages( system );
+  if ( oldSystemPackages == nullptr ) { return std::nullopt; }
 
-  InstallDescriptors oldDescriptors = oldLockfile.getDescriptors();
+  const InstallDescriptors & oldDescriptors = oldLockfile.getDescriptors();
 
   std::optional<LockedInputRaw> wrongGroupInput;
   /* We could look for packages where just the _iid_ has changed, but for now
    * just use _iid_. */
   for ( const auto & [iid, descriptor] : group )
     {
-      if ( auto it = oldSystemPackages.find( iid );
-           it != oldSystemPackages.end() )
+      if ( auto it = oldSystemPackages->find( iid );
+           it != oldSystemPackages->end() )
         {
           auto & [_, maybeLockedPackage] = *it;
           if ( maybeLockedPackage.has_value() )
@@ -457,6 +555,69 @@ Environment::getGroupInput( const InstallDescriptors & group,
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+nix::ref<pkgdb::PkgDbInput>
+Environment::getLockedInput( const LockedInputRaw & lockedInput )
+{
+  std::string key = lockedInput.url + "#"
+                    + lockedInput.fingerprint.to_string( nix::Base16, false );
+
+  if ( auto cached = this->cache->lockedInputs.find( key );
+       cached != this->cache->lockedInputs.end() )
+    {
+      return static_cast<nix::ref<pkgdb::PkgDbInput>>( cached->second );
+    }
+
+  /* Reuse an input from the combined registry if it has the same
+   * fingerprint, but don't force the registry to be initialized. */
+  std::shared_ptr<pkgdb::PkgDbInput> input;
+  if ( this->dbs != nullptr )
+    {
+      for ( const auto & [_, dbInput] : *this->dbs )
+        {
+          if ( dbInput->getDbReadOnly()->fingerprint
+               == lockedInput.fingerprint )
+            {
+              input = dbInput;
+              break;
+            }
+        }
+    }
+
+  /* The fingerprint is known so the flake is only locked if its database
+   * needs to be scraped. */
+  if ( input == nullptr )
+    {
+      RegistryInput registryInput( lockedInput );
+      /* Reuse subtrees from the old lockfile's registry to avoid evaluating
+       * the flake to detect them. */
+      if ( const auto & oldLockfile = this->getOldLockfile();
+           oldLockfile.has_value() )
+        {
+          for ( const auto & [_, pinned] :
+                oldLockfile->getRegistryRaw().inputs )
+            {
+              if ( pinned.subtrees.has_value()
+                   && ( *pinned.getFlakeRef()
+                        == *registryInput.getFlakeRef() ) )
+                {
+                  registryInput.subtrees = pinned.subtrees;
+                  break;
+                }
+            }
+        }
+      nix::ref<nix::Store> store = this->getStore();
+      input = std::make_shared<pkgdb::PkgDbInput>( store,
+                                                   registryInput,
+                                                   lockedInput.fingerprint );
+    }
+
+  this->cache->lockedInputs.emplace( std::move( key ), input );
+  return static_cast<nix::ref<pkgdb::PkgDbInput>>( input );
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 ResolutionResult
@@ -471,16 +632,14 @@ Environment::tryResolveGroup( const InstallDescriptors & group,
    * input+rev try to use it to resolve the group.
    * If we fail collect a list of failed descriptors; presumably these are
    * new group members. */
-  std::optional<pkgdb::PkgDbInput> oldGroupInput;
-  if ( auto oldLockfile = this->getOldLockfile(); oldLockfile.has_value() )
+  std::shared_ptr<pkgdb::PkgDbInput> oldGroupInput;
+  if ( const auto & oldLockfile = this->getOldLockfile();
+       oldLockfile.has_value() )
     {
-      auto lockedInput
-        = getGroupInput( group, *this->getOldLockfile(), system );
+      auto lockedInput = getGroupInput( group, *oldLockfile, system );
       if ( lockedInput.has_value() )
         {
-          RegistryInput        registryInput( *lockedInput );
-          nix::ref<nix::Store> store = this->getStore();
-          oldGroupInput = pkgdb::PkgDbInput( store, registryInput );
+          oldGroupInput = this->getLockedInput( *lockedInput );
 
           auto maybeResolved
             = this->tryResolveGroupIn( group, *oldGroupInput, system );
@@ -515,7 +674,9 @@ Environment::tryResolveGroup( const InstallDescriptors & group,
   for ( const auto & [_, input] : *this->getPkgDbRegistry() )
     {
       /* If we already tried to resolve in this input - skip it. */
-      if ( ! oldGroupInput.has_value() || ( ( *input ) == ( *oldGroupInput ) ) )
+      if ( ( oldGroupInput == nullptr )
+           || ( input->getDbReadOnly()->fingerprint
+                != oldGroupInput->getDbReadOnly()->fingerprint ) )
         {
           {
             auto maybeResolved
@@ -548,11 +709,20 @@ Environment::tryResolveGroup( const InstallDescriptors & group,
 
 std::variant<InstallID, SystemPackages>
 Environment::tryResolveGroupIn( const InstallDescriptors & group,
-                                const pkgdb::PkgDbInput &  input,
+                                pkgdb::PkgDbInput &        input,
                                 const System &             system )
 {
   std::unordered_map<InstallID, std::optional<pkgdb::row_id>> pkgRows;
 
+  /* Collect queries for requested descriptors which haven't been resolved in
+   * this input yet so they may be resolved together in a single statement.
+   * Queries are resolved for all systems at once so that locking the
+   * remaining systems can reuse these results. */
+  std::string fingerprint
+    = input.getDbReadOnly()->fingerprint.to_string( nix::Base16, false );
+  std::vector<std::pair<InstallID, std::string>> iidKeys;
+  std::vector<std::string>                       pendingKeys;
+  std::vector<pkgdb::PkgQueryArgs>               queries;
   for ( const auto & [iid, descriptor] : group )
     {
       /* Skip unrequested systems. */
@@ -565,11 +735,80 @@ Environment::tryResolveGroupIn( const InstallDescriptors & group,
           pkgRows.emplace( iid, std::nullopt );
           continue;
         }
+      pkgdb::PkgQueryArgs args
+        = this->getDescriptorQueryArgs( descriptor, input, system );
+      args.systems      = this->getSystems();
+      std::string dbKey = pkgdb::getQueryCacheKey( args );
+      std::string key   = fingerprint + ":" + dbKey;
+      iidKeys.emplace_back( iid, key );
+      if ( this->cache->resolutions.contains( key )
+           || ( std::find( pendingKeys.begin(), pendingKeys.end(), dbKey )
+                != pendingKeys.end() ) )
+        {
+          continue;
+        }
+
+      /* Skip queries for names that this input doesn't have. */
+      if ( ! input.mayHaveMatches( args ) )
+        {
+          this->cache->resolutions.try_emplace( key );
+          continue;
+        }
+
+      /* Reuse results memoized by an earlier run. */
+      if ( auto cached = input.getDbReadOnly()->getCachedQuery( dbKey );
+           cached.has_value() )
+        {
+          this->cache->resolutions.emplace( key, std::move( *cached ) );
+        }
+      else
+        {
+          pendingKeys.emplace_back( dbKey );
+          queries.emplace_back( std::move( args ) );
+        }
+    }
+
+  /* Try resolving. */
+  if ( ! queries.empty() )
+    {
+      /* Only scrape prefixes that these queries actually search. */
+      for ( const auto & query : queries ) { input.scrapeForQuery( query ); }
+
+      pkgdb::PkgQueryBatch batch( std::move( queries ) );
+      auto rows = batch.executeBySystem( input.getDbReadOnly()->db );
+      for ( size_t idx = 0; idx < pendingKeys.size(); ++idx )
+        {
+          this->cache->resolutions.emplace(
+            fingerprint + ":" + pendingKeys.at( idx ),
+            rows.at( idx ) );
+        }
 
-      /* Try resolving. */
-      std::optional<pkgdb::row_id> maybeRow
-        = this->tryResolveDescriptorIn( descriptor, input, system );
-      if ( maybeRow.has_value() || descriptor.optional )
+      /* Persist results for later runs once locking is done. */
+      auto        dbRO   = input.getDbReadOnly();
+      std::string dbPath = dbRO->dbPath.string();
+      auto        itr    = this->pendingQueries.find( dbPath );
+      if ( itr == this->pendingQueries.end() )
+        {
+          itr = this->pendingQueries
+                  .emplace( dbPath, PendingQueries { dbRO->fingerprint, {} } )
+                  .first;
+        }
+      for ( size_t idx = 0; idx < pendingKeys.size(); ++idx )
+        {
+          itr->second.results.emplace_back( pendingKeys.at( idx ),
+                                            rows.at( idx ) );
+        }
+    }
+
+  for ( const auto & [iid, key] : iidKeys )
+    {
+      std::optional<pkgdb::row_id> maybeRow;
+      const auto & resolved = this->cache->resolutions.at( key );
+      if ( auto row = resolved.find( system ); row != resolved.end() )
+        {
+          maybeRow = row->second;
+        }
+      if ( maybeRow.has_value() || group.at( iid ).optional )
         {
           pkgRows.emplace( iid, maybeRow );
         }
@@ -607,6 +846,7 @@ Environment::lockSystem( const System & system )
   assert( this->lockfileRaw.has_value() );
   SystemPackages pkgs;
 
+  /* Inputs are only initialized and scraped if a group needs resolving. */
   auto groups = this->getUnlockedGroups( system );
 
   /* Try resolving unresolved groups. */
@@ -661,21 +901,18 @@ Environment::lockSystem( const System & system )
   /* Copy over old lockfile entries we want to keep.
    * Make sure to update the priority if the entry was copied over from
    * the old. */
-  if ( auto oldLockfile = this->getOldLockfile();
-       oldLockfile.has_value()
-       && oldLockfile->getLockfileRaw().packages.contains( system ) )
+  if ( const auto & oldLockfile = this->getOldLockfile();
+       oldLockfile.has_value() )
     {
-      SystemPackages systemPackages
-        = oldLockfile->getLockfileRaw().packages.at( system );
-      auto oldDescriptors = oldLockfile->getDescriptors();
       for ( const auto & group : this->getLockedGroups( system ) )
         {
           for ( const auto & [iid, descriptor] : group )
             {
-              if ( auto oldLockedPackagePair = systemPackages.find( iid );
-                   oldLockedPackagePair != systemPackages.end() )
+              if ( const auto * oldLockedPackage
+                   = oldLockfile->getLockedPackage( system, iid );
+                   oldLockedPackage != nullptr )
                 {
-                  pkgs.emplace( *oldLockedPackagePair );
+                  pkgs.emplace( iid, *oldLockedPackage );
                   pkgs.at( iid )->priority = descriptor.priority;
                 }
             }
@@ -686,6 +923,35 @@ Environment::lockSystem( const System & system )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+void
+Environment::saveQueryResults()
+{
+  /* Databases are opened by their fingerprint to avoid locking flakes. */
+  for ( const auto & [dbPath, pending] : this->pendingQueries )
+    {
+      try
+        {
+          pkgdb::PkgDb           dbRW( pending.fingerprint, dbPath );
+          sqlite3pp::transaction txn( dbRW.db, false, true );
+          for ( const auto & [key, rows] : pending.results )
+            {
+              dbRW.cacheQuery( key, rows );
+            }
+          txn.commit();
+        }
+      catch ( const std::exception & err )
+        {
+          nix::warn( "failed to save query results to '%s': %s",
+                     dbPath,
+                     err.what() );
+        }
+    }
+  this->pendingQueries.clear();
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 Lockfile
@@ -696,10 +962,15 @@ Environment::createLockfile()
       this->lockfileRaw           = LockfileRaw {};
       this->lockfileRaw->manifest = this->getManifestRaw();
       this->lockfileRaw->registry = this->getCombinedRegistryRaw();
+      this->lockfileRaw->inputsHash
+        = getLockfileInputsHash( this->getManifestRaw(),
+                                 this->getGlobalManifestRaw(),
+                                 this->getSystems() );
       for ( const auto & system : this->getSystems() )
         {
           this->lockSystem( system );
         }
+      this->saveQueryResults();
     }
   Lockfile lockfile( *this->lockfileRaw );
   lockfile.removeUnusedInputs();
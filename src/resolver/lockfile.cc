@@ -26,7 +26,7 @@ namespace flox::resolver {
 void
 LockfileRaw::check() const
 {
-  if ( this->lockfileVersion != 0 )
+  if ( LOCKFILE_VERSION < this->lockfileVersion )
     {
       throw InvalidLockfileException(
         "unsupported lockfile version "
@@ -64,7 +64,7 @@ Lockfile::checkGroups() const
                   continue;
                 }
 
-              auto maybeLocked = maybeSystem->second.at( iid );
+              const auto & maybeLocked = maybeSystem->second.at( iid );
 
               /* Package was unresolved, we don't enforce `optional' here. */
               if ( ! maybeLocked.has_value() ) { continue; }
@@ -169,6 +169,30 @@ Lockfile::Lockfile( std::filesystem::path lockfilePath )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+const SystemPackages *
+Lockfile::getSystemPackages( const System & system ) const
+{
+  auto maybeSystem = this->lockfileRaw.packages.find( system );
+  if ( maybeSystem == this->lockfileRaw.packages.end() ) { return nullptr; }
+  return &maybeSystem->second;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+const std::optional<LockedPackageRaw> *
+Lockfile::getLockedPackage( const System & system, const InstallID & iid ) const
+{
+  const SystemPackages * packages = this->getSystemPackages( system );
+  if ( packages == nullptr ) { return nullptr; }
+  auto maybeLocked = packages->find( iid );
+  if ( maybeLocked == packages->end() ) { return nullptr; }
+  return &maybeLocked->second;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 void
@@ -337,7 +361,8 @@ LockfileRaw::clear()
   this->manifest.clear();
   this->registry.clear();
   this->packages        = std::unordered_map<System, SystemPackages> {};
-  this->lockfileVersion = 0;
+  this->lockfileVersion = LOCKFILE_VERSION;
+  this->inputsHash      = std::nullopt;
 }
 
 
@@ -417,6 +442,19 @@ from_json( const nlohmann::json & jfrom, LockfileRaw & raw )
                                               extract_json_errmsg( err ) );
             }
         }
+      else if ( key == "inputs-hash" )
+        {
+          try
+            {
+              raw.inputsHash = value.get<std::string>();
+            }
+          catch ( nlohmann::json::exception & err )
+            {
+              throw InvalidLockfileException( "couldn't parse lockfile field `"
+                                                + key + "'",
+                                              extract_json_errmsg( err ) );
+            }
+        }
       else
         {
           throw InvalidLockfileException( "encountered unexpected field `" + key
@@ -433,6 +471,29 @@ to_json( nlohmann::json & jto, const LockfileRaw & raw )
           { "registry", raw.registry },
           { "packages", raw.packages },
           { "lockfile-version", raw.lockfileVersion } };
+  if ( raw.inputsHash.has_value() ) { jto["inputs-hash"] = *raw.inputsHash; }
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::string
+getLockfileInputsHash(
+  const ManifestRaw &                      manifest,
+  const std::optional<GlobalManifestRaw> & globalManifest,
+  const std::vector<System> &              systems )
+{
+  /* Object keys are sorted, so equivalent manifests dump identically. */
+  nlohmann::json inputs = { { "lockfile-version", LOCKFILE_VERSION },
+                            { "manifest", manifest },
+                            { "global-manifest", nullptr },
+                            { "systems", systems } };
+  if ( globalManifest.has_value() )
+    {
+      inputs["global-manifest"] = *globalManifest;
+    }
+  return nix::hashString( nix::htSHA256, inputs.dump() )
+    .to_string( nix::Base16, false );
 }
 
 
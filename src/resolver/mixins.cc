@@ -248,12 +248,68 @@ EnvironmentMixin::getEnvironment()
       this->environment
         = std::make_optional<Environment>( this->getGlobalManifest(),
                                            this->getManifest(),
-                                           this->getLockfile() );
+                                           this->getLockfile(),
+                                           false,
+                                           this->environmentCache );
     }
   return *this->environment;
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+void
+EnvironmentMixin::setEnvironmentCache( std::shared_ptr<EnvironmentCache> cache )
+{
+  if ( this->environment.has_value() )
+    {
+      throw EnvironmentMixinException(
+        "`environmentCache' cannot be initialized after `environment'" );
+    }
+  this->environmentCache = std::move( cache );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+std::string
+EnvironmentMixin::getInputsHash()
+{
+  std::optional<GlobalManifestRaw> globalManifestRaw;
+  if ( auto globalManifest = this->getGlobalManifest();
+       globalManifest.has_value() )
+    {
+      globalManifestRaw = globalManifest->getManifestRaw();
+    }
+  const EnvironmentManifest & manifest = this->getManifest();
+  return getLockfileInputsHash( manifest.getManifestRaw(),
+                                globalManifestRaw,
+                                manifest.getSystems() );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool
+EnvironmentMixin::hasCurrentLockfile()
+{
+  const auto & oldLockfileRaw = this->getLockfileRaw();
+  return oldLockfileRaw.has_value() && oldLockfileRaw->inputsHash.has_value()
+         && ( *oldLockfileRaw->inputsHash == this->getInputsHash() );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+LockfileRaw
+EnvironmentMixin::lockEnvironment()
+{
+  /* Reuse the old lockfile if it was created from identical manifests. */
+  if ( this->hasCurrentLockfile() ) { return *this->getLockfileRaw(); }
+  return this->getEnvironment().createLockfile().getLockfileRaw();
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 argparse::Argument &
@@ -172,6 +172,8 @@ SearchCommand::run()
         *this->getEnvironment().getPkgDbRegistry() )
     {
       this->params.query.fillPkgQueryArgs( args );
+      if ( ! input->mayHaveMatches( args ) ) { continue; }
+      input->scrapeForQuery( args );
       auto query = pkgdb::PkgQuery( args );
       auto dbRO  = input->getDbReadOnly();
       for ( const auto & row : query.execute( dbRO->db ) )
@@ -0,0 +1,140 @@
+/* ========================================================================== *
+ *
+ * @file tests/bench-package-row.cc
+ *
+ * @brief Measures the per-package cost of extracting metadata for
+ *        `pkgdb scrape`.
+ *
+ * Compares reading each field through @a flox::FlakePackage, as scraping
+ * previously did, against the single pass performed by
+ * @a flox::pkgdb::mkPackageRow.
+ *
+ * Usage: `bench-package-row [COUNT [ROUNDS]]`.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <nix/eval-cache.hh>
+#include <nix/flake/flake.hh>
+#include <nix/globals.hh>
+
+#include "flox/core/nix-state.hh"
+#include "flox/flake-package.hh"
+#include "flox/flox-flake.hh"
+#include "flox/pkgdb/write.hh"
+#include "test.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @brief Extract metadata using `FlakePackage` getters. */
+static void
+extractFlakePackage( const flox::Cursor & cursor )
+{
+  flox::FlakePackage pkg( cursor, { "packages", "x86_64-linux", "phony" } );
+  (void) pkg.getOutputs();
+  (void) pkg.getOutputsToInstall();
+  (void) pkg.getLicense();
+  (void) pkg.isBroken();
+  (void) pkg.isUnfree();
+  (void) pkg.getDescription();
+}
+
+
+/** @brief Extract metadata using `mkPackageRow`. */
+static void
+extractPackageRow( const flox::Cursor & cursor )
+{
+  (void) flox::pkgdb::mkPackageRow( 0, "phony", cursor, false );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @return Mean nanoseconds spent running @a extract on each package. */
+template<typename Extract>
+static long long
+measure( const std::vector<flox::Cursor> & pkgs,
+         std::size_t                       rounds,
+         Extract &&                        extract )
+{
+  auto start = std::chrono::steady_clock::now();
+  for ( std::size_t round = 0; round < rounds; ++round )
+    {
+      for ( const auto & cursor : pkgs ) { extract( cursor ); }
+    }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed )
+           .count()
+         / static_cast<long long>( pkgs.size() * rounds );
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+main( int argc, char * argv[] )
+{
+  std::size_t count  = 1000;
+  std::size_t rounds = 10;
+  if ( 1 < argc ) { count = std::stoul( argv[1] ); }
+  if ( 2 < argc ) { rounds = std::stoul( argv[2] ); }
+
+  nix::verbosity = nix::lvlWarn;
+
+  /* Initialize `nix' */
+  flox::NixState nstate;
+
+  nix::FlakeRef   ref = nix::parseFlakeRef( nixpkgsRef );
+  flox::FloxFlake flake( nstate.getState(), ref );
+
+  flox::Cursor root = flake.openCursor(
+    flox::AttrPath { "legacyPackages", nix::settings.thisSystem.get() } );
+
+  /* Collect packages, forcing their fields so that both extractors measure
+   * cursor traversal rather than evaluation. */
+  std::vector<flox::Cursor> pkgs;
+  for ( const nix::Symbol & aname : root->getAttrs() )
+    {
+      if ( count <= pkgs.size() ) { break; }
+      try
+        {
+          flox::Cursor child = root->getAttr( aname );
+          if ( ! child->isDerivation() ) { continue; }
+          extractFlakePackage( child );
+          pkgs.emplace_back( std::move( child ) );
+        }
+      catch ( const nix::Error & )
+        {}
+    }
+
+  if ( pkgs.empty() )
+    {
+      std::cerr << "ERROR: No packages were found." << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  std::cout << "packages: " << pkgs.size() << ", rounds: " << rounds
+            << std::endl
+            << "FlakePackage: "
+            << measure( pkgs, rounds, extractFlakePackage ) << " ns/package"
+            << std::endl
+            << "mkPackageRow: "
+            << measure( pkgs, rounds, extractPackageRow ) << " ns/package"
+            << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
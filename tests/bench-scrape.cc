@@ -0,0 +1,132 @@
+/* ========================================================================== *
+ *
+ * @file tests/bench-scrape.cc
+ *
+ * @brief Measures the time spent scraping a prefix of `nixpkgs` with each
+ *        @a flox::eval_cache_mode, along with the growth of `nix`'s
+ *        eval cache.
+ *
+ * Each mode should be measured in a separate process so that evaluation
+ * isn't shared between runs, for example:
+ * ```
+ * $ for mode in rw warm none; do tests/bench-scrape "$mode"; done
+ * ```
+ *
+ * Usage: `bench-scrape [rw|warm|none [ATTR-PATH...]]`, where `ATTR-PATH`
+ * defaults to `legacyPackages <SYSTEM>`.
+ *
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include <nix/eval-cache.hh>
+#include <nix/flake/flake.hh>
+#include <nix/globals.hh>
+
+#include "flox/core/nix-state.hh"
+#include "flox/flox-flake.hh"
+#include "flox/pkgdb/package-writer.hh"
+#include "flox/pkgdb/write.hh"
+#include "test.hh"
+
+
+/* -------------------------------------------------------------------------- */
+
+/** @return The size of a file in bytes, or 0 if it doesn't exist. */
+static std::uintmax_t
+fileSize( const std::filesystem::path & path )
+{
+  std::error_code ec;
+  auto            size = std::filesystem::file_size( path, ec );
+  return ec ? 0 : size;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int
+main( int argc, char * argv[] )
+{
+  std::string mode = ( 1 < argc ) ? argv[1] : "rw";
+  if ( mode == "rw" ) { flox::evalCacheMode = flox::ECM_READ_WRITE; }
+  else if ( mode == "warm" ) { flox::evalCacheMode = flox::ECM_WARM; }
+  else if ( mode == "none" ) { flox::evalCacheMode = flox::ECM_NONE; }
+  else
+    {
+      std::cerr << "ERROR: Unknown eval cache mode: " << mode << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  nix::verbosity = nix::lvlWarn;
+
+  /* Initialize `nix' */
+  flox::NixState nstate;
+
+  flox::AttrPath prefix;
+  for ( int idx = 2; idx < argc; ++idx ) { prefix.emplace_back( argv[idx] ); }
+  if ( prefix.empty() )
+    {
+      prefix = { "legacyPackages", nix::settings.thisSystem.get() };
+    }
+
+  std::filesystem::path tmpDir = nix::createTempDir();
+  std::filesystem::path dbPath = tmpDir / "bench.sqlite";
+  std::filesystem::path cachePath;
+  std::uintmax_t        cacheBefore = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    nix::FlakeRef   ref = nix::parseFlakeRef( nixpkgsRef );
+    flox::FloxFlake flake( nstate.getState(), ref );
+
+    cachePath
+      = flox::getEvalCachePath( flake.lockedFlake.getFingerprint() );
+    cacheBefore = fileSize( cachePath );
+
+    flox::pkgdb::PkgDb db( flake.lockedFlake, dbPath.string() );
+
+    flox::pkgdb::Todos todo;
+    todo.emplace( std::make_tuple( prefix,
+                                   flake.openCursor( prefix ),
+                                   db.addOrGetAttrSetId( prefix ) ) );
+
+    sqlite3pp::transaction     txn( db.db, false, true );
+    flox::pkgdb::PackageWriter writer( db );
+    flox::pkgdb::EvalWatchdog  watchdog( std::nullopt, std::nullopt );
+    while ( ! todo.empty() )
+      {
+        db.scrape( flake.state->symbols, todo.front(), todo, writer, watchdog );
+        todo.pop();
+      }
+    writer.finish();
+    txn.commit();
+    /* The eval cache is committed when `flake' is destroyed. */
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "mode: " << mode << std::endl
+            << "prefix: " << nix::concatStringsSep( ".", prefix ) << std::endl
+            << "scrape: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>( elapsed )
+                 .count()
+            << " ms" << std::endl
+            << "pkgdb: " << fileSize( dbPath ) << " bytes" << std::endl
+            << "eval cache: " << cacheBefore << " -> " << fileSize( cachePath )
+            << " bytes" << std::endl;
+
+  std::filesystem::remove_all( tmpDir );
+  return EXIT_SUCCESS;
+}
+
+
+/* -------------------------------------------------------------------------- *
+ *
+ *
+ *
+ * ========================================================================== */
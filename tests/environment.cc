@@ -7,9 +7,13 @@
 #include <fstream>
 #include <iostream>
 
+#include <nix/util.hh>
 #include <nlohmann/json.hpp>
 
+#include "flox/core/nix-state.hh"
 #include "flox/core/util.hh"
+#include "flox/pkgdb/input.hh"
+#include "flox/pkgdb/write.hh"
 #include "flox/resolver/environment.hh"
 #include "flox/resolver/manifest.hh"
 #include "test.hh"
@@ -30,6 +34,7 @@ public:
 
   using Environment::Environment;
   using Environment::getGroupInput;
+  using Environment::getLockedInput;
   using Environment::groupIsLocked;
 };
 
@@ -739,6 +744,177 @@ test_createLockfile_new()
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+/** @brief `getLockedInput()` only constructs an input once. */
+bool
+test_getLockedInput0()
+{
+  ManifestRaw manifestRaw;
+  manifestRaw.options          = Options {};
+  manifestRaw.options->systems = { _system };
+
+  TestEnvironment environment( std::nullopt,
+                               EnvironmentManifest( manifestRaw ),
+                               std::nullopt );
+
+  LockedInputRaw lockedInput = helloLocked.input;
+  auto           first       = environment.getLockedInput( lockedInput );
+  auto           second      = environment.getLockedInput( lockedInput );
+  EXPECT( first.get_ptr() == second.get_ptr() );
+  EXPECT( first->getDbReadOnly()->fingerprint == lockedInput.fingerprint );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief `scrapeAttrPath()` adds a single package without marking its prefix
+ *        as scraped.
+ */
+bool
+test_scrapeAttrPath0()
+{
+  auto [fd, path] = nix::createTempFile( "test-scrapeAttrPath.sqlite" );
+  fd.close();
+  std::filesystem::remove( path );
+
+  NixState             nstate;
+  nix::ref<nix::Store> store = nstate.getStore();
+  pkgdb::PkgDbInput    input( store,
+                              static_cast<RegistryInput>( helloLocked.input ),
+                              path,
+                              pkgdb::PkgDbInput::db_path_tag {} );
+
+  EXPECT( input.scrapeAttrPath( helloLocked.attrPath ) );
+  EXPECT( input.getDbReadOnly()->hasPackage( helloLocked.attrPath ) );
+  EXPECT( ! input.getDbReadOnly()->completedAttrSet(
+    AttrPath { helloLocked.attrPath.at( 0 ), helloLocked.attrPath.at( 1 ) } ) );
+
+  /* Attributes which previously failed to evaluate aren't evaluated. */
+  AttrPath prefix { helloLocked.attrPath.at( 0 ),
+                    helloLocked.attrPath.at( 1 ) };
+  AttrPath cowsay = prefix;
+  cowsay.emplace_back( "cowsay" );
+  {
+    auto dbRW = input.getDbReadWrite();
+    dbRW->addEvalError( dbRW->addOrGetAttrSetId( prefix ),
+                        "cowsay",
+                        "throw",
+                        "cowsay is intentionally broken" );
+  }
+  input.closeDbReadWrite();
+  EXPECT( input.scrapeAttrPath( cowsay ) );
+  EXPECT( ! input.getDbReadOnly()->hasPackage( cowsay ) );
+
+  std::filesystem::remove( path );
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief `mayHaveMatches()` rules out names missing from scraped prefixes.
+ */
+bool
+test_mayHaveMatches0()
+{
+  auto [fd, path] = nix::createTempFile( "test-mayHaveMatches.sqlite" );
+  fd.close();
+  std::filesystem::remove( path );
+
+  NixState             nstate;
+  nix::ref<nix::Store> store = nstate.getStore();
+  pkgdb::PkgDbInput    input( store,
+                              static_cast<RegistryInput>( helloLocked.input ),
+                              path,
+                              pkgdb::PkgDbInput::db_path_tag {} );
+
+  pkgdb::PkgQueryArgs args;
+  args.systems  = { _system };
+  args.subtrees = std::vector<Subtree> { ST_LEGACY };
+  args.pname    = "not-a-package";
+
+  /* Nothing can be ruled out before scraping. */
+  EXPECT( input.mayHaveMatches( args ) );
+
+  /* Mark the prefix as scraped with only `hello' in it. */
+  AttrPath prefix { helloLocked.attrPath.at( 0 ),
+                    helloLocked.attrPath.at( 1 ) };
+  EXPECT( input.scrapeAttrPath( helloLocked.attrPath ) );
+  {
+    auto dbRW = input.getDbReadWrite();
+    dbRW->setPrefixDone( prefix, true );
+    dbRW->updateBestCandidates( prefix );
+  }
+  input.closeDbReadWrite();
+
+  EXPECT( ! input.mayHaveMatches( args ) );
+  args.pname = "hello";
+  EXPECT( input.mayHaveMatches( args ) );
+
+  args.pname   = std::nullopt;
+  args.relPath = AttrPath { "hello" };
+  EXPECT( input.mayHaveMatches( args ) );
+  args.relPath = AttrPath { "python3Packages", "hello" };
+  EXPECT( input.mayHaveMatches( args ) );
+  args.relPath = AttrPath { "not-a-package" };
+  EXPECT( ! input.mayHaveMatches( args ) );
+
+  /* Names are reloaded once scraping adds packages. */
+  args.relPath = std::nullopt;
+  args.pname   = "cowsay";
+  EXPECT( ! input.mayHaveMatches( args ) );
+  input.getDbReadWrite()->setPrefixDone( prefix, false );
+  input.closeDbReadWrite();
+  AttrPath cowsay = prefix;
+  cowsay.emplace_back( "cowsay" );
+  EXPECT( input.scrapeAttrPath( cowsay ) );
+  input.getDbReadWrite()->setPrefixDone( prefix, true );
+  input.closeDbReadWrite();
+  EXPECT( input.mayHaveMatches( args ) );
+
+  std::filesystem::remove( path );
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief A @a PkgDbInput constructed from a locked input's fingerprint opens
+ *        the same database as one which locks the flake.
+ */
+bool
+test_PkgDbInput_fingerprint0()
+{
+  std::filesystem::path cacheDir = nix::createTempDir();
+
+  NixState             nstate;
+  nix::ref<nix::Store> store = nstate.getStore();
+  auto                 registryInput
+    = static_cast<RegistryInput>( helloLocked.input );
+
+  /* Create the database by locking the flake. */
+  pkgdb::PkgDbInput locked( store, registryInput, cacheDir );
+  EXPECT( locked.getDbReadOnly()->fingerprint
+          == helloLocked.input.fingerprint );
+
+  pkgdb::PkgDbInput fromFingerprint( store,
+                                     registryInput,
+                                     helloLocked.input.fingerprint,
+                                     cacheDir );
+  EXPECT( fromFingerprint.getDbPath() == locked.getDbPath() );
+  EXPECT_EQ( fromFingerprint.getNameOrURL(), locked.getNameOrURL() );
+
+  std::filesystem::remove_all( cacheDir );
+  return true;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 /** @brief `createLockfile()` reuses existing lockfile entry. */
@@ -887,6 +1063,12 @@ main()
   RUN_TEST( getGroupInput2 );
   RUN_TEST( getGroupInput3 );
 
+  RUN_TEST( getLockedInput0 );
+
+  RUN_TEST( scrapeAttrPath0 );
+  RUN_TEST( mayHaveMatches0 );
+  RUN_TEST( PkgDbInput_fingerprint0 );
+
   RUN_TEST( createLockfile_new );
   RUN_TEST( createLockfile_existing );
   RUN_TEST( createLockfile_both );
@@ -0,0 +1,215 @@
+#! /usr/bin/env bats
+# -*- mode: bats; -*-
+# ============================================================================ #
+#
+# `pkgdb list' and `pkgdb gc' CLI tests.
+#
+# This test relies on `pkgdb scrape` working correctly, and tests will be
+# skipped if attempts to produce a shared db fail.
+#
+#
+# ---------------------------------------------------------------------------- #
+
+load setup_suite.bash;
+
+# bats file_tags=cli,gc
+
+
+# ---------------------------------------------------------------------------- #
+
+setup_file() {
+  export DBPATH="$BATS_FILE_TMPDIR/test.sqlite";
+  mkdir -p "$BATS_FILE_TMPDIR";
+  if $PKGDB scrape --database "$DBPATH" "$NIXPKGS_REF"           \
+                   legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  then
+    echo "Scraped flake $NIXPKGS_REF" >&3;
+    export SKIP_SCRAPED=;
+  else
+    echo "Failed to scrape flake $NIXPKGS_REF" >&3;
+    echo "Some tests will be skipped" >&3;
+    export SKIP_SCRAPED=:;
+  fi
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+require_shared() {
+  if test -n "${SKIP_SCRAPED:-}"; then
+    skip "This test requires \`pkgdb scrape', but a failure was encountered.";
+  fi
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# Create a cache directory holding a copy of the shared database.
+setup_cachedir() {
+  export CACHEDIR="$BATS_TEST_TMPDIR/cache";
+  mkdir -p "$CACHEDIR";
+  cp "$DBPATH" "$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=gc
+
+@test "pkgdb gc --help" {
+  run $PKGDB gc --help;
+  assert_success;
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=list
+
+# Databases are listed from the cache index, which is not itself listed.
+@test "pkgdb list --json" {
+  require_shared;
+  setup_cachedir;
+  run sh -c 'pkgdb list --cachedir "$CACHEDIR" --json > list.json;';
+  assert_success;
+
+  assert test -f "$CACHEDIR/index.sqlite";
+
+  run jq -r 'keys|length' list.json;
+  assert_success;
+  assert_output '1';
+
+  run jq -r '.[].fingerprint' list.json;
+  assert_success;
+  assert_output "$NIXPKGS_FINGERPRINT";
+
+  run jq -r '.[].size > 0' list.json;
+  assert_success;
+  assert_output 'true';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=list
+
+# Read-only cache directories are listed without creating an index.
+@test "pkgdb list --json with a read-only cachedir" {
+  require_shared;
+  setup_cachedir;
+  chmod a-w "$CACHEDIR";
+  if test -w "$CACHEDIR"; then
+    chmod u+w "$CACHEDIR";
+    skip "This test requires an unprivileged user.";
+  fi
+
+  run sh -c 'pkgdb list --cachedir "$CACHEDIR" --json > list.json;';
+  chmod u+w "$CACHEDIR";
+  assert_success;
+
+  refute test -e "$CACHEDIR/index.sqlite";
+
+  run jq -r '.[].fingerprint' list.json;
+  assert_success;
+  assert_output "$NIXPKGS_FINGERPRINT";
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=gc
+
+# Databases are only deleted when the cache exceeds the maximum size.
+@test "pkgdb gc --max-size" {
+  require_shared;
+  setup_cachedir;
+
+  run $PKGDB gc --cachedir "$CACHEDIR" --max-size 1G;
+  assert_success;
+  assert_output '';
+  assert test -f "$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+
+  run $PKGDB gc --cachedir "$CACHEDIR" --max-size 0 --dry-run;
+  assert_success;
+  assert_output "$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+  assert test -f "$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+
+  run $PKGDB gc --cachedir "$CACHEDIR" --max-size 0;
+  assert_success;
+  assert_output "$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+  refute test -f "$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+
+  run $PKGDB list --cachedir "$CACHEDIR";
+  assert_success;
+  assert_output '';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=gc
+
+# Databases locked by a process scraping them are not deleted.
+@test "pkgdb gc skips locked databases" {
+  require_shared;
+  if ! command -v flock >/dev/null; then
+    skip "This test requires \`flock'.";
+  fi
+  setup_cachedir;
+  _db="$CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite";
+
+  run flock "$_db.lock" $PKGDB gc --cachedir "$CACHEDIR" --max-size 0;
+  assert_success;
+  assert_output '';
+  assert test -f "$_db";
+  assert test -f "$_db.lock";
+
+  run $PKGDB gc --cachedir "$CACHEDIR" --max-size 0;
+  assert_success;
+  assert_output "$_db";
+  refute test -e "$_db";
+  refute test -e "$_db.lock";
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=gc, list
+
+# Shards which haven't been merged are listed and collected with the database
+# they belong to.
+@test "pkgdb gc collects shards" {
+  require_shared;
+  export CACHEDIR="$BATS_TEST_TMPDIR/cache";
+  _shard_dir="$CACHEDIR/$NIXPKGS_FINGERPRINT";
+  mkdir -p "$_shard_dir";
+  cp "$DBPATH" "$_shard_dir/legacyPackages.$NIX_SYSTEM.sqlite";
+
+  run $PKGDB list --cachedir "$CACHEDIR";
+  assert_success;
+  assert_output --partial " $_shard_dir.sqlite";
+
+  run $PKGDB gc --cachedir "$CACHEDIR" --max-size 0;
+  assert_success;
+  assert_output "$_shard_dir.sqlite";
+  refute test -e "$_shard_dir";
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=gc
+
+@test "pkgdb gc --max-size rejects invalid sizes" {
+  for _size in '' -1 1T 1KB 99999999999999999999 18014398509481984G; do
+    run $PKGDB gc --cachedir "$BATS_TEST_TMPDIR" --max-size "$_size";
+    assert_failure;
+  done
+}
+
+
+# ---------------------------------------------------------------------------- #
+#
+#
+#
+# ============================================================================ #
@@ -224,6 +224,120 @@ jq_edit() {
 }
 
 
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=resolver:lockfile
+
+# Locking with an up to date lockfile returns it without re-locking.
+@test "'pkgdb manifest lock' reuses lockfile with unchanged inputs" {
+  setup_project;
+
+  run sh -c 'pkgdb manifest lock manifest.json > manifest.lock;';
+  assert_success;
+
+  run jq -r '.["inputs-hash"]' manifest.lock;
+  assert_success;
+  refute_output 'null';
+
+  # Re-locking would reset `priority' from the manifest, so a modified value
+  # shows that the old lockfile was returned as is.
+  jq_edit manifest.lock '.packages["x86_64-linux"].nodejs.priority=42';
+  run sh -c 'pkgdb manifest lock --lockfile manifest.lock manifest.json  \
+               > manifest.lock2;';
+  assert_success;
+
+  run jq -r '.packages["x86_64-linux"].nodejs.priority' manifest.lock2;
+  assert_success;
+  assert_output '42';
+
+  # Changing the manifest causes a re-lock.
+  jq_edit manifest.json '.install.nodejs.priority=3';
+  run sh -c 'pkgdb manifest lock --lockfile manifest.lock manifest.json  \
+               > manifest.lock3;';
+  assert_success;
+
+  run jq -r '.packages["x86_64-linux"].nodejs.priority' manifest.lock3;
+  assert_success;
+  assert_output '3';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=resolver:lockfile
+
+# Manifests without `options.systems' lock the current system, so changing the
+# current system must cause a re-lock.
+@test "'pkgdb manifest lock' re-locks when the current system changes" {
+  setup_project;
+  jq_edit manifest.json 'del( .options.systems )|.install={}';
+
+  run sh -c 'NIX_CONFIG="system = x86_64-linux"                      \
+               pkgdb manifest lock manifest.json > manifest.lock;';
+  assert_success;
+
+  run sh -c 'NIX_CONFIG="system = aarch64-darwin"                    \
+               pkgdb manifest lock --lockfile manifest.lock manifest.json  \
+                 > manifest.lock2;';
+  assert_success;
+
+  run jq -r '.packages|keys|join( " " )' manifest.lock2;
+  assert_success;
+  assert_output 'aarch64-darwin';
+
+  run sh -c 'jq -r ".[\"inputs-hash\"]" manifest.lock manifest.lock2  \
+               |uniq|wc -l|tr -d " ";';
+  assert_success;
+  assert_output '2';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=resolver:lockfile, resolver:lock-many
+
+# Locking many manifests emits one line per manifest in the order given.
+@test "'pkgdb manifest lock-many' locks each manifest" {
+  setup_project "$BATS_TEST_TMPDIR/a";
+  setup_project "$BATS_TEST_TMPDIR/b";
+  jq_edit manifest.json '.install.nodejs.priority=3';
+  cd "$BATS_TEST_TMPDIR"||return;
+
+  run sh -c 'pkgdb manifest lock-many a/manifest.json b/manifest.json  \
+               > locks.jsonl;';
+  assert_success;
+
+  run jq -sr 'map( .manifest|split( "/" )[-2] )|join( " " )' locks.jsonl;
+  assert_success;
+  assert_output 'a b';
+
+  run jq -sr '.[1].lockfile.packages["x86_64-linux"].nodejs.priority'  \
+             locks.jsonl;
+  assert_success;
+  assert_output '3';
+
+  # Worker processes produce identical output.
+  run sh -c 'pkgdb manifest lock-many --jobs 2 a/manifest.json        \
+               b/manifest.json > locks2.jsonl;';
+  assert_success;
+  run diff locks.jsonl locks2.jsonl;
+  assert_success;
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=resolver:lock-many
+
+@test "'pkgdb manifest lock-many --jobs' rejects invalid counts" {
+  for _jobs in 0 -1 two; do
+    run pkgdb manifest lock-many --jobs "$_jobs" a/manifest.json;
+    assert_failure;
+    refute_output --partial 'invalid_argument';
+  done
+}
+
+
 # ---------------------------------------------------------------------------- #
 #
 #
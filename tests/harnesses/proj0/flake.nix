@@ -110,6 +110,24 @@
       default = pkgs.pkg0;
     } );
 
+    # A small package set with attributes that fail to evaluate.
+    legacyPackages = eachDefaultSystemMap ( system: let
+      pkgs = builtins.getAttr system pkgsFor;
+    in {
+      inherit (pkgs) pkg0;
+      evil0 = throw "evil0 is intentionally broken";
+      evil1 = assert false; pkgs.pkg1;
+      # Reads a file about a billion times, so it is effectively only
+      # finished by an evaluation budget.
+      # Reading files checks for interrupts, and nested folds keep the stack
+      # and lists small.
+      slow0 = let
+        file  = ./flake.nix;
+        size  = n: _: n + ( builtins.stringLength ( builtins.readFile file ) );
+        inner = n: _: builtins.foldl' size n ( builtins.genList ( x: x ) 1024 );
+      in builtins.foldl' inner 0 ( builtins.genList ( x: x ) 1048576 );
+    } );
+
   };
 
 
@@ -57,6 +57,126 @@ test_LockedPackageRawFromJSON0()
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+/** @brief `Lockfile` provides references to locked packages by system. */
+bool
+test_getLockedPackage0()
+{
+  using namespace flox::resolver;
+  nlohmann::json json
+    = { { "input",
+          { { "fingerprint", nixpkgsFingerprintStr },
+            { "url", nixpkgsRef },
+            { "attrs",
+              { { "owner", "NixOS" },
+                { "repo", "nixpkgs" },
+                { "rev", nixpkgsRev } } } } },
+        { "attr-path", { "legacyPackages", "x86_64-linux", "hello" } },
+        { "priority", 5 },
+        { "info", {} } };
+
+  LockfileRaw raw;
+  raw.manifest.install
+    = { { "hello", std::nullopt }, { "world", std::nullopt } };
+  raw.manifest.options = flox::resolver::Options {};
+  raw.manifest.options->systems = { "x86_64-linux" };
+  raw.packages                  = { { "x86_64-linux",
+                                      { { "hello", LockedPackageRaw( json ) },
+                                        { "world", std::nullopt } } } };
+  Lockfile lockfile( raw );
+
+  const SystemPackages * packages
+    = lockfile.getSystemPackages( "x86_64-linux" );
+  EXPECT( packages != nullptr );
+  EXPECT_EQ( packages->size(), std::size_t( 2 ) );
+  EXPECT( lockfile.getSystemPackages( "aarch64-darwin" ) == nullptr );
+
+  const auto * hello = lockfile.getLockedPackage( "x86_64-linux", "hello" );
+  EXPECT( ( hello != nullptr ) && hello->has_value() );
+  EXPECT( &packages->at( "hello" ) == hello );
+
+  const auto * world = lockfile.getLockedPackage( "x86_64-linux", "world" );
+  EXPECT( ( world != nullptr ) && ( ! world->has_value() ) );
+
+  EXPECT( lockfile.getLockedPackage( "x86_64-linux", "curl" ) == nullptr );
+  EXPECT( lockfile.getLockedPackage( "aarch64-darwin", "hello" ) == nullptr );
+
+  /* Groups are only computed once. */
+  EXPECT( &lockfile.getManifest().getGroupedDescriptors()
+          == &lockfile.getManifest().getGroupedDescriptors() );
+  EXPECT_EQ( lockfile.getManifest().getGroupedDescriptors().size(),
+             std::size_t( 1 ) );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Lockfile inputs hashes only change when manifests or locked systems
+ *        change.
+ */
+bool
+test_getLockfileInputsHash0()
+{
+  using namespace flox::resolver;
+  ManifestRaw manifest;
+  manifest.install = { { "hello", std::nullopt } };
+  std::vector<flox::System> systems = { "x86_64-linux" };
+
+  std::string hash = getLockfileInputsHash( manifest, std::nullopt, systems );
+  EXPECT_EQ( hash, getLockfileInputsHash( manifest, std::nullopt, systems ) );
+
+  GlobalManifestRaw globalManifest;
+  globalManifest.options          = Options {};
+  globalManifest.options->systems = { "x86_64-linux" };
+  EXPECT( hash != getLockfileInputsHash( manifest, globalManifest, systems ) );
+
+  ManifestRaw changed = manifest;
+  changed.install     = { { "hello", std::nullopt }, { "curl", std::nullopt } };
+  EXPECT( hash != getLockfileInputsHash( changed, std::nullopt, systems ) );
+
+  /* A manifest without `options.systems' locks the current system, so the
+   * same manifest must hash differently on another system. */
+  EXPECT( hash
+          != getLockfileInputsHash( manifest,
+                                    std::nullopt,
+                                    { "aarch64-darwin" } ) );
+
+  /* The hash is preserved by serialization. */
+  LockfileRaw raw;
+  raw.manifest   = manifest;
+  raw.inputsHash = hash;
+  nlohmann::json json = raw;
+  EXPECT_EQ( json.at( "inputs-hash" ).get<std::string>(), hash );
+  EXPECT( json.get<LockfileRaw>().inputsHash == hash );
+
+  /* Lockfiles without a hash don't emit one. */
+  raw.inputsHash = std::nullopt;
+  json           = raw;
+  EXPECT( ! json.contains( "inputs-hash" ) );
+
+  /* Lockfiles from before `inputs-hash' was added are still accepted, but
+   * newer versions are not. */
+  EXPECT_EQ( json.at( "lockfile-version" ).get<unsigned>(), LOCKFILE_VERSION );
+  json["lockfile-version"] = 0;
+  raw                      = json.get<LockfileRaw>();
+  raw.check();
+  raw.lockfileVersion = LOCKFILE_VERSION + 1;
+  try
+    {
+      raw.check();
+      return false;
+    }
+  catch ( const InvalidLockfileException & )
+    {}
+
+  return true;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int
@@ -70,6 +190,10 @@ main()
 
   RUN_TEST( LockedPackageRawFromJSON0 );
 
+  RUN_TEST( getLockedPackage0 );
+
+  RUN_TEST( getLockfileInputsHash0 );
+
   return exitCode;
 }
 
@@ -279,6 +279,66 @@ setup_file() {
 }
 
 
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=eval-errors
+
+# Attributes which fail to evaluate are remembered across scrapes.
+# `slow0' never finishes, so scrapes which evaluate it need a budget.
+@test "evaluation errors are recorded" {
+  _dbpath="$BATS_TEST_TMPDIR/errors.sqlite";
+  run $PKGDB scrape --time-budget 10 --database "$_dbpath"        \
+                    "$TEST_HARNESS_FLAKE" legacyPackages "$NIX_SYSTEM";
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT attrName FROM Packages";
+  assert_output 'pkg0';
+  run sqlite3 "$_dbpath" "SELECT attrName FROM EvalErrors ORDER BY attrName";
+  assert_output "$( printf 'evil0\nevil1\nslow0'; )";
+
+  # Known failures are skipped, but not forgotten.
+  run $PKGDB scrape --force --database "$_dbpath" "$TEST_HARNESS_FLAKE"  \
+                    legacyPackages "$NIX_SYSTEM";
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM EvalErrors";
+  assert_output '3';
+
+  # Retried failures are recorded again.
+  run $PKGDB scrape --retry-errors --time-budget 10               \
+                    --database "$_dbpath" "$TEST_HARNESS_FLAKE"    \
+                    legacyPackages "$NIX_SYSTEM";
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM EvalErrors";
+  assert_output '3';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=eval-errors,budget
+
+# Attributes which exceed a budget are skipped, and others are still scraped.
+@test "pkgdb scrape --time-budget --alloc-budget" {
+  _dbpath="$BATS_TEST_TMPDIR/budget.sqlite";
+  run $PKGDB scrape --time-budget 0 --database "$_dbpath"         \
+                    "$TEST_HARNESS_FLAKE" legacyPackages "$NIX_SYSTEM";
+  assert_failure;
+  run $PKGDB scrape --alloc-budget 1X --database "$_dbpath"       \
+                    "$TEST_HARNESS_FLAKE" legacyPackages "$NIX_SYSTEM";
+  assert_failure;
+
+  # Only `slow0' exceeds generous budgets.
+  run $PKGDB scrape --time-budget 10 --alloc-budget 64G           \
+                    --database "$_dbpath" "$TEST_HARNESS_FLAKE"    \
+                    legacyPackages "$NIX_SYSTEM";
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT attrName FROM Packages";
+  assert_output 'pkg0';
+  run sqlite3 "$_dbpath" "SELECT attrName FROM EvalErrors          \
+    WHERE errorClass = 'budget'";
+  assert_output 'slow0';
+}
+
+
 # ---------------------------------------------------------------------------- #
 #
 #
@@ -19,11 +19,14 @@
  * -------------------------------------------------------------------------- */
 
 #include <assert.h>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
 #include <list>
+#include <memory>
 #include <queue>
+#include <thread>
 
 #include <nix/eval-cache.hh>
 #include <nix/eval.hh>
@@ -36,6 +39,8 @@
 #include "flox/core/types.hh"
 #include "flox/flox-flake.hh"
 #include "flox/pkgdb/db-package.hh"
+#include "flox/pkgdb/eval-watchdog.hh"
+#include "flox/pkgdb/package-writer.hh"
 #include "flox/pkgdb/pkg-query.hh"
 #include "flox/pkgdb/write.hh"
 #include "test.hh"
@@ -74,7 +79,8 @@ clearTables( flox::pkgdb::PkgDb & db )
 {
   /* Clear DB */
   db.execute_all(
-    "DELETE FROM Packages; DELETE FROM AttrSets; DELETE FROM Descriptions" );
+    "DELETE FROM Packages; DELETE FROM EvalErrors; DELETE FROM AttrSets; "
+    "DELETE FROM Descriptions" );
 }
 
 /* -------------------------------------------------------------------------- */
@@ -965,6 +971,793 @@ test_getPackages_semver0( flox::pkgdb::PkgDb & db )
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Tests that `PkgQueryBatch` produces the same best matches as running
+ * individual `PkgQuery`s.
+ */
+bool
+test_PkgQueryBatch0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+
+  /* Make packages */
+  row_id linux = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux" } );
+  row_id desc
+    = db.addOrGetDescriptionId( "A program with a friendly greeting/farewell" );
+  sqlite3pp::command cmd( db.db, R"SQL(
+    INSERT INTO Packages (
+      parentId, attrName, name, pname, version, semver, license, outputs
+    , outputsToInstall, broken, unfree, descriptionId
+    ) VALUES
+      ( :parentId, 'hello0', 'hello-2.12', 'hello', '2.12', '2.12.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false, :descriptionId
+      )
+    , ( :parentId, 'hello1', 'hello-2.13.1', 'hello', '2.13.1', '2.13.1'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false, :descriptionId
+      )
+    , ( :parentId, 'hello2', 'hello-3', 'hello', '3', '3.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false, :descriptionId
+      )
+    , ( :parentId, 'goodbye', 'goodbye-1.0', 'goodbye', '1.0', '1.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', true, false, :descriptionId
+      )
+  )SQL" );
+  cmd.bind( ":parentId", static_cast<long long>( linux ) );
+  cmd.bind( ":descriptionId", static_cast<long long>( desc ) );
+  if ( flox::pkgdb::sql_rc rc = cmd.execute(); flox::pkgdb::isSQLError( rc ) )
+    {
+      throw flox::pkgdb::PkgDbException(
+        nix::fmt( "Failed to write Packages:(%d) %s", rc, db.db.error_msg() ) );
+    }
+
+  flox::pkgdb::PkgQueryArgs qargs;
+  qargs.systems = std::vector<std::string> { "x86_64-linux" };
+
+  std::vector<flox::pkgdb::PkgQueryArgs> queries;
+
+  /* Latest `hello' */
+  qargs.pnameOrAttrName = "hello";
+  queries.emplace_back( qargs );
+
+  /* `hello' in a semver range */
+  qargs.semver = "^2";
+  queries.emplace_back( qargs );
+  qargs.semver = std::nullopt;
+
+  /* `hello' by exact version */
+  qargs.version = "2.12";
+  queries.emplace_back( qargs );
+  qargs.version = std::nullopt;
+
+  /* `goodbye' is broken */
+  qargs.pnameOrAttrName = "goodbye";
+  queries.emplace_back( qargs );
+
+  /* `hello' in the wrong subtree */
+  qargs.pnameOrAttrName = "hello";
+  qargs.subtrees        = std::vector<flox::Subtree> { flox::ST_PACKAGES };
+  queries.emplace_back( qargs );
+
+  std::vector<std::optional<row_id>> expected;
+  for ( const auto & query : queries )
+    {
+      auto rows = flox::pkgdb::PkgQuery( query ).execute( db.db );
+      if ( rows.empty() ) { expected.emplace_back( std::nullopt ); }
+      else { expected.emplace_back( rows.front() ); }
+    }
+
+  flox::pkgdb::PkgQueryBatch batch( queries );
+  auto                       rows = batch.execute( db.db );
+  EXPECT_EQ( rows.size(), expected.size() );
+  EXPECT( rows == expected );
+
+  EXPECT( rows.at( 0 ) == db.getPackageId(
+            flox::AttrPath { "legacyPackages", "x86_64-linux", "hello2" } ) );
+  EXPECT( rows.at( 1 ) == db.getPackageId(
+            flox::AttrPath { "legacyPackages", "x86_64-linux", "hello1" } ) );
+  EXPECT( rows.at( 2 ) == db.getPackageId(
+            flox::AttrPath { "legacyPackages", "x86_64-linux", "hello0" } ) );
+  EXPECT( ! rows.at( 3 ).has_value() );
+  EXPECT( ! rows.at( 4 ).has_value() );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests that `lookupRelPath` resolves fully specified paths directly. */
+bool
+test_lookupRelPath0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+
+  /* Make packages */
+  row_id linux = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux" } );
+  sqlite3pp::command cmd( db.db, R"SQL(
+    INSERT INTO Packages (
+      parentId, attrName, name, pname, version, semver, license, outputs
+    , outputsToInstall, broken, unfree
+    ) VALUES
+      ( :parentId, 'hello', 'hello-2.12', 'hello', '2.12', '2.12.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false
+      )
+    , ( :parentId, 'goodbye', 'goodbye-1.0', 'goodbye', '1.0', '1.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', true, false
+      )
+  )SQL" );
+  cmd.bind( ":parentId", static_cast<long long>( linux ) );
+  if ( flox::pkgdb::sql_rc rc = cmd.execute(); flox::pkgdb::isSQLError( rc ) )
+    {
+      throw flox::pkgdb::PkgDbException(
+        nix::fmt( "Failed to write Packages:(%d) %s", rc, db.db.error_msg() ) );
+    }
+  row_id hello = db.getPackageId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux", "hello" } );
+  row_id goodbye = db.getPackageId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux", "goodbye" } );
+
+  flox::pkgdb::PkgQueryArgs qargs;
+  qargs.relPath = flox::AttrPath { "hello" };
+
+  auto rsl = flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" );
+  EXPECT( rsl.has_value() );
+  EXPECT( *rsl == std::vector<row_id> { hello } );
+  EXPECT( flox::pkgdb::PkgQuery( qargs ).execute( db.db ) == *rsl );
+
+  /* Filters still apply. */
+  qargs.pnameOrAttrName = "goodbye";
+  rsl = flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" );
+  EXPECT( rsl.has_value() && rsl->empty() );
+
+  qargs.relPath = flox::AttrPath { "goodbye" };
+  rsl           = flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" );
+  EXPECT( rsl.has_value() && rsl->empty() );
+
+  qargs.allowBroken = true;
+  rsl = flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" );
+  EXPECT( rsl.has_value() );
+  EXPECT( *rsl == std::vector<row_id> { goodbye } );
+
+  /* Missing packages and systems. */
+  qargs.pnameOrAttrName = std::nullopt;
+  qargs.relPath         = flox::AttrPath { "missing" };
+  rsl = flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" );
+  EXPECT( rsl.has_value() && rsl->empty() );
+
+  qargs.relPath = flox::AttrPath { "hello" };
+  rsl           = flox::pkgdb::lookupRelPath( db.db, qargs, "aarch64-darwin" );
+  EXPECT( rsl.has_value() && rsl->empty() );
+
+  /* Version constraints must be ranked. */
+  qargs.version = "2.12";
+  EXPECT( ! flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" )
+              .has_value() );
+  qargs.version = std::nullopt;
+
+  /* Matches in multiple subtrees must be ranked. */
+  row_id packages
+    = db.addOrGetAttrSetId( flox::AttrPath { "packages", "x86_64-linux" } );
+  cmd.reset();
+  cmd.bind( ":parentId", static_cast<long long>( packages ) );
+  if ( flox::pkgdb::sql_rc rc = cmd.execute(); flox::pkgdb::isSQLError( rc ) )
+    {
+      throw flox::pkgdb::PkgDbException(
+        nix::fmt( "Failed to write Packages:(%d) %s", rc, db.db.error_msg() ) );
+    }
+  EXPECT( ! flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" )
+              .has_value() );
+
+  qargs.subtrees = std::vector<flox::Subtree> { flox::ST_LEGACY };
+  rsl = flox::pkgdb::lookupRelPath( db.db, qargs, "x86_64-linux" );
+  EXPECT( rsl.has_value() );
+  EXPECT( *rsl == std::vector<row_id> { hello } );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests that `BestCandidates` rankings agree with `PkgQuery`. */
+bool
+test_BestCandidates0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+  db.execute( "DELETE FROM BestCandidates" );
+
+  /* Make packages */
+  flox::AttrPath prefix = { "legacyPackages", "x86_64-linux" };
+  row_id         linux  = db.addOrGetAttrSetId( prefix );
+  row_id         python = db.addOrGetAttrSetId( "python3Packages", linux );
+  sqlite3pp::command cmd( db.db, R"SQL(
+    INSERT INTO Packages (
+      parentId, attrName, name, pname, version, semver, license, outputs
+    , outputsToInstall, broken, unfree
+    ) VALUES
+      ( :parentId, 'hello', 'hello-2.12', 'hello', '2.12', '2.12.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false
+      )
+    , ( :parentId, 'hello_3', 'hello-3', 'hello', '3', '3.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', true, false
+      )
+    , ( :parentId, 'hello_4', 'hello-4', 'hello', '4', '4.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, true
+      )
+    , ( :parentId, 'goodbye', 'farewell-1.0', 'farewell', '1.0', '1.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false
+      )
+    , ( :pythonId, 'hello', 'hello-9', 'hello', '9', '9.0.0'
+      , 'GPL-3.0-or-later', '["out"]', '["out"]', false, false
+      )
+  )SQL" );
+  cmd.bind( ":parentId", static_cast<long long>( linux ) );
+  cmd.bind( ":pythonId", static_cast<long long>( python ) );
+  if ( flox::pkgdb::sql_rc rc = cmd.execute(); flox::pkgdb::isSQLError( rc ) )
+    {
+      throw flox::pkgdb::PkgDbException(
+        nix::fmt( "Failed to write Packages:(%d) %s", rc, db.db.error_msg() ) );
+    }
+
+  flox::pkgdb::PkgQueryArgs qargs;
+  qargs.systems         = std::vector<std::string> { "x86_64-linux" };
+  qargs.pnameOrAttrName = "hello";
+
+  /* Rankings aren't used until the prefix is scraped. */
+  EXPECT( ! flox::pkgdb::lookupBestCandidate( db.db, qargs, "x86_64-linux" )
+              .has_value() );
+
+  db.setPrefixDone( prefix, true );
+  db.updateBestCandidates( prefix );
+
+  for ( const auto & name : { "hello", "hello_3", "farewell", "goodbye" } )
+    {
+      qargs.pnameOrAttrName = name;
+      for ( const bool allowBroken : { false, true } )
+        {
+          for ( const bool allowUnfree : { false, true } )
+            {
+              qargs.allowBroken = allowBroken;
+              qargs.allowUnfree = allowUnfree;
+              auto rsl          = flox::pkgdb::lookupBestCandidate( db.db,
+                                                           qargs,
+                                                           "x86_64-linux" );
+              EXPECT( rsl.has_value() );
+              auto expected = flox::pkgdb::PkgQuery( qargs ).execute( db.db );
+              if ( ! expected.empty() ) { expected.resize( 1 ); }
+              EXPECT( *rsl == expected );
+            }
+        }
+    }
+
+  /* Prefixes that don't exist have no candidates. */
+  qargs.pnameOrAttrName = "hello";
+  auto rsl = flox::pkgdb::lookupBestCandidate( db.db, qargs, "aarch64-darwin" );
+  EXPECT( rsl.has_value() && rsl->empty() );
+
+  /* Non-default parameters must be ranked. */
+  qargs.semver = "^2";
+  EXPECT( ! flox::pkgdb::lookupBestCandidate( db.db, qargs, "x86_64-linux" )
+              .has_value() );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests that `getPackageNames` lists names from completed prefixes. */
+bool
+test_getPackageNames0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+  db.execute( "DELETE FROM BestCandidates" );
+
+  flox::AttrPath prefix = { "legacyPackages", "x86_64-linux" };
+  row_id         linux  = db.addOrGetAttrSetId( prefix );
+  sqlite3pp::command cmd( db.db, R"SQL(
+    INSERT INTO Packages (
+      parentId, attrName, name, pname, version, semver, outputs
+    , outputsToInstall, broken, unfree
+    ) VALUES
+      ( :parentId, 'hello', 'hello-2.12', 'hello', '2.12', '2.12.0'
+      , '["out"]', '["out"]', false, false
+      )
+    , ( :parentId, 'goodbye', 'farewell-1.0', 'farewell', '1.0', '1.0.0'
+      , '["out"]', '["out"]', true, true
+      )
+  )SQL" );
+  cmd.bind( ":parentId", static_cast<long long>( linux ) );
+  if ( flox::pkgdb::sql_rc rc = cmd.execute(); flox::pkgdb::isSQLError( rc ) )
+    {
+      throw flox::pkgdb::PkgDbException(
+        nix::fmt( "Failed to write Packages:(%d) %s", rc, db.db.error_msg() ) );
+    }
+
+  /* Names are only listed for completed prefixes. */
+  EXPECT( ! db.getPackageNames( prefix ).has_value() );
+
+  db.setPrefixDone( prefix, true );
+  db.updateBestCandidates( prefix );
+
+  auto names = db.getPackageNames( prefix );
+  EXPECT( names.has_value() );
+  EXPECT( *names
+          == ( std::vector<std::string> { "farewell", "goodbye", "hello" } ) );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Tests that prefixes scraped as a skeleton are distinguished from those
+ * with `meta` fields, and aren't used to answer queries which need them.
+ */
+bool
+test_skeletonAttrSet0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+  db.execute( "DELETE FROM BestCandidates" );
+
+  flox::AttrPath prefix = { "legacyPackages", "x86_64-linux" };
+  row_id         linux  = db.addOrGetAttrSetId( prefix );
+
+  flox::pkgdb::PackageRow row;
+  row.parentId = linux;
+  row.attrName = "hello";
+  row.name     = "hello-2.12";
+  row.pname    = "hello";
+  row.version  = "2.12";
+  row.semver   = "2.12.0";
+  row.outputs  = { "out" };
+  row.skeleton = true;
+  db.addPackage( row );
+
+  /* Incomplete prefixes aren't skeletons. */
+  EXPECT( ! db.skeletonAttrSet( prefix ) );
+
+  db.setPrefixDone( prefix, true, true );
+  db.updateBestCandidates( prefix );
+  EXPECT( db.completedAttrSet( prefix ) );
+  EXPECT( db.skeletonAttrSet( prefix ) );
+  EXPECT( db.skeletonAttrSet(
+    flox::AttrPath { "legacyPackages", "x86_64-linux", "python3Packages" } ) );
+
+  /* Names are still listed, but rankings depend on `broken' and `unfree'. */
+  EXPECT( db.getPackageNames( prefix ).has_value() );
+  flox::pkgdb::PkgQueryArgs qargs;
+  qargs.systems         = std::vector<std::string> { "x86_64-linux" };
+  qargs.pnameOrAttrName = "hello";
+  EXPECT( ! flox::pkgdb::lookupBestCandidate( db.db, qargs, "x86_64-linux" )
+              .has_value() );
+
+  /* Default parameters filter on `broken', but don't match by `meta'. */
+  EXPECT( qargs.needsMeta() );
+  EXPECT( ! qargs.matchesMeta() );
+
+  /* Skeleton packages can't be filtered by `meta' fields, directly or by
+   * their `relPath'. */
+  EXPECT( flox::pkgdb::PkgQuery( qargs ).execute( db.db ).empty() );
+  qargs.relPath = flox::AttrPath { "hello" };
+  EXPECT( flox::pkgdb::PkgQuery( qargs ).execute( db.db ).empty() );
+  qargs.relPath = std::nullopt;
+
+  qargs.allowBroken = true;
+  EXPECT( ! qargs.needsMeta() );
+  EXPECT_EQ( flox::pkgdb::PkgQuery( qargs ).execute( db.db ).size(),
+             std::size_t( 1 ) );
+  qargs.allowUnfree = false;
+  EXPECT( flox::pkgdb::PkgQuery( qargs ).execute( db.db ).empty() );
+  qargs.allowUnfree = true;
+
+  qargs.partialMatch = "hel";
+  EXPECT( qargs.needsMeta() );
+  EXPECT( qargs.matchesMeta() );
+
+  /* Clearing `done' also clears `skeleton'. */
+  db.setPrefixDone( prefix, false, true );
+  EXPECT( ! db.skeletonAttrSet( prefix ) );
+  db.setPrefixDone( prefix, true );
+  EXPECT( ! db.skeletonAttrSet( prefix ) );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests that attributes which failed to evaluate are remembered. */
+bool
+test_EvalErrors0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+
+  row_id linux = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux" } );
+  row_id darwin = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-darwin" } );
+
+  EXPECT( db.getEvalErrors( linux ).empty() );
+
+  db.addEvalError( linux, "evil0", "throw", "oh no" );
+  db.addEvalError( linux, "evil1", "assert", "assertion 'false' failed" );
+  db.addEvalError( darwin, "evil0", "eval", "oh no" );
+
+  auto errors = db.getEvalErrors( linux );
+  EXPECT_EQ( errors.size(), std::size_t( 2 ) );
+  EXPECT_EQ( errors.at( "evil0" ), "throw" );
+  EXPECT_EQ( errors.at( "evil1" ), "assert" );
+
+  /* Recording an attribute again replaces its error. */
+  db.addEvalError( linux, "evil0", "abort", "evaluation aborted" );
+  errors = db.getEvalErrors( linux );
+  EXPECT_EQ( errors.size(), std::size_t( 2 ) );
+  EXPECT_EQ( errors.at( "evil0" ), "abort" );
+
+  /* Clearing is limited to a single attribute set. */
+  db.clearEvalErrors( linux );
+  EXPECT( db.getEvalErrors( linux ).empty() );
+  EXPECT_EQ( db.getEvalErrors( darwin ).size(), std::size_t( 1 ) );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests that `PkgQueryBatch` resolves members for each of their systems. */
+bool
+test_PkgQueryBatch1( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+
+  /* Make packages */
+  row_id linux = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux" } );
+  row_id darwin = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-darwin" } );
+  sqlite3pp::command cmd( db.db, R"SQL(
+    INSERT INTO Packages (
+      parentId, attrName, name, pname, version, semver, outputs
+    ) VALUES
+      ( :linux, 'hello', 'hello-2.12', 'hello', '2.12', '2.12.0', '["out"]' )
+    , ( :darwin, 'hello', 'hello-2.12', 'hello', '2.12', '2.12.0', '["out"]' )
+    , ( :linux, 'curl', 'curl-8.1.1', 'curl', '8.1.1', '8.1.1', '["out"]' )
+  )SQL" );
+  cmd.bind( ":linux", static_cast<long long>( linux ) );
+  cmd.bind( ":darwin", static_cast<long long>( darwin ) );
+  if ( flox::pkgdb::sql_rc rc = cmd.execute(); flox::pkgdb::isSQLError( rc ) )
+    {
+      throw flox::pkgdb::PkgDbException(
+        nix::fmt( "Failed to write Packages:(%d) %s", rc, db.db.error_msg() ) );
+    }
+
+  flox::pkgdb::PkgQueryArgs qargs;
+  qargs.systems = std::vector<std::string> { "x86_64-linux", "x86_64-darwin" };
+
+  std::vector<flox::pkgdb::PkgQueryArgs> queries;
+  qargs.pnameOrAttrName = "hello";
+  queries.emplace_back( qargs );
+  qargs.pnameOrAttrName = "curl";
+  queries.emplace_back( qargs );
+
+  flox::pkgdb::PkgQueryBatch batch( queries );
+  auto                       rows = batch.executeBySystem( db.db );
+  EXPECT_EQ( rows.size(), std::size_t( 2 ) );
+
+  EXPECT_EQ( rows.at( 0 ).size(), std::size_t( 2 ) );
+  EXPECT_EQ( rows.at( 0 ).at( "x86_64-linux" ),
+             db.getPackageId(
+               flox::AttrPath { "legacyPackages", "x86_64-linux", "hello" } ) );
+  EXPECT_EQ( rows.at( 0 ).at( "x86_64-darwin" ),
+             db.getPackageId( flox::AttrPath { "legacyPackages",
+                                               "x86_64-darwin",
+                                               "hello" } ) );
+
+  /* `curl' is missing on `x86_64-darwin'. */
+  EXPECT_EQ( rows.at( 1 ).size(), std::size_t( 1 ) );
+  EXPECT( rows.at( 1 ).contains( "x86_64-linux" ) );
+
+
+  /* `semver' is applied to every member, like `PkgQuery'. */
+  queries.clear();
+  qargs.pnameOrAttrName = "hello";
+  qargs.semver          = "^3";
+  queries.emplace_back( qargs );
+  EXPECT( flox::pkgdb::PkgQueryBatch( queries ).execute( db.db ).front()
+          == std::nullopt );
+
+  /* Mixing `version' and `semver' is rejected, like `PkgQuery'. */
+  queries.front().version = "2.12";
+  try
+    {
+      flox::pkgdb::PkgQueryBatch mixed( queries );
+      return false;
+    }
+  catch ( const flox::pkgdb::InvalidPkgQueryArg & )
+    {}
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests memoizing query results with `cacheQuery' and `getCachedQuery'. */
+bool
+test_QueryCache0( flox::pkgdb::PkgDb & db )
+{
+  db.clearQueryCache();
+
+  flox::pkgdb::PkgQueryArgs qargs;
+  qargs.pnameOrAttrName = "hello";
+  qargs.systems         = std::vector<std::string> { "x86_64-linux" };
+  std::string key       = flox::pkgdb::getQueryCacheKey( qargs );
+
+  /* Keys reflect `systems', but not their order. */
+  qargs.systems = std::vector<std::string> { "x86_64-darwin" };
+  EXPECT( key != flox::pkgdb::getQueryCacheKey( qargs ) );
+  qargs.systems = std::vector<std::string> { "x86_64-linux", "x86_64-darwin" };
+  key           = flox::pkgdb::getQueryCacheKey( qargs );
+  qargs.systems = std::vector<std::string> { "x86_64-darwin", "x86_64-linux" };
+  EXPECT_EQ( key, flox::pkgdb::getQueryCacheKey( qargs ) );
+
+  /* Keys reflect other arguments. */
+  qargs.allowBroken = true;
+  EXPECT( key != flox::pkgdb::getQueryCacheKey( qargs ) );
+
+  EXPECT( ! db.getCachedQuery( key ).has_value() );
+
+  std::unordered_map<flox::System, row_id> results
+    = { { "x86_64-linux", 1 }, { "x86_64-darwin", 2 } };
+  db.cacheQuery( key, results );
+  auto cached = db.getCachedQuery( key );
+  EXPECT( cached.has_value() );
+  EXPECT( *cached == results );
+
+  db.clearQueryCache();
+  EXPECT( ! db.getCachedQuery( key ).has_value() );
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests writing packages with a `PackageWriter' thread. */
+bool
+test_PackageWriter0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+
+  row_id parentId = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux" } );
+
+  {
+    /* Use a tiny queue and batches to exercise waiting on the writer. */
+    flox::pkgdb::PackageWriter writer( db, 1, 2 );
+    for ( const char * attrName : { "phony0", "phony1", "phony2" } )
+      {
+        flox::pkgdb::PackageRow row;
+        row.parentId    = parentId;
+        row.attrName    = attrName;
+        row.name        = std::string( attrName ) + "-1.0.0";
+        row.pname       = attrName;
+        row.version     = "1.0.0";
+        row.outputs     = { "out" };
+        row.description = "A phony package";
+        writer.push( std::move( row ) );
+      }
+    writer.finish();
+    try
+      {
+        /* Ensure we throw an error for packages pushed after finishing. */
+        writer.push( flox::pkgdb::PackageRow {} );
+        return false;
+      }
+    catch ( const flox::pkgdb::PkgDbException & )
+      { /* Expected */
+      }
+  }
+
+  for ( const char * attrName : { "phony0", "phony1", "phony2" } )
+    {
+      EXPECT( db.hasPackage(
+        flox::AttrPath { "legacyPackages", "x86_64-linux", attrName } ) );
+    }
+
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Tests that scraped fields are recorded, and that fields skipped by
+ * existing packages remain skipped.
+ */
+bool
+test_setScrapeFields0( flox::pkgdb::PkgDb & db )
+{
+  clearTables( db );
+  db.execute( "DELETE FROM DbVersions WHERE name = 'pkgdb_scrape_fields'" );
+
+  /* Databases without a record scraped every field. */
+  EXPECT( db.getScrapeFields() == flox::pkgdb::ScrapeFields {} );
+
+  /* Empty databases may switch fields freely. */
+  auto fields = nlohmann::json::array( { "description" } )
+                  .get<flox::pkgdb::ScrapeFields>();
+  EXPECT( db.setScrapeFields( fields ) == fields );
+  EXPECT( db.setScrapeFields( {} ) == flox::pkgdb::ScrapeFields {} );
+  EXPECT( db.setScrapeFields( fields ) == fields );
+  EXPECT( db.getScrapeFields() == fields );
+  EXPECT_EQ( nlohmann::json( fields ).dump(), "[\"description\"]" );
+
+  row_id parentId = db.addOrGetAttrSetId(
+    flox::AttrPath { "legacyPackages", "x86_64-linux" } );
+  flox::pkgdb::PackageRow row;
+  row.parentId = parentId;
+  row.attrName = "phony";
+  row.name     = "phony-1.0.0";
+  row.pname    = "phony";
+  row.outputs  = { "bin", "out", "dev" };
+  db.addPackage( row );
+
+  /* Skipped columns must be `NULL'. */
+  {
+    sqlite3pp::query qry( db.db,
+                          "SELECT outputsToInstall IS NULL FROM Packages" );
+    EXPECT( ( *qry.begin() ).get<bool>( 0 ) );
+  }
+
+  /* Skipped `outputsToInstall' falls back to outputs up to `out'. */
+  {
+    flox::pkgdb::DbPackage pkg(
+      static_cast<flox::pkgdb::PkgDbReadOnly &>( db ),
+      flox::AttrPath { "legacyPackages", "x86_64-linux", "phony" } );
+    EXPECT( pkg.getOutputsToInstall()
+            == ( std::vector<std::string> { "bin", "out" } ) );
+  }
+
+  /* Skipped `broken' and `unfree' columns are unknown, so packages
+   * aren't filtered by them. */
+  {
+    flox::pkgdb::PkgQueryArgs qargs;
+    qargs.systems = { "x86_64-linux" };
+    EXPECT_EQ( flox::pkgdb::PkgQuery( qargs ).execute( db.db ).size(),
+               std::size_t( 1 ) );
+    qargs.allowUnfree = false;
+    EXPECT_EQ( flox::pkgdb::PkgQuery( qargs ).execute( db.db ).size(),
+               std::size_t( 1 ) );
+
+    /* Queries may not filter on a skipped `license' column. */
+    qargs.licenses = std::vector<std::string> { "MIT" };
+    try
+      {
+        (void) flox::pkgdb::PkgQuery( qargs ).execute( db.db );
+        return false;
+      }
+    catch ( const flox::pkgdb::InvalidPkgQueryArg & )
+      { /* Expected */
+      }
+  }
+
+  /* Fields missing from existing packages can't be added back. */
+  EXPECT( db.setScrapeFields( {} ) == fields );
+  EXPECT( db.getScrapeFields() == fields );
+
+  try
+    {
+      (void) nlohmann::json::array( { "phony" } )
+        .get<flox::pkgdb::ScrapeFields>();
+      return false;
+    }
+  catch ( const flox::pkgdb::PkgDbException & )
+    { /* Expected */
+    }
+
+  clearTables( db );
+  db.execute( "DELETE FROM DbVersions WHERE name = 'pkgdb_scrape_fields'" );
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/** Tests that `busyHandler' retries until `DB_BUSY_TIMEOUT' has elapsed. */
+bool
+test_busyHandler0()
+{
+  EXPECT( flox::pkgdb::busyHandler( 0 ) != 0 );
+  EXPECT( flox::pkgdb::busyHandler( 4 ) != 0 );
+  /* Enough attempts to have exceeded the timeout at the maximum delay. */
+  EXPECT_EQ( flox::pkgdb::busyHandler(
+               static_cast<int>( flox::pkgdb::DB_BUSY_TIMEOUT.count() ) ),
+             0 );
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Tests that `EvalWatchdog' interrupts evaluation which exceeds its budget,
+ * once for each attribute it is armed for.
+ */
+bool
+test_EvalWatchdog0()
+{
+  bool hadCheck = static_cast<bool>( nix::interruptCheck );
+  {
+    flox::pkgdb::EvalWatchdog watchdog( std::chrono::milliseconds( 10 ),
+                                        std::nullopt );
+    for ( int attr = 0; attr < 2; ++attr )
+      {
+        watchdog.arm();
+        auto deadline
+          = std::chrono::steady_clock::now() + std::chrono::seconds( 5 );
+        bool interrupted = false;
+        while ( ( ! interrupted )
+                && ( std::chrono::steady_clock::now() < deadline ) )
+          {
+            try
+              {
+                nix::checkInterrupt();
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+              }
+            catch ( const flox::pkgdb::EvalBudgetExceeded & )
+              {
+                interrupted = true;
+              }
+          }
+        EXPECT( interrupted );
+      }
+
+    /* Disarmed watchdogs don't interrupt. */
+    watchdog.arm();
+    watchdog.disarm();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    nix::checkInterrupt();
+  }
+  EXPECT_EQ( static_cast<bool>( nix::interruptCheck ), hadCheck );
+  return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Tests that a write waits for another connection to release its lock rather
+ * than failing with `SQLITE_BUSY'.
+ */
+bool
+test_busyHandler1( flox::pkgdb::PkgDb & db )
+{
+  flox::pkgdb::PkgDb other( db.fingerprint, db.dbPath.string() );
+
+  auto txn = std::make_unique<sqlite3pp::transaction>( other.db, false, true );
+  std::thread release(
+    [&]()
+    {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+      txn->commit();
+    } );
+
+  row_id row = db.addOrGetAttrSetId( "busyHandler1" );
+  release.join();
+  EXPECT( row != 0 );
+
+  return true;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int
@@ -1020,6 +1813,25 @@ main( int argc, char * argv[] )
     RUN_TEST( DbPackage0, db );
 
     RUN_TEST( getPackages_semver0, db );
+
+    RUN_TEST( PkgQueryBatch0, db );
+    RUN_TEST( PkgQueryBatch1, db );
+
+    RUN_TEST( lookupRelPath0, db );
+    RUN_TEST( BestCandidates0, db );
+    RUN_TEST( getPackageNames0, db );
+    RUN_TEST( skeletonAttrSet0, db );
+    RUN_TEST( EvalErrors0, db );
+
+    RUN_TEST( QueryCache0, db );
+
+    RUN_TEST( PackageWriter0, db );
+
+    RUN_TEST( setScrapeFields0, db );
+
+    RUN_TEST( busyHandler0 );
+    RUN_TEST( EvalWatchdog0 );
+    RUN_TEST( busyHandler1, db );
   }
 
   /* XXX: You may find it useful to preserve the file and print it for some
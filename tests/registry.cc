@@ -11,6 +11,8 @@
 #include <fstream>
 #include <iostream>
 
+#include <nix/flake/flakeref.hh>
+#include <nix/store-api.hh>
 #include <nlohmann/json.hpp>
 
 #include "flox/core/util.hh"
@@ -116,6 +118,38 @@ test_EnvironmentManifest_NoIndirectRefs0()
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Test that errors fetching inputs concurrently are deferred until the
+ *        inputs are locked.
+ *
+ * `registry1.json` contains an indirect reference which cannot be fetched.
+ */
+bool
+test_prefetchRegistryInputs0()
+{
+  std::ifstream     regFile( TEST_DATA_DIR "/registry/registry1.json" );
+  nlohmann::json    json = nlohmann::json::parse( regFile ).at( "registry" );
+  flox::RegistryRaw regRaw;
+  json.get_to( regRaw );
+
+  nix::ref<nix::Store> store = flox::NixStoreMixin().getStore();
+  flox::prefetchRegistryInputs( regRaw, store );
+
+  /* Fetched inputs are in the store, while the unresolvable indirect input
+   * is skipped without throwing. */
+  for ( const auto * name : { "nixpkgs", "floco" } )
+    {
+      auto [tree, locked] = regRaw.inputs.at( name ).from->fetchTree( store );
+      EXPECT( store->isValidPath( tree.storePath ) );
+      EXPECT( locked.input.isLocked() );
+    }
+
+  return true;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int
@@ -134,6 +168,7 @@ main( int argc, char * argv[] )
   flox::NixState nstate;
 
   RUN_TEST( FloxFlakeInputRegistry0 );
+  RUN_TEST( prefetchRegistryInputs0 );
 
   RUN_TEST( EnvironmentManifest_getRegistryRaw0 );
   RUN_TEST( EnvironmentManifest_badPath0 );
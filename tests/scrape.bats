@@ -175,6 +175,124 @@ setup_file() {
 }
 
 
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=merge
+
+# Shards are only merged by default once their prefix is completely scraped.
+@test "pkgdb scrape --shard; pkgdb merge" {
+  export PKGDB_CACHEDIR="$BATS_TEST_TMPDIR/cache";
+  _shard_dir="$PKGDB_CACHEDIR/$NIXPKGS_FINGERPRINT";
+  run $PKGDB scrape --shard "$NIXPKGS_REF"                        \
+                    legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_success;
+  assert_output "$_shard_dir/legacyPackages.$NIX_SYSTEM.sqlite";
+
+  run $PKGDB merge "$_shard_dir";
+  assert_success;
+  assert_output "$_shard_dir.sqlite";
+  run test -e "$_shard_dir/legacyPackages.$NIX_SYSTEM.sqlite";
+  assert_success;
+
+  run $PKGDB merge --all "$_shard_dir";
+  assert_success;
+  run test -e "$_shard_dir";
+  assert_failure;
+  run sqlite3 "$_shard_dir.sqlite" "SELECT outputs FROM Packages      \
+    WHERE name = 'blobs.gg-unstable-2019-07-24' LIMIT 1";
+  assert_output '["out"]';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=fields
+
+# Skipped fields are stored as `NULL' and recorded in `DbVersions'.
+@test "pkgdb scrape --fields" {
+  _dbpath="$BATS_TEST_TMPDIR/fields.sqlite";
+  run $PKGDB scrape --database "$_dbpath" --fields description    \
+                    "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM Packages      \
+    WHERE ( outputsToInstall IS NOT NULL ) OR ( broken IS NOT NULL )";
+  assert_output '0';
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM Packages      \
+    WHERE descriptionId IS NULL";
+  assert_output '0';
+  run sh -c "$PKGDB get flake '$_dbpath'|jq -c '.fields';";
+  assert_output '["description"]';
+
+  # Fields skipped by existing packages can't be added back.
+  run $PKGDB scrape --database "$_dbpath" --fields none          \
+                    "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_success;
+  run sh -c "$PKGDB get flake '$_dbpath'|jq -c '.fields';";
+  assert_output '[]';
+
+  run $PKGDB scrape --database "$_dbpath" --fields phony         \
+                    "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_failure;
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=skeleton
+
+# Skeletons skip `meta' fields, which are backfilled by a later scrape.
+@test "pkgdb scrape --skeleton" {
+  _dbpath="$BATS_TEST_TMPDIR/skeleton.sqlite";
+  run $PKGDB scrape --database "$_dbpath" --skeleton              \
+                    "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM Packages      \
+    WHERE ( NOT skeleton ) OR ( descriptionId IS NOT NULL )";
+  assert_output '0';
+  run sqlite3 "$_dbpath" "SELECT pname FROM Packages      \
+    WHERE name = 'blobs.gg-unstable-2019-07-24' LIMIT 1";
+  assert_output 'blobs.gg';
+
+  run $PKGDB scrape --database "$_dbpath"                         \
+                    "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_success;
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM Packages WHERE skeleton";
+  assert_output '0';
+  run sqlite3 "$_dbpath" "SELECT descriptionId IS NOT NULL FROM Packages      \
+    WHERE name = 'blobs.gg-unstable-2019-07-24' LIMIT 1";
+  assert_output '1';
+  run sqlite3 "$_dbpath" "SELECT COUNT( * ) FROM AttrSets WHERE skeleton";
+  assert_output '0';
+}
+
+
+# ---------------------------------------------------------------------------- #
+
+@test "pkgdb scrape --eval-cache" {
+  run $PKGDB scrape --eval-cache bogus                            \
+                    --database "$BATS_TEST_TMPDIR/bogus.sqlite"   \
+                    "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM" 'akkoma-emoji';
+  assert_failure;
+
+  # Each mode scrapes the same packages.
+  for _mode in rw warm none; do
+    run $PKGDB scrape --eval-cache "$_mode"                        \
+                      --database "$BATS_TEST_TMPDIR/$_mode.sqlite" \
+                      "$NIXPKGS_REF" legacyPackages "$NIX_SYSTEM"  \
+                      'akkoma-emoji';
+    assert_success;
+  done
+  _count="$( sqlite3 "$BATS_TEST_TMPDIR/rw.sqlite"                \
+                     "SELECT COUNT( * ) FROM Packages"; )";
+  [[ "$_count" -gt 0 ]];
+  for _mode in warm none; do
+    run sqlite3 "$BATS_TEST_TMPDIR/$_mode.sqlite"                 \
+                "SELECT COUNT( * ) FROM Packages";
+    assert_output "$_count";
+  done
+}
+
+
 # ---------------------------------------------------------------------------- #
 #
 #
@@ -532,6 +532,35 @@ genParamsNixpkgsFlox() {
 }
 
 
+# ---------------------------------------------------------------------------- #
+
+# bats test_tags=search:fields
+
+# Databases scraped without `broken' or `unfree' treat them as unknown, while
+# filters on other skipped columns are still rejected.
+@test "'pkgdb search' with a '--fields none' database" {
+  export PKGDB_CACHEDIR="$BATS_TEST_TMPDIR/pkgdbs";
+  run $PKGDB scrape --database "$PKGDB_CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite" \
+                    --fields none "$NIXPKGS_REF" legacyPackages x86_64-linux \
+                    'akkoma-emoji';
+  assert_success;
+
+  run --separate-stderr "$PKGDB" search "$TDATA/params0.json";
+  assert_success;
+  run [ "${#lines[@]}" -gt 0 ];
+  assert_success;
+
+  run sh -c "$PKGDB get flake                                        \
+               '$PKGDB_CACHEDIR/$NIXPKGS_FINGERPRINT.sqlite'|jq -c '.fields';";
+  assert_output '[]';
+
+  params="$( jq '.manifest.options.allow.licenses=["MIT"]'          \
+                "$TDATA/params0.json"; )";
+  run $PKGDB search "$params";
+  assert_failure;
+}
+
+
 # ---------------------------------------------------------------------------- #
 #
 #